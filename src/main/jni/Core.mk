@@ -12,6 +12,7 @@ LOCAL_CFLAGS += -pg -DNDK_PROFILER
 endif
 endif
 LOCAL_CFLAGS += -DAA_BITS=8
+LOCAL_CFLAGS += -DHAVE_PTHREADS
 ifdef MEMENTO
 LOCAL_CFLAGS += -DMEMENTO -DMEMENTO_LEAKONLY
 endif
@@ -322,4 +322,19 @@ fz_device *fz_new_draw_device_with_bbox(fz_context *ctx, fz_pixmap *dest, const
 
 fz_device *fz_new_draw_device_type3(fz_context *ctx, fz_pixmap *dest);
 
+/*
+	fz_set_draw_device_draft: Trade quality for speed in a draw
+	device, for renders that are soon to be replaced.
+
+	In draft mode paths are drawn without anti-aliasing, images
+	are decoded at a lower resolution and scaled without
+	interpolation, shadings are painted at a lower resolution,
+	transparency groups are drawn as opaque, and soft masked
+	content is left out. Text is still drawn from the
+	(anti-aliased) glyph cache.
+
+	Call before anything is drawn to the device.
+*/
+void fz_set_draw_device_draft(fz_context *ctx, fz_device *dev, int draft);
+
 #endif
@@ -73,6 +73,57 @@ fz_device *fz_new_list_device(fz_context *ctx, fz_display_list *list);
 */
 void fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, const fz_matrix *ctm, const fz_rect *area, fz_cookie *cookie);
 
+/*
+	fz_list_runner: A display list part way through being run through
+	a device. It holds the position in the list and the graphics state
+	unpacked so far; the device holds its own state (for a draw device,
+	the stack of clips and groups). So a long list can be run a slice
+	at a time, or an aborted run picked up where it stopped, as long as
+	the device is kept and nothing else is run through it meanwhile.
+
+	Between slices, a draw device's pixmap shows everything run so far
+	except what is inside a clip, mask or group still open.
+*/
+typedef struct fz_list_runner_s fz_list_runner;
+
+/*
+	fz_new_list_runner: Prepare to run a display list through a device,
+	with the same arguments as fz_run_display_list. Nothing is run until
+	fz_run_list_runner is called.
+
+	The runner keeps a reference to the list, but not to the device,
+	which must outlive it.
+*/
+fz_list_runner *fz_new_list_runner(fz_context *ctx, fz_display_list *list, fz_device *dev, const fz_matrix *ctm, const fz_rect *area);
+
+/*
+	fz_run_list_runner: Carry on running a display list from where the
+	runner last stopped.
+
+	max_nodes: Stop after this many display list nodes, or 0 for no
+	limit.
+
+	max_ms: Stop once this many milliseconds have passed, or 0 for no
+	limit. Nodes are not interrupted, so one slow node can overrun.
+
+	cookie: As for fz_run_display_list. The run also stops when it is
+	aborted, and can be carried on by calling again with the abort
+	flag cleared or another cookie. A node interrupted part way through
+	by an abort is not run again.
+
+	Returns 1 once the end of the list is reached, 0 if it stopped
+	early.
+*/
+int fz_run_list_runner(fz_context *ctx, fz_list_runner *runner, int max_nodes, int max_ms, fz_cookie *cookie);
+
+/*
+	fz_drop_list_runner: Free a runner, whether or not it reached the
+	end of its list.
+
+	Does not throw exceptions.
+*/
+void fz_drop_list_runner(fz_context *ctx, fz_list_runner *runner);
+
 /*
 	fz_keep_display_list: Keep a reference to a display list.
 
@@ -88,4 +139,16 @@ fz_display_list *fz_keep_display_list(fz_context *ctx, fz_display_list *list);
 */
 void fz_drop_display_list(fz_context *ctx, fz_display_list *list);
 
+/*
+	fz_display_list_size: Return the number of bytes of memory
+	taken up by the commands recorded in a display list, including
+	the text objects (glyph arrays) they refer to.
+
+	Other objects that the list holds references to (images,
+	fonts) are shared with other users and are not counted.
+
+	Does not throw exceptions.
+*/
+unsigned int fz_display_list_size(fz_context *ctx, fz_display_list *list);
+
 #endif
@@ -29,6 +29,7 @@ typedef int (fz_document_count_pages_fn)(fz_context *ctx, fz_document *doc);
 typedef fz_page *(fz_document_load_page_fn)(fz_context *ctx, fz_document *doc, int number);
 typedef int (fz_document_meta_fn)(fz_context *ctx, fz_document *doc, int key, void *ptr, int size);
 typedef void (fz_document_write_fn)(fz_context *ctx, fz_document *doc, char *filename, fz_write_options *opts);
+typedef void (fz_document_prefetch_pages_fn)(fz_context *ctx, fz_document *doc, int number, int ahead, int behind, int w, int h, unsigned int budget);
 
 typedef fz_link *(fz_page_load_links_fn)(fz_context *ctx, fz_page *page);
 typedef fz_rect *(fz_page_bound_page_fn)(fz_context *ctx, fz_page *page, fz_rect *);
@@ -67,6 +68,7 @@ struct fz_document_s
 	fz_document_load_page_fn *load_page;
 	fz_document_meta_fn *meta;
 	fz_document_write_fn *write;
+	fz_document_prefetch_pages_fn *prefetch_pages;
 };
 
 typedef fz_document *(fz_document_open_fn)(fz_context *ctx, const char *filename);
@@ -191,6 +193,27 @@ int fz_count_pages(fz_context *ctx, fz_document *doc);
 */
 fz_page *fz_load_page(fz_context *ctx, fz_document *doc, int number);
 
+/*
+	fz_prefetch_pages: Prepare the pages around the current one in
+	the background, so that turning to them does not wait for
+	decoding.
+
+	number: The page being shown.
+
+	ahead, behind: How many pages after and before it to prepare.
+
+	w, h: The size (in pixels) the pages will be rendered at.
+
+	budget: The most memory (in bytes) to hold for prepared pages;
+	0 releases everything held.
+
+	Each call replaces the previous request. Only document types
+	whose pages are single images (such as CBZ) do anything; for
+	others this is a no-op, as it is where the build or context
+	does not support threads.
+*/
+void fz_prefetch_pages(fz_context *ctx, fz_document *doc, int number, int ahead, int behind, int w, int h, unsigned int budget);
+
 /*
 	fz_load_links: Load the list of links for a page.
 
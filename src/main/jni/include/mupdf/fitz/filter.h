@@ -19,10 +19,12 @@ fz_stream *fz_open_a85d(fz_context *ctx, fz_stream *chain);
 fz_stream *fz_open_ahxd(fz_context *ctx, fz_stream *chain);
 fz_stream *fz_open_rld(fz_context *ctx, fz_stream *chain);
 fz_stream *fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables);
+fz_stream *fz_open_dctd_bands(fz_context *ctx, fz_buffer *buffer, int color_transform, int *l2factor);
 fz_stream *fz_open_faxd(fz_context *ctx, fz_stream *chain,
 	int k, int end_of_line, int encoded_byte_align,
 	int columns, int rows, int end_of_block, int black_is_1);
 fz_stream *fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits);
+fz_buffer *fz_inflate_buffer(fz_context *ctx, fz_buffer *in, int window_bits, int initial, int *truncated);
 fz_stream *fz_open_lzwd(fz_context *ctx, fz_stream *chain, int early_change);
 fz_stream *fz_open_predict(fz_context *ctx, fz_stream *chain, int predictor, int columns, int colors, int bpc);
 fz_stream *fz_open_jbig2d(fz_context *ctx, fz_stream *chain, fz_jbig2_globals *globals);
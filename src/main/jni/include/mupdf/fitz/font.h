@@ -78,6 +78,19 @@ fz_font *fz_load_system_cjk_font(fz_context *ctx, const char *name, int ros, int
 fz_font *fz_new_type3_font(fz_context *ctx, const char *name, const fz_matrix *matrix);
 
 fz_font *fz_new_font_from_memory(fz_context *ctx, const char *name, unsigned char *data, int len, int index, int use_glyph_bbox);
+/*
+	fz_new_shared_font_from_memory: Like fz_new_font_from_memory, for data
+	that is never freed (the built-in fonts). Every context sharing this
+	font context gets the same font back for the same data and index, so
+	callers must not change the font they are given.
+
+	The FT_Face charmap is shared state too: anyone selecting a charmap
+	and looking up glyphs through it must hold FZ_LOCK_FREETYPE across
+	both. fz_encode_character, used by html layout with these fonts,
+	expects the face's default Unicode charmap and sees whichever one a
+	PDF font last selected.
+*/
+fz_font *fz_new_shared_font_from_memory(fz_context *ctx, const char *name, unsigned char *data, int len, int index, int use_glyph_bbox);
 fz_font *fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox);
 fz_font *fz_new_font_from_file(fz_context *ctx, const char *name, const char *path, int index, int use_glyph_bbox);
 
@@ -81,10 +81,12 @@ struct fz_image_s
 };
 
 fz_pixmap *fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed);
+fz_pixmap *fz_load_jpx_region(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed, const fz_irect *area, int *l2factor);
 fz_pixmap *fz_load_png(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_tiff(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_jxr(fz_context *ctx, unsigned char *data, int size);
 
+void fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_jpeg_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_png_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_tiff_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
@@ -95,4 +97,47 @@ fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, i
 
 void fz_image_get_sanitised_res(fz_image *image, int *xres, int *yres);
 
+/*
+	Image prefetching: decode images on a background thread ahead of
+	the time they are drawn, so that the draw device finds the pixmaps
+	already in the store.
+*/
+typedef struct fz_prefetcher_s fz_prefetcher;
+
+/*
+	fz_new_prefetcher: Start a background thread to decode images.
+
+	The thread runs with a clone of ctx, so ctx must have been created
+	with locking functions (see fz_clone_context).
+
+	Returns NULL if this is not possible (no locks, or no thread
+	support in this build); callers should then simply do without.
+*/
+fz_prefetcher *fz_new_prefetcher(fz_context *ctx);
+
+/*
+	fz_drop_prefetcher: Stop the thread, waiting for any image it is
+	decoding, and release the pixmaps it holds. The pixmaps stay in
+	the store until it needs the space.
+*/
+void fz_drop_prefetcher(fz_context *ctx, fz_prefetcher *pf);
+
+/*
+	fz_prefetch_images: Replace the list of images to decode.
+
+	images: The images, most wanted first. Images already decoded
+	(or being decoded) from the previous list are kept; pixmaps for
+	images that are no longer listed are released.
+
+	w, h: The size (in pixels) the images are expected to be drawn
+	at, as passed to fz_new_pixmap_from_image. Images are decoded at
+	the coarsest subsample factor that covers this size, which the
+	draw device will then pick up for any size up to it.
+
+	budget: The most memory (in bytes) to hold in decoded pixmaps.
+	Decoding stops at the first image that does not fit; 0 releases
+	everything.
+*/
+void fz_prefetch_images(fz_context *ctx, fz_prefetcher *pf, fz_image **images, int count, int w, int h, unsigned int budget);
+
 #endif
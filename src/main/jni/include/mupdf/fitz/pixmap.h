@@ -283,6 +283,35 @@ struct fz_pixmap_s
 void fz_drop_pixmap_imp(fz_context *ctx, fz_storable *pix);
 
 void fz_copy_pixmap_rect(fz_context *ctx, fz_pixmap *dest, fz_pixmap *src, const fz_irect *r);
+
+/*
+	fz_copy_pixmap_rect_to_rgb565: Copy part of an RGB or grey pixmap
+	into a buffer of 16 bit RGB 565 pixels, with ordered dithering.
+
+	dest: The top left pixel of the buffer.
+
+	stride: The number of bytes from one row of dest to the next.
+
+	dest_bbox: The area of the pixmap coordinate space that dest covers.
+
+	r: The area to copy. It is clipped to both dest_bbox and src.
+
+	Alpha is ignored, so src should be opaque. The dither pattern is
+	fixed to the coordinate space, so areas copied separately from
+	different pixmaps join without seams.
+*/
+void fz_copy_pixmap_rect_to_rgb565(fz_context *ctx, unsigned char *dest, int stride, const fz_irect *dest_bbox, fz_pixmap *src, const fz_irect *r);
+
+/*
+	fz_copy_pixmap_rect_to_gray: Copy part of a grey or RGB pixmap into
+	a buffer of 8 bit grey pixels, with no alpha. RGB is converted to
+	luminance as fz_convert_pixmap does.
+
+	The arguments, and the handling of alpha, are as for
+	fz_copy_pixmap_rect_to_rgb565.
+*/
+void fz_copy_pixmap_rect_to_gray(fz_context *ctx, unsigned char *dest, int stride, const fz_irect *dest_bbox, fz_pixmap *src, const fz_irect *r);
+
 void fz_premultiply_pixmap(fz_context *ctx, fz_pixmap *pix);
 fz_pixmap *fz_alpha_from_gray(fz_context *ctx, fz_pixmap *gray, int luminosity);
 unsigned int fz_pixmap_size(fz_context *ctx, fz_pixmap *pix);
@@ -84,6 +84,26 @@ struct fz_store_hash_s
 	} u;
 };
 
+/*
+	Each type of key belongs to a tier, which decides how soon its items
+	are given up under memory pressure (see fz_store_pressure). Tiers
+	are listed cheapest to recreate first. The glyph cache is not part
+	of the store, but is given up with the last tier.
+
+	The tiles tier is empty in this tree: the draw device only stores
+	pattern tiles that have a non-zero id, and no interpreter or the
+	display list ever passes one. A host may count its own
+	caches of rendered tiles against it, as the Android viewer does.
+*/
+enum
+{
+	FZ_STORE_TIER_IMAGES,	/* decoded image tiles */
+	FZ_STORE_TIER_TILES,	/* rendered pattern tiles (none yet, see above) */
+	FZ_STORE_TIER_RESOURCES,	/* fonts, forms, shadings and other parsed resources */
+	FZ_STORE_TIER_GLYPHS,	/* rendered glyphs */
+	FZ_STORE_TIER_MAX
+};
+
 typedef struct fz_store_type_s fz_store_type;
 
 struct fz_store_type_s
@@ -92,6 +112,7 @@ struct fz_store_type_s
 	void *(*keep_key)(fz_context *,void *);
 	void (*drop_key)(fz_context *,void *);
 	int (*cmp_key)(fz_context *ctx, void *, void *);
+	int tier;
 #ifndef NDEBUG
 	void (*debug)(fz_context *ctx, FILE *, void *);
 #endif
@@ -164,6 +185,26 @@ void *fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_
 */
 void fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_type *type);
 
+/*
+	fz_filter_store: Evict every item of a given type for which a
+	filter function returns non zero.
+
+	drop: The function used to free the value (only items with this
+	drop function are considered), or NULL to consider every item of
+	the type.
+
+	fn: The filter function; called with the key and value of each
+	candidate item. This is called with the store lock held, so it
+	must not allocate or call back into the store.
+
+	arg: Opaque argument passed to the filter function.
+
+	type: Functions used to manipulate the key.
+*/
+typedef int (fz_store_filter_fn)(fz_context *ctx, void *arg, void *key, fz_storable *val);
+
+void fz_filter_store(fz_context *ctx, fz_store_drop_fn *drop, fz_store_filter_fn *fn, void *arg, fz_store_type *type);
+
 /*
 	fz_empty_store: Evict everything from the store.
 */
@@ -194,6 +235,40 @@ int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/*
+	Memory pressure levels reported by the host, from none to critical.
+*/
+enum
+{
+	FZ_STORE_PRESSURE_NONE,
+	FZ_STORE_PRESSURE_MODERATE,
+	FZ_STORE_PRESSURE_LOW,
+	FZ_STORE_PRESSURE_CRITICAL
+};
+
+/*
+	fz_store_pressure: Adapt the store to the memory pressure the host
+	reports.
+
+	The store budget is set to a fraction of the maximum given when the
+	store was created: all of it with no pressure, then 3/4, 1/2 and 1/4.
+	Each level above none empties one more tier outright, starting with
+	the decoded image tiles (as the tiles tier is empty, going from
+	moderate to low only lowers the budget); at critical pressure the
+	glyph cache is purged too. The remaining tiers are then trimmed, least recently
+	used first and in tier order, until the store fits its new budget.
+	Items that are in use elsewhere (for instance by the pages on
+	screen) are never evicted.
+
+	level: One of FZ_STORE_PRESSURE_*.
+
+	freed: If not NULL, FZ_STORE_TIER_MAX entries set to the number of
+	bytes given up from each tier.
+
+	Returns the total number of bytes given up.
+*/
+unsigned int fz_store_pressure(fz_context *ctx, int level, unsigned int *freed);
+
 /*
 	fz_print_store: Dump the contents of the store for debugging.
 */
@@ -31,6 +31,71 @@ fz_stream *fz_open_file(fz_context *ctx, const char *filename);
 fz_stream *fz_open_fd_progressive(fz_context *ctx, int fd, int bps);
 fz_stream *fz_open_file_progressive(fz_context *ctx, const char *filename, int bps);
 
+/*
+	fz_range_request_fn: Called by a ranged stream when it needs len
+	bytes at offset that it does not hold and has not asked for
+	before. The callee should start fetching them (typically with an
+	HTTP range request) and deliver them later with fz_range_supply.
+	Must not throw.
+*/
+typedef void (fz_range_request_fn)(fz_context *ctx, void *opaque, int offset, int len);
+
+/*
+	fz_range_poll_fn: Called by a ranged stream just before it gives
+	up on a read with FZ_ERROR_TRYLATER, so that data that has arrived
+	in the meantime can be handed over with fz_range_supply.
+*/
+typedef void (fz_range_poll_fn)(fz_context *ctx, void *opaque, fz_stream *stm);
+
+typedef void (fz_range_close_fn)(fz_context *ctx, void *opaque);
+
+/*
+	fz_open_ranged: Open a progressive stream over a remote file of
+	known length that is fetched in byte ranges on demand.
+
+	Reading bytes that have not arrived yet asks for them through
+	request (with some read ahead) and throws FZ_ERROR_TRYLATER; the
+	caller retries once more data has been supplied. Documents can
+	ask for the ranges they are about to need in advance with
+	FZ_STREAM_META_WANT.
+
+	poll and close may be NULL. close is called with opaque when the
+	stream is dropped.
+
+	The stream is not thread safe; fz_range_supply must be called from
+	the thread that uses the document, or from inside poll.
+*/
+fz_stream *fz_open_ranged(fz_context *ctx, int length, void *opaque, fz_range_request_fn *request, fz_range_poll_fn *poll, fz_range_close_fn *close);
+
+/*
+	fz_range_supply: Hand len bytes of the file starting at offset to
+	a stream opened with fz_open_ranged. Data may be supplied in any
+	size of chunk, but the chunks for any one range request should be
+	supplied in order.
+*/
+void fz_range_supply(fz_context *ctx, fz_stream *stm, int offset, const unsigned char *data, int len);
+
+/*
+	fz_range_missing: List the byte ranges that a ranged stream has
+	requested but not yet been supplied with, as offset/length pairs
+	in ranges (room for max pairs). Returns the number of ranges,
+	which may be larger than max.
+*/
+int fz_range_missing(fz_context *ctx, fz_stream *stm, int *ranges, int max);
+
+/*
+	fz_range_fetched: Return the number of bytes of the file that a
+	ranged stream holds.
+*/
+int fz_range_fetched(fz_context *ctx, fz_stream *stm);
+
+/*
+	fz_open_file_ranged: Open a local file as a ranged stream, with
+	the file standing in for a range server that delivers requested
+	ranges at bps bits per second (0 for no limit). For testing.
+*/
+fz_stream *fz_open_file_ranged(fz_context *ctx, const char *filename, int bps);
+
 /*
 	fz_open_file_w: Open the named file and wrap it in a stream.
 
@@ -150,7 +215,11 @@ fz_buffer *fz_read_file(fz_context *ctx, const char *filename);
 enum
 {
 	FZ_STREAM_META_PROGRESSIVE = 1,
-	FZ_STREAM_META_LENGTH = 2
+	FZ_STREAM_META_LENGTH = 2,
+	/* Hint that size bytes at offset *(int *)ptr will be needed
+	 * soon. Returns 1 if the stream fetches ranges on request; a size
+	 * of 0 just asks that. */
+	FZ_STREAM_META_WANT = 3
 };
 
 int fz_stream_meta(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr);
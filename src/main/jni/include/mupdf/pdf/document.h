@@ -211,6 +211,7 @@ struct pdf_document_s
 
 	/* State indicating which file parsing method we are using */
 	int file_reading_linearly;
+	int file_ranged; /* file fetches byte ranges on request */
 	int file_length;
 
 	pdf_obj *linear_obj; /* Linearized object (if used) */
@@ -4,6 +4,7 @@
 typedef struct pdf_csi_s pdf_csi;
 typedef struct pdf_gstate_s pdf_gstate;
 typedef struct pdf_processor_s pdf_processor;
+typedef struct pdf_content_tokens_s pdf_content_tokens;
 
 void *pdf_new_processor(fz_context *ctx, int size);
 void pdf_drop_processor(fz_context *ctx, pdf_processor *proc);
@@ -143,6 +144,13 @@ struct pdf_csi_s
 	int in_text;
 	fz_rect d1_rect;
 
+	/* tokenized content stream cache */
+	pdf_content_tokens *record;
+	pdf_content_tokens *replay;
+	int replay_pos;
+	int opcode;
+	int lexing;
+
 	/* stack */
 	pdf_obj *obj;
 	char name[256];
@@ -162,4 +170,11 @@ void pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *do
 void pdf_process_annot(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_page *page, pdf_annot *annot, fz_cookie *cookie);
 void pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *resources, fz_buffer *contents);
 
+/*
+	pdf_forget_content_tokens: Evict any tokenized copies of content
+	streams that depend on object num from the store. Called whenever
+	a stream is updated in place.
+*/
+void pdf_forget_content_tokens(fz_context *ctx, pdf_document *doc, int num);
+
 #endif
@@ -17,12 +17,36 @@ pdf_js_event *pdf_js_get_event(pdf_js *js);
 void pdf_js_execute(pdf_js *js, char *code);
 void pdf_js_execute_count(pdf_js *js, char *code, int count);
 
+/*
+	pdf_js_execute_obj: Execute the script held in a string or stream
+	object. Each script is compiled the first time and kept for as
+	long as javascript is enabled, keyed on the object.
+*/
+void pdf_js_execute_obj(pdf_js *js, pdf_obj *code);
+
+/*
+	Calculation dependencies. Between pdf_js_begin_calculate and
+	pdf_js_end_calculate, the fields that scripts look up with
+	getField() are recorded as the inputs of the calculated field,
+	along with their current values. pdf_js_calculate_needed then
+	tells whether any of those values (or that of the field itself)
+	has changed since, so that the calculation must be run again.
+	If the calculation fails, call pdf_js_abort_calculate instead of
+	pdf_js_end_calculate: it stops the tracing and forgets the field's
+	inputs, so that it is calculated again next time.
+*/
+int pdf_js_calculate_needed(pdf_js *js, pdf_obj *field);
+void pdf_js_begin_calculate(pdf_js *js);
+void pdf_js_end_calculate(pdf_js *js, pdf_obj *field);
+void pdf_js_abort_calculate(pdf_js *js, pdf_obj *field);
+
 /*
  * Javascript engine interface
  */
 typedef struct pdf_jsimp_s pdf_jsimp;
 typedef struct pdf_jsimp_type_s pdf_jsimp_type;
 typedef struct pdf_jsimp_obj_s pdf_jsimp_obj;
+typedef struct pdf_jsimp_script_s pdf_jsimp_script;
 
 typedef void (pdf_jsimp_dtr)(void *jsctx, void *obj);
 typedef pdf_jsimp_obj *(pdf_jsimp_method)(void *jsctx, void *obj, int argc, pdf_jsimp_obj *args[]);
@@ -67,4 +91,9 @@ pdf_jsimp_obj *pdf_jsimp_property(pdf_jsimp *imp, pdf_jsimp_obj *obj, char *prop
 void pdf_jsimp_execute(pdf_jsimp *imp, char *code);
 void pdf_jsimp_execute_count(pdf_jsimp *imp, char *code, int count);
 
+/* Compile once, run many times. Compiling returns NULL on syntax errors. */
+pdf_jsimp_script *pdf_jsimp_compile(pdf_jsimp *imp, char *code);
+void pdf_jsimp_run(pdf_jsimp *imp, pdf_jsimp_script *script);
+void pdf_jsimp_drop_script(pdf_jsimp *imp, pdf_jsimp_script *script);
+
 #endif
@@ -146,6 +146,7 @@ fz_rect *pdf_to_rect(fz_context *ctx, pdf_obj *array, fz_rect *rect);
 fz_matrix *pdf_to_matrix(fz_context *ctx, pdf_obj *array, fz_matrix *mat);
 
 pdf_document *pdf_get_indirect_document(fz_context *ctx, pdf_obj *obj);
+pdf_document *pdf_get_bound_document(fz_context *ctx, pdf_obj *obj);
 void pdf_set_str_len(fz_context *ctx, pdf_obj *obj, int newlen);
 void pdf_set_int(fz_context *ctx, pdf_obj *obj, int i);
 
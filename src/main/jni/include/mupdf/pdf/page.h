@@ -19,6 +19,14 @@ pdf_page *pdf_load_page(fz_context *ctx, pdf_document *doc, int number);
 
 fz_link *pdf_load_links(fz_context *ctx, pdf_page *page);
 
+/*
+	pdf_load_page_thumbnail: Load the thumbnail image stored in a
+	page's /Thumb entry, without loading the page itself.
+
+	Returns NULL if the page has no thumbnail.
+*/
+fz_image *pdf_load_page_thumbnail(fz_context *ctx, pdf_document *doc, int number);
+
 /*
 	pdf_bound_page: Determine the size of a page.
 
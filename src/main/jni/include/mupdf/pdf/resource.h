@@ -7,6 +7,8 @@
 void pdf_store_item(fz_context *ctx, pdf_obj *key, void *val, unsigned int itemsize);
 void *pdf_find_item(fz_context *ctx, fz_store_drop_fn *drop, pdf_obj *key);
 void pdf_remove_item(fz_context *ctx, fz_store_drop_fn *drop, pdf_obj *key);
+void pdf_filter_store(fz_context *ctx, fz_store_drop_fn *drop, fz_store_filter_fn *fn, void *arg);
+void pdf_empty_store(fz_context *ctx, pdf_document *doc);
 
 /*
  * Functions, Colorspaces, Shadings and Images
@@ -30,7 +30,33 @@
 #undef TIME_DISPLAY_LIST
 
 #define MAX_SEARCH_HITS (500)
-#define NUM_CACHE (3)
+/* Up to NUM_CACHE pages are kept loaded, for as long as their display
+ * lists fit in PAGE_CACHE_BUDGET */
+#define NUM_CACHE (16)
+#define PAGE_CACHE_BUDGET (32 << 20)
+/* Display lists for this many pages on either side of the visible one
+ * are built in the background */
+#define PREFETCH_LISTS (1)
+/* Image-based documents (CBZ) decode neighbouring pages in the background */
+#define PREFETCH_AHEAD (2)
+#define PREFETCH_BEHIND (1)
+#define PREFETCH_BUDGET (32 << 20)
+/* Rendered pixels are kept in tiles so that panning back over a page, or
+ * returning to a zoom level, need not rasterize the same area again */
+#define TILE_SIZE (256)
+#define TILE_CACHE_BUDGET (32 << 20)
+/* Drafts for RGB_565 bitmaps are drawn in bands of about this many bytes */
+#define DRAFT_BAND_SIZE (1 << 20)
+/* Thumbnails are rendered by this many threads, and at most THUMB_AHEAD
+ * of them are held until they are collected */
+#define THUMB_WORKERS (3)
+#define THUMB_AHEAD (16)
+/* ComponentCallbacks2.TRIM_MEMORY_* levels passed to trimMemory */
+#define TRIM_MEMORY_RUNNING_MODERATE (5)
+#define TRIM_MEMORY_RUNNING_LOW (10)
+#define TRIM_MEMORY_RUNNING_CRITICAL (15)
+#define TRIM_MEMORY_MODERATE (60)
+#define TRIM_MEMORY_COMPLETE (80)
 #define STRIKE_HEIGHT (0.375f)
 #define UNDERLINE_HEIGHT (0.075f)
 #define LINE_THICKNESS (0.07f)
@@ -54,6 +80,72 @@ struct rect_node_s
 	rect_node *next;
 };
 
+/* One display list per annotation, along with the state it was recorded
+ * from. The appearance stream is kept so that its address cannot be
+ * reused by another stream while the list is alive. */
+typedef struct annot_list_s annot_list;
+
+struct annot_list_s
+{
+	fz_annot *annot;
+	pdf_xobject *ap;
+	int ap_iteration;
+	int flags;
+	fz_matrix matrix;
+	fz_rect bounds;
+	fz_display_list *list;
+	annot_list *next;
+};
+
+/* A tile is identified by its page, the size the whole page is rendered
+ * at (which fixes the zoom to a whole number of pixels), whether it is
+ * gray, and its position in the grid of TILE_SIZE squares covering the
+ * page at that size. */
+typedef struct
+{
+	int page;
+	int page_w;
+	int page_h;
+	int gray;
+	int x;
+	int y;
+} tile_key;
+
+typedef struct tile_s tile;
+
+struct tile_s
+{
+	tile_key key;
+	fz_rect area;
+	fz_pixmap *pix;
+	tile *prev;
+	tile *next;
+};
+
+/* A tile whose rendering was aborted part way, kept so that asking for
+ * it again carries on from where it stopped rather than starting over. */
+typedef struct
+{
+	tile_key key;
+	fz_rect area;
+	fz_pixmap *pix;
+	fz_device *dev;
+	fz_list_runner *runner;
+} parked_tile;
+
+/* The bitmap being drawn. RGBA_8888 bitmaps are wrapped as pix and drawn
+ * into directly. RGB_565 ones are filled from RGBA tiles or bands, so
+ * no 32 bit copy of the whole bitmap is ever made. A_8 ones are treated
+ * as gray, and are filled from tiles rendered in gray throughout. */
+typedef struct
+{
+	fz_irect bbox;
+	int format;
+	fz_pixmap *pix;
+	unsigned char *samples;
+	int stride;
+} draw_target;
+
 typedef struct
 {
 	int number;
@@ -64,9 +156,68 @@ typedef struct
 	rect_node *changed_rects;
 	rect_node *hq_changed_rects;
 	fz_display_list *page_list;
-	fz_display_list *annot_list;
+	annot_list *annot_lists;
 } page_cache;
 
+typedef struct
+{
+	int number;
+	fz_display_list *list;
+} prefetched_list;
+
+/* The worker has its own context and its own handle on the document file,
+ * since a document may only be used by one thread at a time. Requests and
+ * results are passed under mutex. */
+typedef struct
+{
+	fz_context *ctx;
+	fz_document *doc;
+	char *path;
+	int broken;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	fz_cookie cookie;
+	int busy;
+	int wanted[2 * PREFETCH_LISTS];
+	int want[2 * PREFETCH_LISTS];
+	prefetched_list done[2 * PREFETCH_LISTS];
+} list_prefetcher;
+
+typedef struct thumbnailer_s thumbnailer;
+
+/* Like the list prefetcher, each thumbnail worker has its own context
+ * and its own handle on the document file */
+typedef struct
+{
+	thumbnailer *th;
+	fz_context *ctx;
+	fz_document *doc;
+	fz_cookie cookie;
+	pthread_t thread;
+	int started;
+	int broken;
+} thumb_worker;
+
+struct thumbnailer_s
+{
+	char *path;
+	int count;
+	int width;
+	int height;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	// Pages are handed out to workers in order, and collected in order.
+	// The result for page n is kept in slot n % THUMB_AHEAD.
+	int next_page;
+	int next_out;
+	int ready[THUMB_AHEAD];
+	fz_pixmap *pix[THUMB_AHEAD];
+	thumb_worker workers[THUMB_WORKERS];
+};
+
 typedef struct globals_s globals;
 
 struct globals_s
@@ -81,6 +232,28 @@ struct globals_s
 
 	page_cache pages[NUM_CACHE];
 
+	// A page loaded only to answer link, widget or annotation queries.
+	// It is kept apart so that those do not evict the pages being
+	// rendered, and is moved into the cache if the page is then shown.
+	fz_page *query_page;
+	int query_number;
+
+	list_prefetcher *prefetcher;
+
+	thumbnailer *thumbnailer;
+
+	// Rendered tiles of the cached pages, looked up by tile_key and
+	// chained from most to least recently used.
+	fz_hash_table *tiles;
+	tile *tiles_head;
+	tile *tiles_tail;
+	size_t tiles_size;
+	parked_tile parked;
+
+	// Memory pressure last reported by the host (FZ_STORE_PRESSURE_*).
+	// It scales down the budgets of the caches above.
+	int pressure;
+
 	int alerts_initialised;
 	// fin_lock and fin_lock2 are used during shutdown. The two waiting tasks
 	// show_alert and waitForAlertInternal respectively take these locks while
@@ -127,33 +300,92 @@ static void drop_changed_rects(fz_context *ctx, rect_node **nodePtr)
 	*nodePtr = NULL;
 }
 
+static void drop_annot_lists(fz_context *ctx, annot_list **nodePtr)
+{
+	annot_list *node = *nodePtr;
+	while (node)
+	{
+		annot_list *tnode = node;
+		node = node->next;
+		fz_drop_display_list(ctx, tnode->list);
+		pdf_drop_xobject(ctx, tnode->ap);
+		fz_free(ctx, tnode);
+	}
+
+	*nodePtr = NULL;
+}
+
+static void drop_tile(globals *glo, tile *t)
+{
+	fz_context *ctx = glo->ctx;
+
+	fz_hash_remove(ctx, glo->tiles, &t->key);
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		glo->tiles_head = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	else
+		glo->tiles_tail = t->prev;
+	glo->tiles_size -= fz_pixmap_size(ctx, t->pix);
+	fz_drop_pixmap(ctx, t->pix);
+	fz_free(ctx, t);
+}
+
+static void drop_parked_tile(globals *glo)
+{
+	fz_context *ctx = glo->ctx;
+
+	fz_drop_list_runner(ctx, glo->parked.runner);
+	fz_drop_device(ctx, glo->parked.dev);
+	fz_drop_pixmap(ctx, glo->parked.pix);
+	memset(&glo->parked, 0, sizeof(glo->parked));
+}
+
+/* Drop the tiles of a page that overlap the given area of it, or all of
+ * its tiles if area is NULL. */
+static void drop_tiles(globals *glo, int page, const fz_rect *area)
+{
+	tile *t = glo->tiles_head;
+
+	if (glo->parked.runner && glo->parked.key.page == page)
+	{
+		fz_rect r = glo->parked.area;
+		if (area == NULL || !fz_is_empty_rect(fz_intersect_rect(&r, area)))
+			drop_parked_tile(glo);
+	}
+
+	while (t)
+	{
+		tile *next = t->next;
+		if (t->key.page == page)
+		{
+			fz_rect r = t->area;
+			if (area == NULL || !fz_is_empty_rect(fz_intersect_rect(&r, area)))
+				drop_tile(glo, t);
+		}
+		t = next;
+	}
+}
+
 static void drop_page_cache(globals *glo, page_cache *pc)
 {
 	fz_context *ctx = glo->ctx;
 	fz_document *doc = glo->doc;
 
 	LOGI("Drop page %d", pc->number);
+	if (pc->page)
+		drop_tiles(glo, pc->number, NULL);
 	fz_drop_display_list(ctx, pc->page_list);
 	pc->page_list = NULL;
-	fz_drop_display_list(ctx, pc->annot_list);
-	pc->annot_list = NULL;
+	drop_annot_lists(ctx, &pc->annot_lists);
 	fz_drop_page(ctx, pc->page);
 	pc->page = NULL;
 	drop_changed_rects(ctx, &pc->changed_rects);
 	drop_changed_rects(ctx, &pc->hq_changed_rects);
 }
 
-static void dump_annotation_display_lists(globals *glo)
-{
-	fz_context *ctx = glo->ctx;
-	int i;
-
-	for (i = 0; i < NUM_CACHE; i++) {
-		fz_drop_display_list(ctx, glo->pages[i].annot_list);
-		glo->pages[i].annot_list = NULL;
-	}
-}
-
 static void show_alert(globals *glo, pdf_alert_event *alert)
 {
 	pthread_mutex_lock(&glo->fin_lock2);
@@ -270,163 +502,606 @@ static globals *get_globals_any_thread(JNIEnv *env, jobject thiz)
 	return (globals *)(intptr_t)((*env)->GetLongField(env, thiz, global_fid));
 }
 
-JNIEXPORT jlong JNICALL
-JNI_FN(MuPDFCore_openFile)(JNIEnv * env, jobject thiz, jstring jfilename)
+// The fitz locks are shared by all documents. Contexts need them to be
+// cloned for use on background threads, as the page prefetcher does.
+static pthread_mutex_t fitz_mutexes[FZ_LOCK_MAX];
+static pthread_once_t fitz_mutexes_once = PTHREAD_ONCE_INIT;
+
+static void init_fitz_mutexes(void)
 {
-	const char *filename;
-	globals *glo;
-	fz_context *ctx;
-	jclass clazz;
+	int i;
 
-#ifdef NDK_PROFILER
-	monstartup("libmupdf.so");
-#endif
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		pthread_mutex_init(&fitz_mutexes[i], NULL);
+}
 
-	clazz = (*env)->GetObjectClass(env, thiz);
-	global_fid = (*env)->GetFieldID(env, clazz, "globals", "J");
+static void lock_fitz(void *user, int lock)
+{
+	pthread_mutex_lock(&((pthread_mutex_t *)user)[lock]);
+}
 
-	glo = calloc(1, sizeof(*glo));
-	if (glo == NULL)
-		return 0;
-	glo->resolution = 160;
-	glo->alerts_initialised = 0;
+static void unlock_fitz(void *user, int lock)
+{
+	pthread_mutex_unlock(&((pthread_mutex_t *)user)[lock]);
+}
 
-	filename = (*env)->GetStringUTFChars(env, jfilename, NULL);
-	if (filename == NULL)
-	{
-		LOGE("Failed to get filename");
-		free(glo);
-		return 0;
-	}
+static fz_locks_context fitz_locks = { fitz_mutexes, lock_fitz, unlock_fitz };
 
+static fz_locks_context *get_fitz_locks(void)
+{
+	pthread_once(&fitz_mutexes_once, init_fitz_mutexes);
+	return &fitz_locks;
+}
+
+// Every document gets a clone of one process-wide context, so they all
+// share one store, one glyph cache and one copy of each built-in font,
+// and the store budget holds however many documents are open. The base
+// context is never dropped.
+static fz_context *base_ctx;
+static pthread_once_t base_ctx_once = PTHREAD_ONCE_INIT;
+
+static void init_base_context(void)
+{
 	/* 128 MB store for low memory devices. Tweak as necessary. */
-	glo->ctx = ctx = fz_new_context(NULL, NULL, 128 << 20);
-	if (!ctx)
-	{
-		LOGE("Failed to initialise context");
-		(*env)->ReleaseStringUTFChars(env, jfilename, filename);
-		free(glo);
-		return 0;
-	}
+	base_ctx = fz_new_context(NULL, get_fitz_locks(), 128 << 20);
+	if (base_ctx)
+		fz_register_document_handlers(base_ctx);
+}
 
-	fz_register_document_handlers(ctx);
+static fz_context *new_document_context(void)
+{
+	pthread_once(&base_ctx_once, init_base_context);
+	return fz_clone_context(base_ctx);
+}
+
+static fz_display_list *build_prefetched_list(list_prefetcher *pf, int number)
+{
+	fz_context *ctx = pf->ctx;
+	fz_page *page = NULL;
+	fz_device *dev = NULL;
+	fz_display_list *list = NULL;
+
+	fz_var(page);
+	fz_var(dev);
+	fz_var(list);
 
-	glo->doc = NULL;
 	fz_try(ctx)
 	{
-		glo->colorspace = fz_device_rgb(ctx);
-
-		LOGI("Opening document...");
-		fz_try(ctx)
-		{
-			glo->current_path = fz_strdup(ctx, (char *)filename);
-			glo->doc = fz_open_document(ctx, (char *)filename);
-			alerts_init(glo);
-		}
-		fz_catch(ctx)
+		if (pf->doc == NULL)
 		{
-			fz_throw(ctx, FZ_ERROR_GENERIC, "Cannot open document: '%s'", filename);
+			pf->doc = fz_open_document(ctx, pf->path);
+			if (fz_needs_password(ctx, pf->doc))
+			{
+				pf->broken = 1;
+				fz_throw(ctx, FZ_ERROR_GENERIC, "document needs a password");
+			}
 		}
-		LOGI("Done!");
+		page = fz_load_page(ctx, pf->doc, number);
+		list = fz_new_display_list(ctx);
+		dev = fz_new_list_device(ctx, list);
+		fz_run_page_contents(ctx, page, dev, &fz_identity, &pf->cookie);
+		if (pf->cookie.abort)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Prefetch aborted");
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_page(ctx, page);
 	}
 	fz_catch(ctx)
 	{
-		LOGE("Failed: %s", ctx->error->message);
-		fz_drop_document(ctx, glo->doc);
-		glo->doc = NULL;
-		fz_drop_context(ctx);
-		glo->ctx = NULL;
-		free(glo);
-		glo = NULL;
+		LOGE("Prefetch of page %d failed: %s", number, ctx->error->message);
+		if (pf->doc == NULL)
+			pf->broken = 1;
+		fz_drop_display_list(ctx, list);
+		list = NULL;
 	}
 
-	(*env)->ReleaseStringUTFChars(env, jfilename, filename);
-
-	return (jlong)(intptr_t)glo;
-}
-
-typedef struct buffer_state_s
-{
-	globals *globals;
-	char buffer[4096];
+	return list;
 }
-buffer_state;
 
-static int bufferStreamNext(fz_context *ctx, fz_stream *stream, int max)
+static void *list_prefetch_thread(void *arg)
 {
-	buffer_state *bs = (buffer_state *)stream->state;
-	globals *glo = bs->globals;
-	JNIEnv *env = glo->env;
-	jbyteArray array = (jbyteArray)(void *)((*env)->GetObjectField(env, glo->thiz, buffer_fid));
-	int arrayLength = (*env)->GetArrayLength(env, array);
-	int len = sizeof(bs->buffer);
+	list_prefetcher *pf = (list_prefetcher *)arg;
+	int i;
 
-	if (stream->pos > arrayLength)
-		stream->pos = arrayLength;
-	if (stream->pos < 0)
-		stream->pos = 0;
-	if (len + stream->pos > arrayLength)
-		len = arrayLength - stream->pos;
+	pthread_mutex_lock(&pf->mutex);
+	while (!pf->quit)
+	{
+		fz_display_list *list;
+		int number = -1;
 
-	(*env)->GetByteArrayRegion(env, array, stream->pos, len, bs->buffer);
-	(*env)->DeleteLocalRef(env, array);
+		for (i = 0; i < 2 * PREFETCH_LISTS && number < 0; i++)
+		{
+			number = pf->want[i];
+			pf->want[i] = -1;
+		}
+		if (number < 0 || pf->broken)
+		{
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+			continue;
+		}
 
-	stream->rp = bs->buffer;
-	stream->wp = stream->rp + len;
-	stream->pos += len;
-	if (len == 0)
-		return EOF;
-	return *stream->rp++;
-}
+		pf->busy = number;
+		pthread_mutex_unlock(&pf->mutex);
+		list = build_prefetched_list(pf, number);
+		pthread_mutex_lock(&pf->mutex);
+		pf->busy = -1;
+
+		/* The request may have moved on while the list was built */
+		for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+			if (pf->wanted[i] == number)
+				break;
+		if (i < 2 * PREFETCH_LISTS)
+		{
+			for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+				if (pf->done[i].list == NULL)
+					break;
+		}
+		if (list != NULL && i < 2 * PREFETCH_LISTS)
+		{
+			pf->done[i].number = number;
+			pf->done[i].list = list;
+		}
+		else
+		{
+			fz_drop_display_list(pf->ctx, list);
+		}
+	}
+	pthread_mutex_unlock(&pf->mutex);
 
-static void bufferStreamClose(fz_context *ctx, void *state)
-{
-	fz_free(ctx, state);
+	return NULL;
 }
 
-static void bufferStreamSeek(fz_context *ctx, fz_stream *stream, int offset, int whence)
+/* Only PDF files are handled: CBZ documents prefetch their images with
+ * fz_prefetch_pages, documents opened from a buffer have no file that a
+ * second handle could read, and reflowed formats would need the layout
+ * repeated. */
+static list_prefetcher *new_list_prefetcher(globals *glo)
 {
-	buffer_state *bs = (buffer_state *)stream->state;
-	globals *glo = bs->globals;
-	JNIEnv *env = glo->env;
-	jbyteArray array = (jbyteArray)(void *)((*env)->GetObjectField(env, glo->thiz, buffer_fid));
-	int arrayLength = (*env)->GetArrayLength(env, array);
-
-	(*env)->DeleteLocalRef(env, array);
+	fz_context *ctx = glo->ctx;
+	list_prefetcher *pf;
+	int i;
 
-	if (whence == 0) /* SEEK_SET */
-		stream->pos = offset;
-	else if (whence == 1) /* SEEK_CUR */
-		stream->pos += offset;
-	else if (whence == 2) /* SEEK_END */
-		stream->pos = arrayLength + offset;
+	if (glo->current_path == NULL || pdf_specifics(ctx, glo->doc) == NULL)
+		return NULL;
 
-	if (stream->pos > arrayLength)
-		stream->pos = arrayLength;
-	if (stream->pos < 0)
-		stream->pos = 0;
+	pf = calloc(1, sizeof(*pf));
+	if (pf == NULL)
+		return NULL;
+	pf->path = strdup(glo->current_path);
+	pf->ctx = fz_clone_context(ctx);
+	if (pf->path == NULL || pf->ctx == NULL)
+	{
+		fz_drop_context(pf->ctx);
+		free(pf->path);
+		free(pf);
+		return NULL;
+	}
+	pf->busy = -1;
+	for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+	{
+		pf->wanted[i] = -1;
+		pf->want[i] = -1;
+		pf->done[i].number = -1;
+	}
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	if (pthread_create(&pf->thread, NULL, list_prefetch_thread, pf))
+	{
+		pthread_cond_destroy(&pf->cond);
+		pthread_mutex_destroy(&pf->mutex);
+		fz_drop_context(pf->ctx);
+		free(pf->path);
+		free(pf);
+		return NULL;
+	}
 
-	stream->wp = stream->rp;
+	return pf;
 }
 
-JNIEXPORT jlong JNICALL
-JNI_FN(MuPDFCore_openBuffer)(JNIEnv * env, jobject thiz, jstring jmagic)
+static void drop_list_prefetcher(list_prefetcher *pf)
 {
-	globals *glo;
-	fz_context *ctx;
-	jclass clazz;
-	fz_stream *stream = NULL;
-	buffer_state *bs;
-	const char *magic;
+	int i;
 
-#ifdef NDK_PROFILER
-	monstartup("libmupdf.so");
-#endif
+	if (pf == NULL)
+		return;
 
-	clazz = (*env)->GetObjectClass(env, thiz);
-	global_fid = (*env)->GetFieldID(env, clazz, "globals", "J");
+	pthread_mutex_lock(&pf->mutex);
+	pf->quit = 1;
+	pf->cookie.abort = 1;
+	pthread_cond_signal(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+	pthread_join(pf->thread, NULL);
+
+	for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+		fz_drop_display_list(pf->ctx, pf->done[i].list);
+	fz_drop_document(pf->ctx, pf->doc);
+	fz_drop_context(pf->ctx);
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf->path);
+	free(pf);
+}
 
-	glo = calloc(1, sizeof(*glo));
+/* Render a thumbnail that fits in the requested size. A thumbnail image
+ * stored in the file is used if there is one; otherwise the page contents
+ * are drawn straight at the small size, which also lets images decode at
+ * a reduced resolution. Annotations are left out. */
+static fz_pixmap *render_thumbnail(thumb_worker *tw, int number)
+{
+	thumbnailer *th = tw->th;
+	fz_context *ctx = tw->ctx;
+	fz_image *image = NULL;
+	fz_page *page = NULL;
+	fz_device *dev = NULL;
+	fz_pixmap *pix = NULL;
+	fz_pixmap *tmp = NULL;
+	pdf_document *idoc;
+	fz_rect bounds;
+	fz_irect bbox;
+	fz_matrix ctm;
+	float zoom;
+
+	fz_var(image);
+	fz_var(page);
+	fz_var(dev);
+	fz_var(pix);
+	fz_var(tmp);
+
+	/* Keep handing back empty results so that the pages still come out */
+	if (tw->broken)
+		return NULL;
+
+	fz_try(ctx)
+	{
+		if (tw->doc == NULL)
+		{
+			tw->doc = fz_open_document(ctx, th->path);
+			if (fz_needs_password(ctx, tw->doc))
+			{
+				tw->broken = 1;
+				fz_throw(ctx, FZ_ERROR_GENERIC, "document needs a password");
+			}
+		}
+
+		idoc = pdf_specifics(ctx, tw->doc);
+		if (idoc)
+			image = pdf_load_page_thumbnail(ctx, idoc, number);
+
+		if (image)
+		{
+			zoom = fz_min((float)th->width / image->w, (float)th->height / image->h);
+			tmp = fz_new_pixmap_from_image(ctx, image, image->w * zoom, image->h * zoom);
+			if (tmp->colorspace != fz_device_rgb(ctx))
+			{
+				pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), tmp->w, tmp->h);
+				fz_convert_pixmap(ctx, pix, tmp);
+				fz_drop_pixmap(ctx, tmp);
+				tmp = pix;
+				pix = NULL;
+			}
+			pix = fz_scale_pixmap(ctx, tmp, 0, 0, image->w * zoom, image->h * zoom, NULL);
+			if (pix == NULL)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot scale thumbnail");
+			pix->x = 0;
+			pix->y = 0;
+		}
+		else
+		{
+			page = fz_load_page(ctx, tw->doc, number);
+			fz_bound_page(ctx, page, &bounds);
+			zoom = fz_min(th->width / (bounds.x1 - bounds.x0), th->height / (bounds.y1 - bounds.y0));
+			fz_scale(&ctm, zoom, zoom);
+			fz_round_rect(&bbox, fz_transform_rect(&bounds, &ctm));
+			pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &bbox);
+			fz_clear_pixmap_with_value(ctx, pix, 0xff);
+			dev = fz_new_draw_device(ctx, pix);
+			fz_run_page_contents(ctx, page, dev, &ctm, &tw->cookie);
+			if (tw->cookie.abort)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "Thumbnail aborted");
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_page(ctx, page);
+		fz_drop_pixmap(ctx, tmp);
+		fz_drop_image(ctx, image);
+	}
+	fz_catch(ctx)
+	{
+		LOGE("Thumbnail of page %d failed: %s", number, ctx->error->message);
+		if (tw->doc == NULL || tw->broken)
+		{
+			tw->broken = 1;
+			fz_drop_document(ctx, tw->doc);
+			tw->doc = NULL;
+		}
+		fz_drop_pixmap(ctx, pix);
+		pix = NULL;
+	}
+
+	return pix;
+}
+
+static void *thumb_worker_thread(void *arg)
+{
+	thumb_worker *tw = (thumb_worker *)arg;
+	thumbnailer *th = tw->th;
+
+	pthread_mutex_lock(&th->mutex);
+	while (!th->quit)
+	{
+		fz_pixmap *pix;
+		int number;
+
+		if (th->next_page >= th->count)
+			break;
+		if (th->next_page >= th->next_out + THUMB_AHEAD)
+		{
+			pthread_cond_wait(&th->cond, &th->mutex);
+			continue;
+		}
+		number = th->next_page++;
+
+		pthread_mutex_unlock(&th->mutex);
+		pix = render_thumbnail(tw, number);
+		pthread_mutex_lock(&th->mutex);
+
+		th->pix[number % THUMB_AHEAD] = pix;
+		th->ready[number % THUMB_AHEAD] = 1;
+		pthread_cond_broadcast(&th->cond);
+	}
+	pthread_mutex_unlock(&th->mutex);
+
+	return NULL;
+}
+
+static void drop_thumbnailer(thumbnailer *th)
+{
+	int i;
+
+	if (th == NULL)
+		return;
+
+	pthread_mutex_lock(&th->mutex);
+	th->quit = 1;
+	for (i = 0; i < THUMB_WORKERS; i++)
+		th->workers[i].cookie.abort = 1;
+	pthread_cond_broadcast(&th->cond);
+	pthread_mutex_unlock(&th->mutex);
+
+	for (i = 0; i < THUMB_WORKERS; i++)
+	{
+		thumb_worker *tw = &th->workers[i];
+		if (tw->started)
+			pthread_join(tw->thread, NULL);
+		fz_drop_document(tw->ctx, tw->doc);
+	}
+	for (i = 0; i < THUMB_AHEAD; i++)
+		fz_drop_pixmap(th->workers[0].ctx, th->pix[i]);
+	for (i = 0; i < THUMB_WORKERS; i++)
+		fz_drop_context(th->workers[i].ctx);
+	pthread_cond_destroy(&th->cond);
+	pthread_mutex_destroy(&th->mutex);
+	free(th->path);
+	free(th);
+}
+
+static thumbnailer *new_thumbnailer(globals *glo, int width, int height)
+{
+	fz_context *ctx = glo->ctx;
+	thumbnailer *th;
+	int i, count;
+
+	if (glo->current_path == NULL || width <= 0 || height <= 0)
+		return NULL;
+
+	/* The workers open their own copy of the file, which would not be
+	 * authenticated; leave encrypted documents to drawPage */
+	fz_try(ctx)
+	{
+		if (fz_needs_password(ctx, glo->doc))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "document needs a password");
+		count = fz_count_pages(ctx, glo->doc);
+	}
+	fz_catch(ctx)
+		return NULL;
+
+	th = calloc(1, sizeof(*th));
+	if (th == NULL)
+		return NULL;
+	th->count = count;
+	th->width = width;
+	th->height = height;
+	pthread_mutex_init(&th->mutex, NULL);
+	pthread_cond_init(&th->cond, NULL);
+	th->path = strdup(glo->current_path);
+	for (i = 0; i < THUMB_WORKERS; i++)
+	{
+		th->workers[i].th = th;
+		th->workers[i].ctx = fz_clone_context(ctx);
+		if (th->workers[i].ctx == NULL)
+			break;
+	}
+	if (th->path == NULL || i < THUMB_WORKERS)
+	{
+		drop_thumbnailer(th);
+		return NULL;
+	}
+
+	for (i = 0; i < THUMB_WORKERS; i++)
+	{
+		thumb_worker *tw = &th->workers[i];
+		tw->started = !pthread_create(&tw->thread, NULL, thumb_worker_thread, tw);
+		if (!tw->started)
+			break;
+	}
+	if (i == 0)
+	{
+		drop_thumbnailer(th);
+		return NULL;
+	}
+
+	return th;
+}
+
+JNIEXPORT jlong JNICALL
+JNI_FN(MuPDFCore_openFile)(JNIEnv * env, jobject thiz, jstring jfilename)
+{
+	const char *filename;
+	globals *glo;
+	fz_context *ctx;
+	jclass clazz;
+
+#ifdef NDK_PROFILER
+	monstartup("libmupdf.so");
+#endif
+
+	clazz = (*env)->GetObjectClass(env, thiz);
+	global_fid = (*env)->GetFieldID(env, clazz, "globals", "J");
+
+	glo = calloc(1, sizeof(*glo));
+	if (glo == NULL)
+		return 0;
+	glo->resolution = 160;
+	glo->alerts_initialised = 0;
+
+	filename = (*env)->GetStringUTFChars(env, jfilename, NULL);
+	if (filename == NULL)
+	{
+		LOGE("Failed to get filename");
+		free(glo);
+		return 0;
+	}
+
+	glo->ctx = ctx = new_document_context();
+	if (!ctx)
+	{
+		LOGE("Failed to initialise context");
+		(*env)->ReleaseStringUTFChars(env, jfilename, filename);
+		free(glo);
+		return 0;
+	}
+
+	glo->doc = NULL;
+	fz_try(ctx)
+	{
+		glo->colorspace = fz_device_rgb(ctx);
+
+		LOGI("Opening document...");
+		fz_try(ctx)
+		{
+			glo->current_path = fz_strdup(ctx, (char *)filename);
+			glo->doc = fz_open_document(ctx, (char *)filename);
+			alerts_init(glo);
+			glo->prefetcher = new_list_prefetcher(glo);
+		}
+		fz_catch(ctx)
+		{
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Cannot open document: '%s'", filename);
+		}
+		LOGI("Done!");
+	}
+	fz_catch(ctx)
+	{
+		LOGE("Failed: %s", ctx->error->message);
+		fz_drop_document(ctx, glo->doc);
+		glo->doc = NULL;
+		fz_drop_context(ctx);
+		glo->ctx = NULL;
+		free(glo);
+		glo = NULL;
+	}
+
+	(*env)->ReleaseStringUTFChars(env, jfilename, filename);
+
+	return (jlong)(intptr_t)glo;
+}
+
+typedef struct buffer_state_s
+{
+	globals *globals;
+	char buffer[4096];
+}
+buffer_state;
+
+static int bufferStreamNext(fz_context *ctx, fz_stream *stream, int max)
+{
+	buffer_state *bs = (buffer_state *)stream->state;
+	globals *glo = bs->globals;
+	JNIEnv *env = glo->env;
+	jbyteArray array = (jbyteArray)(void *)((*env)->GetObjectField(env, glo->thiz, buffer_fid));
+	int arrayLength = (*env)->GetArrayLength(env, array);
+	int len = sizeof(bs->buffer);
+
+	if (stream->pos > arrayLength)
+		stream->pos = arrayLength;
+	if (stream->pos < 0)
+		stream->pos = 0;
+	if (len + stream->pos > arrayLength)
+		len = arrayLength - stream->pos;
+
+	(*env)->GetByteArrayRegion(env, array, stream->pos, len, bs->buffer);
+	(*env)->DeleteLocalRef(env, array);
+
+	stream->rp = bs->buffer;
+	stream->wp = stream->rp + len;
+	stream->pos += len;
+	if (len == 0)
+		return EOF;
+	return *stream->rp++;
+}
+
+static void bufferStreamClose(fz_context *ctx, void *state)
+{
+	fz_free(ctx, state);
+}
+
+static void bufferStreamSeek(fz_context *ctx, fz_stream *stream, int offset, int whence)
+{
+	buffer_state *bs = (buffer_state *)stream->state;
+	globals *glo = bs->globals;
+	JNIEnv *env = glo->env;
+	jbyteArray array = (jbyteArray)(void *)((*env)->GetObjectField(env, glo->thiz, buffer_fid));
+	int arrayLength = (*env)->GetArrayLength(env, array);
+
+	(*env)->DeleteLocalRef(env, array);
+
+	if (whence == 0) /* SEEK_SET */
+		stream->pos = offset;
+	else if (whence == 1) /* SEEK_CUR */
+		stream->pos += offset;
+	else if (whence == 2) /* SEEK_END */
+		stream->pos = arrayLength + offset;
+
+	if (stream->pos > arrayLength)
+		stream->pos = arrayLength;
+	if (stream->pos < 0)
+		stream->pos = 0;
+
+	stream->wp = stream->rp;
+}
+
+JNIEXPORT jlong JNICALL
+JNI_FN(MuPDFCore_openBuffer)(JNIEnv * env, jobject thiz, jstring jmagic)
+{
+	globals *glo;
+	fz_context *ctx;
+	jclass clazz;
+	fz_stream *stream = NULL;
+	buffer_state *bs;
+	const char *magic;
+
+#ifdef NDK_PROFILER
+	monstartup("libmupdf.so");
+#endif
+
+	clazz = (*env)->GetObjectClass(env, thiz);
+	global_fid = (*env)->GetFieldID(env, clazz, "globals", "J");
+
+	glo = calloc(1, sizeof(*glo));
 	if (glo == NULL)
 		return 0;
 	glo->resolution = 160;
@@ -443,8 +1118,7 @@ JNI_FN(MuPDFCore_openBuffer)(JNIEnv * env, jobject thiz, jstring jmagic)
 		return 0;
 	}
 
-	/* 128 MB store for low memory devices. Tweak as necessary. */
-	glo->ctx = ctx = fz_new_context(NULL, NULL, 128 << 20);
+	glo->ctx = ctx = new_document_context();
 	if (!ctx)
 	{
 		LOGE("Failed to initialise context");
@@ -452,8 +1126,6 @@ JNI_FN(MuPDFCore_openBuffer)(JNIEnv * env, jobject thiz, jstring jmagic)
 		free(glo);
 		return 0;
 	}
-
-	fz_register_document_handlers(ctx);
 	fz_var(stream);
 
 	glo->doc = NULL;
@@ -546,6 +1218,182 @@ JNI_FN(MuPDFCore_isUnencryptedPDFInternal)(JNIEnv * env, jobject thiz)
 }
 
 
+static int page_list_cached(globals *glo, int number)
+{
+	int i;
+
+	for (i = 0; i < NUM_CACHE; i++)
+		if (glo->pages[i].page != NULL && glo->pages[i].number == number && glo->pages[i].page_list != NULL)
+			return 1;
+	return 0;
+}
+
+/* Ask for the display lists of the pages next to the given one, unless
+ * they are cached already. Results for any other pages are dropped. */
+static void prefetch_lists(globals *glo, int number)
+{
+	fz_context *ctx = glo->ctx;
+	list_prefetcher *pf = glo->prefetcher;
+	int wanted[2 * PREFETCH_LISTS];
+	int i, j, n, count = 0;
+
+	if (pf == NULL)
+		return;
+
+	fz_try(ctx)
+		count = fz_count_pages(ctx, glo->doc);
+	fz_catch(ctx)
+		return;
+
+	/* Pages ahead come first, since reading usually goes forwards */
+	n = 0;
+	for (i = 1; i <= PREFETCH_LISTS; i++)
+	{
+		if (number + i < count && !page_list_cached(glo, number + i))
+			wanted[n++] = number + i;
+		if (number - i >= 0 && !page_list_cached(glo, number - i))
+			wanted[n++] = number - i;
+	}
+	while (n < 2 * PREFETCH_LISTS)
+		wanted[n++] = -1;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+	{
+		pf->wanted[i] = wanted[i];
+		pf->want[i] = wanted[i] == pf->busy ? -1 : wanted[i];
+	}
+	for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+	{
+		prefetched_list *done = &pf->done[i];
+
+		if (done->list == NULL)
+			continue;
+		for (j = 0; j < 2 * PREFETCH_LISTS; j++)
+			if (pf->want[j] == done->number)
+				break;
+		if (j < 2 * PREFETCH_LISTS)
+		{
+			/* Already built */
+			pf->want[j] = -1;
+		}
+		else
+		{
+			fz_drop_display_list(ctx, done->list);
+			done->list = NULL;
+		}
+	}
+	pthread_cond_signal(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+static fz_display_list *take_prefetched_list(globals *glo, int number)
+{
+	list_prefetcher *pf = glo->prefetcher;
+	fz_display_list *list = NULL;
+	int i;
+
+	if (pf == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+	{
+		if (pf->done[i].list != NULL && pf->done[i].number == number)
+		{
+			list = pf->done[i].list;
+			pf->done[i].list = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	return list;
+}
+
+static unsigned int page_cache_size(fz_context *ctx, page_cache *pc)
+{
+	annot_list *node;
+	unsigned int size = fz_display_list_size(ctx, pc->page_list);
+
+	for (node = pc->annot_lists; node; node = node->next)
+		size += fz_display_list_size(ctx, node->list);
+	return size;
+}
+
+/* The part of a cache budget allowed at the current memory pressure: all
+ * of it with none, then 3/4, 1/2 and 1/4, as for the fitz store. */
+static unsigned int cache_budget(globals *glo, unsigned int budget)
+{
+	return budget / 4 * (4 - glo->pressure);
+}
+
+/* Drop the cached pages furthest from the current one until the display
+ * lists of the rest fit in PAGE_CACHE_BUDGET. The current page is always
+ * kept. */
+static void trim_page_cache(globals *glo)
+{
+	int current = glo->pages[glo->current].number;
+	unsigned int budget = cache_budget(glo, PAGE_CACHE_BUDGET);
+
+	for (;;)
+	{
+		unsigned int total = 0;
+		int furthest = -1;
+		int furthest_dist = -1;
+		int i;
+
+		for (i = 0; i < NUM_CACHE; i++)
+		{
+			page_cache *pc = &glo->pages[i];
+			int dist;
+
+			if (pc->page == NULL)
+				continue;
+			total += page_cache_size(glo->ctx, pc);
+			dist = abs(pc->number - current);
+			if (i != glo->current && dist > furthest_dist)
+			{
+				furthest_dist = dist;
+				furthest = i;
+			}
+		}
+
+		if (total <= budget || furthest < 0)
+			break;
+		drop_page_cache(glo, &glo->pages[furthest]);
+	}
+}
+
+/* Find a page for a query that only looks at it, without disturbing the
+ * cache of pages being rendered. */
+static fz_page *get_query_page(globals *glo, int number)
+{
+	fz_context *ctx = glo->ctx;
+	int i;
+
+	for (i = 0; i < NUM_CACHE; i++)
+		if (glo->pages[i].page != NULL && glo->pages[i].number == number)
+			return glo->pages[i].page;
+
+	if (glo->query_page != NULL && glo->query_number == number)
+		return glo->query_page;
+
+	fz_drop_page(ctx, glo->query_page);
+	glo->query_page = NULL;
+	fz_try(ctx)
+	{
+		glo->query_page = fz_load_page(ctx, glo->doc, number);
+		glo->query_number = number;
+	}
+	fz_catch(ctx)
+	{
+		LOGE("cannot load page %d: %s", number, ctx->error->message);
+	}
+
+	return glo->query_page;
+}
+
 JNIEXPORT void JNICALL
 JNI_FN(MuPDFCore_gotoPageInternal)(JNIEnv *env, jobject thiz, int page)
 {
@@ -604,7 +1452,15 @@ JNI_FN(MuPDFCore_gotoPageInternal)(JNIEnv *env, jobject thiz, int page)
 	{
 		fz_rect rect;
 		LOGI("Load page %d", pc->number);
-		pc->page = fz_load_page(ctx, glo->doc, pc->number);
+		if (glo->query_page != NULL && glo->query_number == pc->number)
+		{
+			pc->page = glo->query_page;
+			glo->query_page = NULL;
+		}
+		else
+		{
+			pc->page = fz_load_page(ctx, glo->doc, pc->number);
+		}
 		zoom = glo->resolution / 72;
 		fz_bound_page(ctx, pc->page, &pc->media_box);
 		fz_scale(&ctm, zoom, zoom);
@@ -658,6 +1514,8 @@ static void update_changed_rects(globals *glo, page_cache *pc, pdf_document *ido
 		node->next = pc->changed_rects;
 		pc->changed_rects = node;
 
+		drop_tiles(glo, pc->number, &node->rect);
+
 		node = fz_malloc_struct(glo->ctx, rect_node);
 		fz_bound_annot(ctx, pc->page, annot, &node->rect);
 		node->next = pc->hq_changed_rects;
@@ -665,59 +1523,436 @@ static void update_changed_rects(globals *glo, page_cache *pc, pdf_document *ido
 	}
 }
 
-JNIEXPORT jboolean JNICALL
-JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
-		int pageW, int pageH, int patchX, int patchY, int patchW, int patchH, jlong cookiePtr)
+static void get_annot_key(fz_context *ctx, pdf_document *idoc, fz_annot *annot, annot_list *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->annot = annot;
+	if (idoc)
+	{
+		pdf_annot *pannot = (pdf_annot *)annot;
+		key->ap = pannot->ap;
+		key->ap_iteration = pannot->ap_iteration;
+		key->flags = pdf_to_int(ctx, pdf_dict_get(ctx, pannot->obj, PDF_NAME_F));
+		key->matrix = pannot->matrix;
+	}
+}
+
+static int same_annot_key(annot_list *node, annot_list *key)
+{
+	return node->annot == key->annot &&
+		node->ap == key->ap &&
+		node->ap_iteration == key->ap_iteration &&
+		node->flags == key->flags &&
+		!memcmp(&node->matrix, &key->matrix, sizeof(fz_matrix));
+}
+
+static annot_list *new_annot_list(fz_context *ctx, fz_page *page, fz_annot *annot, annot_list *key, fz_cookie *cookie)
+{
+	annot_list *node = fz_malloc_struct(ctx, annot_list);
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		node->list = fz_new_display_list(ctx);
+		dev = fz_new_list_device(ctx, node->list);
+		fz_run_annot(ctx, page, annot, dev, &fz_identity, cookie);
+		if (cookie != NULL && cookie->abort)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
+		fz_bound_annot(ctx, page, annot, &node->bounds);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, node->list);
+		fz_free(ctx, node);
+		fz_rethrow(ctx);
+	}
+
+	node->annot = key->annot;
+	node->ap = key->ap ? pdf_keep_xobject(ctx, key->ap) : NULL;
+	node->ap_iteration = key->ap_iteration;
+	node->flags = key->flags;
+	node->matrix = key->matrix;
+	return node;
+}
+
+/* Bring the page's annotation lists up to date, re-recording only the
+ * annotations whose appearance has changed since their list was made
+ * and dropping those of annotations that have gone. The lists are kept
+ * in page order so that they still draw in the right stacking order. */
+static void update_annot_lists(globals *glo, page_cache *pc, pdf_document *idoc, fz_cookie *cookie)
+{
+	fz_context *ctx = glo->ctx;
+	annot_list **link = &pc->annot_lists;
+	annot_list **prev;
+	annot_list *node;
+	annot_list key;
+	fz_annot *annot;
+
+	for (annot = fz_first_annot(ctx, pc->page); annot; annot = fz_next_annot(ctx, pc->page, annot))
+	{
+		get_annot_key(ctx, idoc, annot, &key);
+
+		/* Usually the annotations come in the same order as last time,
+		 * so the match is found straight away. */
+		for (prev = link; (node = *prev) != NULL; prev = &node->next)
+			if (same_annot_key(node, &key))
+				break;
+
+		if (node)
+			*prev = node->next;
+		else
+			node = new_annot_list(ctx, pc->page, annot, &key, cookie);
+
+		node->next = *link;
+		*link = node;
+		link = &node->next;
+	}
+
+	drop_annot_lists(ctx, link);
+}
+
+static void run_annot_lists(fz_context *ctx, page_cache *pc, fz_device *dev, const fz_matrix *ctm, const fz_rect *area, fz_cookie *cookie)
+{
+	annot_list *node;
+
+	for (node = pc->annot_lists; node; node = node->next)
+	{
+		fz_rect bounds = node->bounds;
+
+		fz_transform_rect(&bounds, ctm);
+		if (fz_is_empty_rect(fz_intersect_rect(&bounds, area)))
+			continue;
+		fz_run_display_list(ctx, node->list, dev, ctm, area, cookie);
+		if (cookie != NULL && cookie->abort)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
+	}
+}
+
+static int tile_index(int v)
+{
+	return v >= 0 ? v / TILE_SIZE : -((TILE_SIZE - 1 - v) / TILE_SIZE);
+}
+
+static tile *render_tile(globals *glo, page_cache *pc, tile_key *key, const fz_matrix *ctm, const fz_irect *page_bbox, fz_cookie *cookie)
+{
+	fz_context *ctx = glo->ctx;
+	fz_device *dev = NULL;
+	fz_list_runner *runner = NULL;
+	fz_pixmap *pix = NULL;
+	fz_irect bbox;
+	fz_rect rect, area;
+	fz_matrix inv;
+	tile *t = NULL;
+
+	fz_var(dev);
+	fz_var(runner);
+	fz_var(pix);
+	fz_var(t);
+
+	bbox.x0 = key->x * TILE_SIZE;
+	bbox.y0 = key->y * TILE_SIZE;
+	bbox.x1 = bbox.x0 + TILE_SIZE;
+	bbox.y1 = bbox.y0 + TILE_SIZE;
+	fz_intersect_irect(&bbox, page_bbox);
+	fz_rect_from_irect(&rect, &bbox);
+	area = rect;
+	fz_transform_rect(&area, fz_invert_matrix(&inv, ctm));
+
+	if (glo->parked.runner && !memcmp(&glo->parked.key, key, sizeof(*key)))
+	{
+		pix = glo->parked.pix;
+		dev = glo->parked.dev;
+		runner = glo->parked.runner;
+		memset(&glo->parked, 0, sizeof(glo->parked));
+	}
+
+	fz_try(ctx)
+	{
+		if (pix == NULL)
+		{
+			pix = fz_new_pixmap_with_bbox(ctx, key->gray ? fz_device_gray(ctx) : glo->colorspace, &bbox);
+			fz_clear_pixmap_with_value(ctx, pix, 0xff);
+			dev = fz_new_draw_device(ctx, pix);
+			if (pc->page_list)
+				runner = fz_new_list_runner(ctx, pc->page_list, dev, ctm, &rect);
+		}
+		if (runner && !fz_run_list_runner(ctx, runner, 0, 0, cookie))
+		{
+			drop_parked_tile(glo);
+			glo->parked.key = *key;
+			glo->parked.area = area;
+			glo->parked.pix = pix;
+			glo->parked.dev = dev;
+			glo->parked.runner = runner;
+			pix = NULL;
+			dev = NULL;
+			runner = NULL;
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
+		}
+		run_annot_lists(ctx, pc, dev, ctm, &rect, cookie);
+
+		if (glo->tiles == NULL)
+			glo->tiles = fz_new_hash_table(ctx, 64, sizeof(tile_key), -1);
+		t = fz_malloc_struct(ctx, tile);
+		t->key = *key;
+		t->pix = pix;
+		t->area = area;
+		fz_hash_insert(ctx, glo->tiles, &t->key, t);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_list_runner(ctx, runner);
+		fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, t);
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+
+	t->next = glo->tiles_head;
+	if (t->next)
+		t->next->prev = t;
+	else
+		glo->tiles_tail = t;
+	glo->tiles_head = t;
+	glo->tiles_size += fz_pixmap_size(ctx, pix);
+
+	while (glo->tiles_size > cache_budget(glo, TILE_CACHE_BUDGET) && glo->tiles_tail != t)
+		drop_tile(glo, glo->tiles_tail);
+
+	return t;
+}
+
+static void draw_draft_area(globals *glo, page_cache *pc, fz_pixmap *pix, const fz_irect *area, const fz_matrix *ctm, fz_cookie *cookie)
+{
+	fz_context *ctx = glo->ctx;
+	fz_device *dev;
+	fz_rect rect;
+
+	fz_rect_from_irect(&rect, area);
+	dev = fz_new_draw_device_with_bbox(ctx, pix, area);
+	fz_try(ctx)
+	{
+		fz_set_draw_device_draft(ctx, dev, 1);
+		if (pc->page_list)
+			fz_run_display_list(ctx, pc->page_list, dev, ctm, &rect, cookie);
+		if (cookie != NULL && cookie->abort)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
+		run_annot_lists(ctx, pc, dev, ctm, &rect, cookie);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+static void copy_to_target(fz_context *ctx, draw_target *target, fz_pixmap *pix, const fz_irect *area)
+{
+	if (target->pix)
+		fz_copy_pixmap_rect(ctx, target->pix, pix, area);
+	else if (target->format == ANDROID_BITMAP_FORMAT_RGB_565)
+		fz_copy_pixmap_rect_to_rgb565(ctx, target->samples, target->stride, &target->bbox, pix, area);
+	else
+		fz_copy_pixmap_rect_to_gray(ctx, target->samples, target->stride, &target->bbox, pix, area);
+}
+
+/* Draw part of the page into the target at draft quality. Drafts are
+ * soon replaced, so they are not kept as tiles. */
+static void draw_draft(globals *glo, page_cache *pc, draw_target *target, const fz_irect *area, const fz_matrix *ctm, fz_cookie *cookie)
+{
+	fz_context *ctx = glo->ctx;
+	fz_colorspace *cs = target->format == ANDROID_BITMAP_FORMAT_A_8 ? fz_device_gray(ctx) : glo->colorspace;
+	fz_pixmap *pix = NULL;
+	fz_irect band;
+	int band_h;
+
+	if (target->pix)
+	{
+		draw_draft_area(glo, pc, target->pix, area, ctm, cookie);
+		return;
+	}
+
+	fz_var(pix);
+
+	band_h = DRAFT_BAND_SIZE / ((area->x1 - area->x0) * (cs->n + 1));
+	if (band_h < 16)
+		band_h = 16;
+	band = *area;
+	fz_try(ctx)
+	{
+		for (band.y0 = area->y0; band.y0 < area->y1; band.y0 = band.y1)
+		{
+			band.y1 = fz_mini(band.y0 + band_h, area->y1);
+			pix = fz_new_pixmap_with_bbox(ctx, cs, &band);
+			fz_clear_pixmap_with_value(ctx, pix, 0xff);
+			draw_draft_area(glo, pc, pix, &band, ctm, cookie);
+			copy_to_target(ctx, target, pix, &band);
+			fz_drop_pixmap(ctx, pix);
+			pix = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+}
+
+/* Set up a target for pixels in one of the ANDROID_BITMAP_FORMATs covering
+ * bbox. Returns the pixmap wrapping them, if one is needed, for the caller
+ * to drop. */
+static fz_pixmap *init_target(globals *glo, draw_target *target, int format, void *pixels, int stride, const fz_irect *bbox)
+{
+	memset(target, 0, sizeof(*target));
+	target->bbox = *bbox;
+	target->format = format;
+	if (format == ANDROID_BITMAP_FORMAT_RGBA_8888)
+		target->pix = fz_new_pixmap_with_bbox_and_data(glo->ctx, glo->colorspace, bbox, pixels);
+	else
+	{
+		target->samples = pixels;
+		target->stride = stride;
+	}
+	return target->pix;
+}
+
+static void clear_target(fz_context *ctx, draw_target *target, int value)
+{
+	unsigned short v565;
+	unsigned char *row;
+	int x, y;
+
+	if (target->pix)
+	{
+		fz_clear_pixmap_with_value(ctx, target->pix, value);
+		return;
+	}
+
+	v565 = ((value >> 3) << 11) | ((value >> 2) << 5) | (value >> 3);
+	row = target->samples;
+	for (y = target->bbox.y0; y < target->bbox.y1; y++)
+	{
+		unsigned short *d = (unsigned short *)row;
+		if (target->format == ANDROID_BITMAP_FORMAT_A_8)
+			memset(row, value, target->bbox.x1 - target->bbox.x0);
+		else
+			for (x = target->bbox.x0; x < target->bbox.x1; x++)
+				*d++ = v565;
+		row += target->stride;
+	}
+}
+
+/* Fill the given area of the target with the page rendered at
+ * pageW x pageH, copying from cached tiles and rendering only those that
+ * are missing. A draft uses the tiles only if all of them are cached. */
+static void draw_tiles(globals *glo, page_cache *pc, draw_target *target, const fz_irect *area, int pageW, int pageH, const fz_matrix *ctm, fz_cookie *cookie, int draft)
+{
+	fz_context *ctx = glo->ctx;
+	fz_irect page_bbox, box;
+	fz_rect rect = pc->media_box;
+	tile_key key;
+	int x0, y0, x1, y1;
+
+	fz_round_rect(&page_bbox, fz_transform_rect(&rect, ctm));
+	box = *area;
+	fz_intersect_irect(&box, &page_bbox);
+	fz_intersect_irect(&box, &target->bbox);
+	if (fz_is_empty_irect(&box))
+		return;
+
+	x0 = tile_index(box.x0);
+	y0 = tile_index(box.y0);
+	x1 = tile_index(box.x1 - 1);
+	y1 = tile_index(box.y1 - 1);
+
+	memset(&key, 0, sizeof(key));
+	key.page = pc->number;
+	key.page_w = pageW;
+	key.page_h = pageH;
+	key.gray = target->format == ANDROID_BITMAP_FORMAT_A_8;
+
+	if (draft)
+	{
+		/* One pass over the whole area is quicker than one per tile */
+		int missing = 0;
+		for (key.y = y0; key.y <= y1 && !missing; key.y++)
+			for (key.x = x0; key.x <= x1 && !missing; key.x++)
+				missing = glo->tiles == NULL || fz_hash_find(ctx, glo->tiles, &key) == NULL;
+		if (missing)
+		{
+			draw_draft(glo, pc, target, &box, ctm, cookie);
+			return;
+		}
+	}
+
+	for (key.y = y0; key.y <= y1; key.y++)
+	{
+		for (key.x = x0; key.x <= x1; key.x++)
+		{
+			tile *t = glo->tiles ? fz_hash_find(ctx, glo->tiles, &key) : NULL;
+
+			if (t && t != glo->tiles_head)
+			{
+				/* Move to the front of the LRU chain */
+				t->prev->next = t->next;
+				if (t->next)
+					t->next->prev = t->prev;
+				else
+					glo->tiles_tail = t->prev;
+				t->prev = NULL;
+				t->next = glo->tiles_head;
+				glo->tiles_head->prev = t;
+				glo->tiles_head = t;
+			}
+			else if (t == NULL)
+				t = render_tile(glo, pc, &key, ctm, &page_bbox, cookie);
+
+			copy_to_target(ctx, target, t->pix, &box);
+		}
+	}
+}
+
+/* Draw the current page into pixels in one of the ANDROID_BITMAP_FORMATs,
+ * with rows stride bytes apart. */
+static void draw_page_pixels(globals *glo, int format, void *pixels, int width, int stride,
+		int pageW, int pageH, int patchX, int patchY, int patchW, int patchH, fz_cookie *cookie, int draft)
 {
-	AndroidBitmapInfo info;
-	void *pixels;
-	int ret;
 	fz_device *dev = NULL;
 	float zoom;
 	fz_matrix ctm;
 	fz_irect bbox;
 	fz_rect rect;
 	fz_pixmap *pix = NULL;
+	draw_target target;
 	float xscale, yscale;
-	globals *glo = get_globals(env, thiz);
 	fz_context *ctx = glo->ctx;
 	fz_document *doc = glo->doc;
 	page_cache *pc = &glo->pages[glo->current];
 	int hq = (patchW < pageW || patchH < pageH);
 	fz_matrix scale;
-	fz_cookie *cookie = (fz_cookie *)(intptr_t)cookiePtr;
-
-	if (pc->page == NULL)
-		return 0;
 
 	fz_var(pix);
 	fz_var(dev);
 
-	LOGI("In native method\n");
-	if ((ret = AndroidBitmap_getInfo(env, bitmap, &info)) < 0) {
-		LOGE("AndroidBitmap_getInfo() failed ! error=%d", ret);
-		return 0;
-	}
-
-	LOGI("Checking format\n");
-	if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888) {
-		LOGE("Bitmap format is not RGBA_8888 !");
-		return 0;
-	}
-
-	LOGI("locking pixels\n");
-	if ((ret = AndroidBitmap_lockPixels(env, bitmap, &pixels)) < 0) {
-		LOGE("AndroidBitmap_lockPixels() failed ! error=%d", ret);
-		return 0;
-	}
-
 	/* Call mupdf to render display list to screen */
 	LOGI("Rendering page(%d)=%dx%d patch=[%d,%d,%d,%d]",
 			pc->number, pageW, pageH, patchX, patchY, patchW, patchH);
 
 	fz_try(ctx)
 	{
-		fz_irect pixbbox;
+		fz_irect pixbbox, patch;
 		pdf_document *idoc = pdf_specifics(ctx, doc);
 
 		if (idoc)
@@ -730,6 +1965,8 @@ JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
 			drop_changed_rects(ctx, hq ? &pc->hq_changed_rects : &pc->changed_rects);
 		}
 
+		if (pc->page_list == NULL)
+			pc->page_list = take_prefetched_list(glo, pc->number);
 		if (pc->page_list == NULL)
 		{
 			/* Render to list */
@@ -745,37 +1982,23 @@ JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
 				fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
 			}
 		}
-		if (pc->annot_list == NULL)
-		{
-			fz_annot *annot;
-			pc->annot_list = fz_new_display_list(ctx);
-			dev = fz_new_list_device(ctx, pc->annot_list);
-			for (annot = fz_first_annot(ctx, pc->page); annot; annot = fz_next_annot(ctx, pc->page, annot))
-				fz_run_annot(ctx, pc->page, annot, dev, &fz_identity, cookie);
-			fz_drop_device(ctx, dev);
-			dev = NULL;
-			if (cookie != NULL && cookie->abort)
-			{
-				fz_drop_display_list(ctx, pc->annot_list);
-				pc->annot_list = NULL;
-				fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
-			}
-		}
+		update_annot_lists(glo, pc, idoc, cookie);
 		bbox.x0 = patchX;
 		bbox.y0 = patchY;
 		bbox.x1 = patchX + patchW;
 		bbox.y1 = patchY + patchH;
+		patch = bbox;
 		pixbbox = bbox;
-		pixbbox.x1 = pixbbox.x0 + info.width;
+		pixbbox.x1 = pixbbox.x0 + width;
 		/* pixmaps cannot handle right-edge padding, so the bbox must be expanded to
 		 * match the pixels data */
-		pix = fz_new_pixmap_with_bbox_and_data(ctx, glo->colorspace, &pixbbox, pixels);
-		if (pc->page_list == NULL && pc->annot_list == NULL)
+		pix = init_target(glo, &target, format, pixels, stride, &pixbbox);
+		if (pc->page_list == NULL && pc->annot_lists == NULL)
 		{
-			fz_clear_pixmap_with_value(ctx, pix, 0xd0);
+			clear_target(ctx, &target, 0xd0);
 			break;
 		}
-		fz_clear_pixmap_with_value(ctx, pix, 0xff);
+		clear_target(ctx, &target, 0xff);
 
 		zoom = glo->resolution / 72;
 		fz_scale(&ctm, zoom, zoom);
@@ -786,9 +2009,6 @@ JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
 		xscale = (float)pageW/(float)(bbox.x1-bbox.x0);
 		yscale = (float)pageH/(float)(bbox.y1-bbox.y0);
 		fz_concat(&ctm, &ctm, fz_scale(&scale, xscale, yscale));
-		rect = pc->media_box;
-		fz_transform_rect(&rect, &ctm);
-		dev = fz_new_draw_device(ctx, pix);
 #ifdef TIME_DISPLAY_LIST
 		{
 			clock_t time;
@@ -798,25 +2018,13 @@ JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
 			time = clock();
 			for (i=0; i<100;i++) {
 #endif
-				if (pc->page_list)
-					fz_run_display_list(ctx, pc->page_list, dev, &ctm, &rect, cookie);
-				if (cookie != NULL && cookie->abort)
-					fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
-
-				if (pc->annot_list)
-					fz_run_display_list(ctx, pc->annot_list, dev, &ctm, &rect, cookie);
-				if (cookie != NULL && cookie->abort)
-					fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
-
+				draw_tiles(glo, pc, &target, &patch, pageW, pageH, &ctm, cookie, draft);
 #ifdef TIME_DISPLAY_LIST
 			}
 			time = clock() - time;
 			LOGI("100 renders in %d (%d per sec)", time, CLOCKS_PER_SEC);
 		}
 #endif
-		fz_drop_device(ctx, dev);
-		dev = NULL;
-		fz_drop_pixmap(ctx, pix);
 		LOGI("Rendered");
 	}
 	fz_always(ctx)
@@ -829,11 +2037,222 @@ JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
 		LOGE("Render failed");
 	}
 
+	fz_drop_pixmap(ctx, pix);
+}
+
+static void prefetch_after_draw(globals *glo, int pageW, int pageH, int patchW, int patchH)
+{
+	fz_context *ctx = glo->ctx;
+	page_cache *pc = &glo->pages[glo->current];
+	int hq = (patchW < pageW || patchH < pageH);
+
+	// While the page is being looked at, decode the next ones at the
+	// same size. Zoomed-in patches would only ask for needlessly large
+	// images, so only whole-page renders do this, and not while memory
+	// is short.
+	if (!hq && glo->pressure < FZ_STORE_PRESSURE_LOW)
+	{
+		fz_try(ctx)
+			fz_prefetch_pages(ctx, glo->doc, pc->number, PREFETCH_AHEAD, PREFETCH_BEHIND, pageW, pageH, PREFETCH_BUDGET);
+		fz_catch(ctx)
+			LOGE("Prefetch failed");
+		prefetch_lists(glo, pc->number);
+	}
+	trim_page_cache(glo);
+}
+
+static jboolean draw_page(JNIEnv *env, jobject thiz, jobject bitmap,
+		int pageW, int pageH, int patchX, int patchY, int patchW, int patchH, jlong cookiePtr, int draft)
+{
+	AndroidBitmapInfo info;
+	void *pixels;
+	int ret;
+	globals *glo = get_globals(env, thiz);
+	fz_cookie *cookie = (fz_cookie *)(intptr_t)cookiePtr;
+
+	if (glo->pages[glo->current].page == NULL)
+		return 0;
+
+	LOGI("In native method\n");
+	if ((ret = AndroidBitmap_getInfo(env, bitmap, &info)) < 0) {
+		LOGE("AndroidBitmap_getInfo() failed ! error=%d", ret);
+		return 0;
+	}
+
+	LOGI("Checking format\n");
+	if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888 && info.format != ANDROID_BITMAP_FORMAT_RGB_565 &&
+		info.format != ANDROID_BITMAP_FORMAT_A_8) {
+		LOGE("Bitmap format is not RGBA_8888, RGB_565 or A_8 !");
+		return 0;
+	}
+
+	LOGI("locking pixels\n");
+	if ((ret = AndroidBitmap_lockPixels(env, bitmap, &pixels)) < 0) {
+		LOGE("AndroidBitmap_lockPixels() failed ! error=%d", ret);
+		return 0;
+	}
+
+	draw_page_pixels(glo, info.format, pixels, info.width, info.stride,
+			pageW, pageH, patchX, patchY, patchW, patchH, cookie, draft);
+
 	AndroidBitmap_unlockPixels(env, bitmap);
 
+	prefetch_after_draw(glo, pageW, pageH, patchW, patchH);
+
+	return 1;
+}
+
+JNIEXPORT jboolean JNICALL
+JNI_FN(MuPDFCore_drawPage)(JNIEnv *env, jobject thiz, jobject bitmap,
+		int pageW, int pageH, int patchX, int patchY, int patchW, int patchH, jlong cookiePtr)
+{
+	return draw_page(env, thiz, bitmap, pageW, pageH, patchX, patchY, patchW, patchH, cookiePtr, 0);
+}
+
+/* A faster, lower quality render for while the view is moving quickly.
+ * It is expected to be replaced by drawPage once the view settles. */
+JNIEXPORT jboolean JNICALL
+JNI_FN(MuPDFCore_drawPageDraft)(JNIEnv *env, jobject thiz, jobject bitmap,
+		int pageW, int pageH, int patchX, int patchY, int patchW, int patchH, jlong cookiePtr)
+{
+	return draw_page(env, thiz, bitmap, pageW, pageH, patchX, patchY, patchW, patchH, cookiePtr, 1);
+}
+
+/* Render in gray into a direct ByteBuffer of one byte per pixel, with rows
+ * stride bytes apart, for consumers that only want luminance. */
+JNIEXPORT jboolean JNICALL
+JNI_FN(MuPDFCore_drawPageGray)(JNIEnv *env, jobject thiz, jobject buffer, int stride,
+		int pageW, int pageH, int patchX, int patchY, int patchW, int patchH, jlong cookiePtr)
+{
+	globals *glo = get_globals(env, thiz);
+	fz_cookie *cookie = (fz_cookie *)(intptr_t)cookiePtr;
+	void *pixels;
+
+	if (glo->pages[glo->current].page == NULL)
+		return 0;
+
+	pixels = (*env)->GetDirectBufferAddress(env, buffer);
+	if (pixels == NULL || stride < patchW || (*env)->GetDirectBufferCapacity(env, buffer) < (jlong)stride * patchH)
+	{
+		LOGE("Buffer is not a direct buffer of %d x %d bytes !", stride, patchH);
+		return 0;
+	}
+
+	draw_page_pixels(glo, ANDROID_BITMAP_FORMAT_A_8, pixels, patchW, stride,
+			pageW, pageH, patchX, patchY, patchW, patchH, cookie, 0);
+
+	prefetch_after_draw(glo, pageW, pageH, patchW, patchH);
+
 	return 1;
 }
 
+/* Start rendering thumbnails of every page, each to fit in width x height,
+ * on background threads. Collect them with nextThumbnail. */
+JNIEXPORT jboolean JNICALL
+JNI_FN(MuPDFCore_startThumbnails)(JNIEnv *env, jobject thiz, int width, int height)
+{
+	globals *glo = get_globals(env, thiz);
+
+	drop_thumbnailer(glo->thumbnailer);
+	glo->thumbnailer = new_thumbnailer(glo, width, height);
+	return glo->thumbnailer != NULL;
+}
+
+/* Wait for the thumbnail of the next page, in page order, and copy it to
+ * the top left of bitmap. Returns the page number, or -1 once every page
+ * has been returned. */
+JNIEXPORT int JNICALL
+JNI_FN(MuPDFCore_nextThumbnail)(JNIEnv *env, jobject thiz, jobject bitmap)
+{
+	AndroidBitmapInfo info;
+	void *pixels;
+	int ret;
+	globals *glo = get_globals(env, thiz);
+	fz_context *ctx = glo->ctx;
+	thumbnailer *th = glo->thumbnailer;
+	fz_pixmap *thumb;
+	fz_pixmap *pix = NULL;
+	fz_irect bbox;
+	int number;
+
+	fz_var(pix);
+
+	if (th == NULL)
+		return -1;
+
+	pthread_mutex_lock(&th->mutex);
+	number = th->next_out;
+	if (number >= th->count)
+	{
+		pthread_mutex_unlock(&th->mutex);
+		return -1;
+	}
+	while (!th->ready[number % THUMB_AHEAD])
+		pthread_cond_wait(&th->cond, &th->mutex);
+	thumb = th->pix[number % THUMB_AHEAD];
+	th->pix[number % THUMB_AHEAD] = NULL;
+	th->ready[number % THUMB_AHEAD] = 0;
+	th->next_out++;
+	pthread_cond_broadcast(&th->cond);
+	pthread_mutex_unlock(&th->mutex);
+
+	if ((ret = AndroidBitmap_getInfo(env, bitmap, &info)) < 0) {
+		LOGE("AndroidBitmap_getInfo() failed ! error=%d", ret);
+		fz_drop_pixmap(ctx, thumb);
+		return number;
+	}
+	if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888) {
+		LOGE("Bitmap format is not RGBA_8888 !");
+		fz_drop_pixmap(ctx, thumb);
+		return number;
+	}
+	if ((ret = AndroidBitmap_lockPixels(env, bitmap, &pixels)) < 0) {
+		LOGE("AndroidBitmap_lockPixels() failed ! error=%d", ret);
+		fz_drop_pixmap(ctx, thumb);
+		return number;
+	}
+
+	fz_try(ctx)
+	{
+		bbox.x0 = 0;
+		bbox.y0 = 0;
+		bbox.x1 = info.width;
+		bbox.y1 = info.height;
+		pix = fz_new_pixmap_with_bbox_and_data(ctx, glo->colorspace, &bbox, pixels);
+		if (thumb)
+		{
+			fz_clear_pixmap_with_value(ctx, pix, 0xff);
+			fz_copy_pixmap_rect(ctx, pix, thumb, &bbox);
+		}
+		else
+		{
+			fz_clear_pixmap_with_value(ctx, pix, 0xd0);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_pixmap(ctx, thumb);
+	}
+	fz_catch(ctx)
+	{
+		LOGE("Thumbnail copy failed");
+	}
+
+	AndroidBitmap_unlockPixels(env, bitmap);
+
+	return number;
+}
+
+JNIEXPORT void JNICALL
+JNI_FN(MuPDFCore_stopThumbnails)(JNIEnv *env, jobject thiz)
+{
+	globals *glo = get_globals(env, thiz);
+
+	drop_thumbnailer(glo->thumbnailer);
+	glo->thumbnailer = NULL;
+}
+
 static char *widget_type_string(int t)
 {
 	switch(t)
@@ -861,6 +2280,7 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 	fz_irect bbox;
 	fz_rect rect;
 	fz_pixmap *pix = NULL;
+	draw_target target;
 	float xscale, yscale;
 	pdf_document *idoc;
 	page_cache *pc = NULL;
@@ -902,8 +2322,9 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 	}
 
 	LOGI("Checking format\n");
-	if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888) {
-		LOGE("Bitmap format is not RGBA_8888 !");
+	if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888 && info.format != ANDROID_BITMAP_FORMAT_RGB_565 &&
+		info.format != ANDROID_BITMAP_FORMAT_A_8) {
+		LOGE("Bitmap format is not RGBA_8888, RGB_565 or A_8 !");
 		return 0;
 	}
 
@@ -919,7 +2340,6 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 
 	fz_try(ctx)
 	{
-		fz_annot *annot;
 		fz_irect pixbbox;
 
 		if (idoc)
@@ -928,6 +2348,8 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 			update_changed_rects(glo, pc, idoc);
 		}
 
+		if (pc->page_list == NULL)
+			pc->page_list = take_prefetched_list(glo, pc->number);
 		if (pc->page_list == NULL)
 		{
 			/* Render to list */
@@ -944,20 +2366,7 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 			}
 		}
 
-		if (pc->annot_list == NULL) {
-			pc->annot_list = fz_new_display_list(ctx);
-			dev = fz_new_list_device(ctx, pc->annot_list);
-			for (annot = fz_first_annot(ctx, pc->page); annot; annot = fz_next_annot(ctx, pc->page, annot))
-				fz_run_annot(ctx, pc->page, annot, dev, &fz_identity, cookie);
-			fz_drop_device(ctx, dev);
-			dev = NULL;
-			if (cookie != NULL && cookie->abort)
-			{
-				fz_drop_display_list(ctx, pc->annot_list);
-				pc->annot_list = NULL;
-				fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
-			}
-		}
+		update_annot_lists(glo, pc, idoc, cookie);
 
 		bbox.x0 = patchX;
 		bbox.y0 = patchY;
@@ -967,7 +2376,7 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 		pixbbox.x1 = pixbbox.x0 + info.width;
 		/* pixmaps cannot handle right-edge padding, so the bbox must be expanded to
 		 * match the pixels data */
-		pix = fz_new_pixmap_with_bbox_and_data(ctx, glo->colorspace, &pixbbox, pixels);
+		pix = init_target(glo, &target, info.format, pixels, info.stride, &pixbbox);
 
 		zoom = glo->resolution / 72;
 		fz_scale(&ctm, zoom, zoom);
@@ -993,20 +2402,7 @@ JNI_FN(MuPDFCore_updatePageInternal)(JNIEnv *env, jobject thiz, jobject bitmap,
 			if (!fz_is_empty_irect(&abox))
 			{
 				LOGI("And it isn't empty");
-				fz_clear_pixmap_rect_with_value(ctx, pix, 0xff, &abox);
-				dev = fz_new_draw_device_with_bbox(ctx, pix, &abox);
-				if (pc->page_list)
-					fz_run_display_list(ctx, pc->page_list, dev, &ctm, &arect, cookie);
-				if (cookie != NULL && cookie->abort)
-					fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
-
-				if (pc->annot_list)
-					fz_run_display_list(ctx, pc->annot_list, dev, &ctm, &arect, cookie);
-				if (cookie != NULL && cookie->abort)
-					fz_throw(ctx, FZ_ERROR_GENERIC, "Render aborted");
-
-				fz_drop_device(ctx, dev);
-				dev = NULL;
+				draw_tiles(glo, pc, &target, &abox, pageW, pageH, &ctm, cookie, 0);
 			}
 		}
 		LOGI("End partial update");
@@ -1570,8 +2966,6 @@ JNI_FN(MuPDFCore_addMarkupAnnotationInternal)(JNIEnv * env, jobject thiz, jobjec
 
 		pdf_set_markup_annot_quadpoints(ctx, idoc, (pdf_annot *)annot, pts, n);
 		pdf_set_markup_appearance(ctx, idoc, (pdf_annot *)annot, color, alpha, line_thickness, line_height);
-
-		dump_annotation_display_lists(glo);
 	}
 	fz_always(ctx)
 	{
@@ -1664,8 +3058,6 @@ JNI_FN(MuPDFCore_addInkAnnotationInternal)(JNIEnv * env, jobject thiz, jobjectAr
 		annot = (fz_annot *)pdf_create_annot(ctx, idoc, (pdf_page *)pc->page, FZ_ANNOT_INK);
 
 		pdf_set_ink_annot_list(ctx, idoc, (pdf_annot *)annot, pts, counts, n, color, INK_THICKNESS);
-
-		dump_annotation_display_lists(glo);
 	}
 	fz_always(ctx)
 	{
@@ -1703,10 +3095,7 @@ JNI_FN(MuPDFCore_deleteAnnotationInternal)(JNIEnv * env, jobject thiz, int annot
 			annot = fz_next_annot(ctx, pc->page, annot);
 
 		if (annot)
-		{
 			pdf_delete_annot(ctx, idoc, (pdf_page *)pc->page, (pdf_annot *)annot);
-			dump_annotation_display_lists(glo);
-		}
 	}
 	fz_catch(ctx)
 	{
@@ -1723,8 +3112,21 @@ static void close_doc(globals *glo)
 	fz_free(glo->ctx, glo->hit_bbox);
 	glo->hit_bbox = NULL;
 
+	drop_thumbnailer(glo->thumbnailer);
+	glo->thumbnailer = NULL;
+
+	drop_list_prefetcher(glo->prefetcher);
+	glo->prefetcher = NULL;
+
 	for (i = 0; i < NUM_CACHE; i++)
 		drop_page_cache(glo, &glo->pages[i]);
+	fz_drop_page(glo->ctx, glo->query_page);
+	glo->query_page = NULL;
+
+	drop_parked_tile(glo);
+	if (glo->tiles)
+		fz_drop_hash(glo->ctx, glo->tiles);
+	glo->tiles = NULL;
 
 	alerts_fin(glo);
 
@@ -1779,7 +3181,7 @@ JNI_FN(MuPDFCore_getPageLinksInternal)(JNIEnv * env, jobject thiz, int pageNumbe
 	fz_link *list;
 	fz_link *link;
 	int count;
-	page_cache *pc;
+	fz_page *page;
 	globals *glo = get_globals(env, thiz);
 
 	linkInfoClass = (*env)->FindClass(env, PACKAGENAME "/LinkInfo");
@@ -1797,15 +3199,14 @@ JNI_FN(MuPDFCore_getPageLinksInternal)(JNIEnv * env, jobject thiz, int pageNumbe
 	ctorRemote = (*env)->GetMethodID(env, linkInfoRemoteClass, "<init>", "(FFFFLjava/lang/String;IZ)V");
 	if (ctorRemote == NULL) return NULL;
 
-	JNI_FN(MuPDFCore_gotoPageInternal)(env, thiz, pageNumber);
-	pc = &glo->pages[glo->current];
-	if (pc->page == NULL || pc->number != pageNumber)
+	page = get_query_page(glo, pageNumber);
+	if (page == NULL)
 		return NULL;
 
 	zoom = glo->resolution / 72;
 	fz_scale(&ctm, zoom, zoom);
 
-	list = fz_load_links(glo->ctx, pc->page);
+	list = fz_load_links(glo->ctx, page);
 	count = 0;
 	for (link = list; link; link = link->next)
 	{
@@ -1889,7 +3290,7 @@ JNI_FN(MuPDFCore_getWidgetAreasInternal)(JNIEnv * env, jobject thiz, int pageNum
 	fz_matrix ctm;
 	float zoom;
 	int count;
-	page_cache *pc;
+	fz_page *page;
 	globals *glo = get_globals(env, thiz);
 	if (glo == NULL)
 		return NULL;
@@ -1900,9 +3301,8 @@ JNI_FN(MuPDFCore_getWidgetAreasInternal)(JNIEnv * env, jobject thiz, int pageNum
 	ctor = (*env)->GetMethodID(env, rectFClass, "<init>", "(FFFF)V");
 	if (ctor == NULL) return NULL;
 
-	JNI_FN(MuPDFCore_gotoPageInternal)(env, thiz, pageNumber);
-	pc = &glo->pages[glo->current];
-	if (pc->number != pageNumber || pc->page == NULL)
+	page = get_query_page(glo, pageNumber);
+	if (page == NULL)
 		return NULL;
 
 	idoc = pdf_specifics(ctx, glo->doc);
@@ -1913,14 +3313,14 @@ JNI_FN(MuPDFCore_getWidgetAreasInternal)(JNIEnv * env, jobject thiz, int pageNum
 	fz_scale(&ctm, zoom, zoom);
 
 	count = 0;
-	for (widget = pdf_first_widget(ctx, idoc, (pdf_page *)pc->page); widget; widget = pdf_next_widget(ctx, widget))
+	for (widget = pdf_first_widget(ctx, idoc, (pdf_page *)page); widget; widget = pdf_next_widget(ctx, widget))
 		count ++;
 
 	arr = (*env)->NewObjectArray(env, count, rectFClass, NULL);
 	if (arr == NULL) return NULL;
 
 	count = 0;
-	for (widget = pdf_first_widget(ctx, idoc, (pdf_page *)pc->page); widget; widget = pdf_next_widget(ctx, widget))
+	for (widget = pdf_first_widget(ctx, idoc, (pdf_page *)page); widget; widget = pdf_next_widget(ctx, widget))
 	{
 		fz_rect rect;
 		pdf_bound_widget(ctx, widget, &rect);
@@ -1949,7 +3349,7 @@ JNI_FN(MuPDFCore_getAnnotationsInternal)(JNIEnv * env, jobject thiz, int pageNum
 	fz_matrix ctm;
 	float zoom;
 	int count;
-	page_cache *pc;
+	fz_page *page;
 	globals *glo = get_globals(env, thiz);
 	if (glo == NULL)
 		return NULL;
@@ -1960,27 +3360,26 @@ JNI_FN(MuPDFCore_getAnnotationsInternal)(JNIEnv * env, jobject thiz, int pageNum
 	ctor = (*env)->GetMethodID(env, annotClass, "<init>", "(FFFFI)V");
 	if (ctor == NULL) return NULL;
 
-	JNI_FN(MuPDFCore_gotoPageInternal)(env, thiz, pageNumber);
-	pc = &glo->pages[glo->current];
-	if (pc->number != pageNumber || pc->page == NULL)
+	page = get_query_page(glo, pageNumber);
+	if (page == NULL)
 		return NULL;
 
 	zoom = glo->resolution / 72;
 	fz_scale(&ctm, zoom, zoom);
 
 	count = 0;
-	for (annot = fz_first_annot(ctx, pc->page); annot; annot = fz_next_annot(ctx, pc->page, annot))
+	for (annot = fz_first_annot(ctx, page); annot; annot = fz_next_annot(ctx, page, annot))
 		count ++;
 
 	arr = (*env)->NewObjectArray(env, count, annotClass, NULL);
 	if (arr == NULL) return NULL;
 
 	count = 0;
-	for (annot = fz_first_annot(ctx, pc->page); annot; annot = fz_next_annot(ctx, pc->page, annot))
+	for (annot = fz_first_annot(ctx, page); annot; annot = fz_next_annot(ctx, page, annot))
 	{
 		fz_rect rect;
 		fz_annot_type type = pdf_annot_type(ctx, (pdf_annot *)annot);
-		fz_bound_annot(ctx, pc->page, annot, &rect);
+		fz_bound_annot(ctx, page, annot, &rect);
 		fz_transform_rect(&rect, &ctm);
 
 		jannot = (*env)->NewObject(env, annotClass, ctor,
@@ -2036,9 +3435,6 @@ JNI_FN(MuPDFCore_passClickEventInternal)(JNIEnv * env, jobject thiz, int pageNum
 		changed = pdf_pass_event(ctx, idoc, (pdf_page *)pc->page, &event);
 		event.event.pointer.ptype = PDF_POINTER_UP;
 		changed |= pdf_pass_event(ctx, idoc, (pdf_page *)pc->page, &event);
-		if (changed) {
-			dump_annotation_display_lists(glo);
-		}
 	}
 	fz_catch(ctx)
 	{
@@ -2101,7 +3497,6 @@ JNI_FN(MuPDFCore_setFocusedWidgetTextInternal)(JNIEnv * env, jobject thiz, jstri
 			if (focus)
 			{
 				result = pdf_text_widget_set_text(ctx, idoc, focus, (char *)text);
-				dump_annotation_display_lists(glo);
 			}
 		}
 	}
@@ -2271,7 +3666,6 @@ JNI_FN(MuPDFCore_setFocusedWidgetChoiceSelectedInternal)(JNIEnv * env, jobject t
 	fz_try(ctx)
 	{
 		pdf_choice_widget_set_value(ctx, idoc, focus, nsel, sel);
-		dump_annotation_display_lists(glo);
 	}
 	fz_catch(ctx)
 	{
@@ -2396,7 +3790,6 @@ JNI_FN(MuPDFCore_signFocusedSignatureInternal)(JNIEnv * env, jobject thiz, jstri
 	fz_try(ctx)
 	{
 		pdf_sign_signature(ctx, idoc, focus, keyfile, password);
-		dump_annotation_display_lists(glo);
 		res = JNI_TRUE;
 	}
 	fz_catch(ctx)
@@ -2643,6 +4036,128 @@ JNI_FN(MuPDFCore_dumpMemoryInternal)(JNIEnv * env, jobject thiz)
 #endif
 }
 
+static int pressure_from_trim_level(int level)
+{
+	if (level >= TRIM_MEMORY_COMPLETE)
+		return FZ_STORE_PRESSURE_CRITICAL;
+	if (level >= TRIM_MEMORY_MODERATE)
+		return FZ_STORE_PRESSURE_LOW;
+	if (level > TRIM_MEMORY_RUNNING_CRITICAL)
+		return FZ_STORE_PRESSURE_MODERATE; /* UI hidden, or in the background */
+	if (level == TRIM_MEMORY_RUNNING_CRITICAL)
+		return FZ_STORE_PRESSURE_CRITICAL;
+	if (level >= TRIM_MEMORY_RUNNING_LOW)
+		return FZ_STORE_PRESSURE_LOW;
+	if (level >= TRIM_MEMORY_RUNNING_MODERATE)
+		return FZ_STORE_PRESSURE_MODERATE;
+	return FZ_STORE_PRESSURE_NONE;
+}
+
+static unsigned int drop_prefetched_lists(globals *glo)
+{
+	fz_context *ctx = glo->ctx;
+	list_prefetcher *pf = glo->prefetcher;
+	unsigned int size = 0;
+	int i;
+
+	if (pf == NULL)
+		return 0;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (i = 0; i < 2 * PREFETCH_LISTS; i++)
+	{
+		size += fz_display_list_size(ctx, pf->done[i].list);
+		fz_drop_display_list(ctx, pf->done[i].list);
+		pf->done[i].list = NULL;
+	}
+	pthread_mutex_unlock(&pf->mutex);
+
+	return size;
+}
+
+/* Give up this document's own caches in the same tiers as the store:
+ * prepared images first, then rendered tiles of other pages, then the
+ * display lists of other pages. What is left is trimmed to the reduced
+ * budgets. The current page keeps its display list and tiles. */
+static void trim_caches(globals *glo, unsigned int *freed)
+{
+	fz_context *ctx = glo->ctx;
+	page_cache *current = &glo->pages[glo->current];
+	size_t tiles_size = glo->tiles_size;
+	size_t size;
+	tile *t, *prev;
+	int i;
+
+	if (glo->pressure >= FZ_STORE_PRESSURE_MODERATE && current->page)
+	{
+		/* Its memory is not accounted, so nothing is added to freed */
+		fz_try(ctx)
+			fz_prefetch_pages(ctx, glo->doc, current->number, 0, 0, 0, 0, 0);
+		fz_catch(ctx)
+			LOGE("Releasing prefetched pages failed");
+	}
+
+	for (t = glo->tiles_tail; t; t = prev)
+	{
+		prev = t->prev;
+		if (t->key.page == current->number && current->page)
+			continue;
+		if (glo->pressure >= FZ_STORE_PRESSURE_LOW || glo->tiles_size > cache_budget(glo, TILE_CACHE_BUDGET))
+			drop_tile(glo, t);
+	}
+	if (glo->parked.runner && glo->parked.key.page != current->number)
+		drop_parked_tile(glo);
+
+	size = 0;
+	for (i = 0; i < NUM_CACHE; i++)
+		if (glo->pages[i].page)
+			size += page_cache_size(ctx, &glo->pages[i]);
+	if (glo->pressure >= FZ_STORE_PRESSURE_CRITICAL)
+	{
+		for (i = 0; i < NUM_CACHE; i++)
+			if (i != glo->current && glo->pages[i].page)
+				drop_page_cache(glo, &glo->pages[i]);
+		fz_drop_page(ctx, glo->query_page);
+		glo->query_page = NULL;
+		freed[FZ_STORE_TIER_RESOURCES] += drop_prefetched_lists(glo);
+	}
+	else if (current->page)
+		trim_page_cache(glo);
+	for (i = 0; i < NUM_CACHE; i++)
+		if (glo->pages[i].page)
+			size -= page_cache_size(ctx, &glo->pages[i]);
+	freed[FZ_STORE_TIER_RESOURCES] += size;
+	freed[FZ_STORE_TIER_TILES] += tiles_size - glo->tiles_size;
+}
+
+/* Called with the level from ComponentCallbacks2.onTrimMemory, or 0 once
+ * memory is no longer short. The store is shared by all documents, so
+ * this relieves all of them, and this document's caches too. Returns the
+ * number of bytes given up. */
+JNIEXPORT jlong JNICALL
+JNI_FN(MuPDFCore_trimMemory)(JNIEnv * env, jobject thiz, int level)
+{
+	globals *glo = get_globals(env, thiz);
+	unsigned int freed[FZ_STORE_TIER_MAX];
+	jlong total = 0;
+	int i;
+
+	if (glo == NULL)
+		return 0;
+
+	glo->pressure = pressure_from_trim_level(level);
+	fz_store_pressure(glo->ctx, glo->pressure, freed);
+	trim_caches(glo, freed);
+	for (i = 0; i < FZ_STORE_TIER_MAX; i++)
+		total += freed[i];
+
+	LOGI("Trim memory %d: freed %u image, %u tile, %u resource and %u glyph bytes",
+		level, freed[FZ_STORE_TIER_IMAGES], freed[FZ_STORE_TIER_TILES],
+		freed[FZ_STORE_TIER_RESOURCES], freed[FZ_STORE_TIER_GLYPHS]);
+
+	return total;
+}
+
 JNIEXPORT jlong JNICALL
 JNI_FN(MuPDFCore_createCookie)(JNIEnv * env, jobject thiz)
 {
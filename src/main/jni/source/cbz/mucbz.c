@@ -23,6 +23,8 @@ struct cbz_document_s
 	fz_archive *zip;
 	int page_count;
 	const char **page;
+	fz_image **image; /* Pages around the current one, held for prefetching */
+	fz_prefetcher *prefetcher;
 };
 
 static inline int cbz_isdigit(int c)
@@ -103,6 +105,15 @@ cbz_create_page_list(fz_context *ctx, cbz_document *doc)
 static void
 cbz_close_document(fz_context *ctx, cbz_document *doc)
 {
+	int i;
+
+	fz_drop_prefetcher(ctx, doc->prefetcher);
+	if (doc->image)
+	{
+		for (i = 0; i < doc->page_count; i++)
+			fz_drop_image(ctx, doc->image[i]);
+		fz_free(ctx, doc->image);
+	}
 	fz_drop_archive(ctx, doc->zip);
 	fz_free(ctx, (char **)doc->page);
 	fz_free(ctx, doc);
@@ -150,35 +161,47 @@ cbz_drop_page_imp(fz_context *ctx, cbz_page *page)
 	fz_drop_image(ctx, page->image);
 }
 
+static fz_image *
+cbz_load_image(fz_context *ctx, cbz_document *doc, int number)
+{
+	fz_image *image;
+	fz_buffer *buf;
+
+	/* Use the prefetched image, as its decoded pixmap is keyed on it */
+	if (doc->image && doc->image[number])
+		return fz_keep_image(ctx, doc->image[number]);
+
+	buf = fz_read_archive_entry(ctx, doc->zip, doc->page[number]);
+	fz_try(ctx)
+		image = fz_new_image_from_buffer(ctx, buf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return image;
+}
+
 static cbz_page *
 cbz_load_page(fz_context *ctx, cbz_document *doc, int number)
 {
-	unsigned char *data = NULL;
 	cbz_page *page = NULL;
-	fz_buffer *buf;
 
 	if (number < 0 || number >= doc->page_count)
 		return NULL;
 
-	fz_var(data);
 	fz_var(page);
 
-	buf = fz_read_archive_entry(ctx, doc->zip, doc->page[number]);
 	fz_try(ctx)
 	{
 		page = fz_new_page(ctx, sizeof *page);
 		page->super.bound_page = (fz_page_bound_page_fn *)cbz_bound_page;
 		page->super.run_page_contents = (fz_page_run_page_contents_fn *)cbz_run_page;
 		page->super.drop_page_imp = (fz_page_drop_page_imp_fn *)cbz_drop_page_imp;
-		page->image = fz_new_image_from_buffer(ctx, buf);
-	}
-	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, buf);
+		page->image = cbz_load_image(ctx, doc, number);
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, data);
 		cbz_drop_page_imp(ctx, page);
 		fz_rethrow(ctx);
 	}
@@ -186,6 +209,70 @@ cbz_load_page(fz_context *ctx, cbz_document *doc, int number)
 	return page;
 }
 
+/*
+	The archive is read here, on the calling thread, as it is not safe
+	to share; only decoding the images is left to the prefetcher.
+*/
+static void
+cbz_prefetch_pages(fz_context *ctx, cbz_document *doc, int number, int ahead, int behind, int w, int h, unsigned int budget)
+{
+	fz_image **want;
+	int i, n, lo, hi, count = 0;
+
+	if (!doc->prefetcher)
+	{
+		if (budget == 0)
+			return;
+		if (!doc->image)
+			doc->image = fz_calloc(ctx, doc->page_count, sizeof *doc->image);
+		doc->prefetcher = fz_new_prefetcher(ctx);
+		if (!doc->prefetcher)
+			return;
+	}
+
+	ahead = fz_maxi(ahead, 0);
+	behind = fz_maxi(behind, 0);
+	lo = fz_maxi(number - behind, 0);
+	hi = fz_mini(number + ahead, doc->page_count - 1);
+	if (budget == 0)
+		hi = lo - 1;
+
+	for (i = 0; i < doc->page_count; i++)
+	{
+		if ((i < lo || i > hi) && doc->image[i])
+		{
+			fz_drop_image(ctx, doc->image[i]);
+			doc->image[i] = NULL;
+		}
+	}
+
+	want = fz_malloc_array(ctx, ahead + behind + 1, sizeof *want);
+	fz_try(ctx)
+	{
+		/* The page itself first, then forwards, then backwards */
+		for (i = 0; i <= ahead + behind; i++)
+		{
+			n = i <= ahead ? number + i : number + ahead - i;
+			if (n < lo || n > hi)
+				continue;
+			if (!doc->image[n])
+			{
+				fz_try(ctx)
+					doc->image[n] = cbz_load_image(ctx, doc, n);
+				fz_catch(ctx)
+					fz_warn(ctx, "cannot prefetch page %d", n + 1);
+			}
+			if (doc->image[n])
+				want[count++] = doc->image[n];
+		}
+		fz_prefetch_images(ctx, doc->prefetcher, want, count, w, h, budget);
+	}
+	fz_always(ctx)
+		fz_free(ctx, want);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 static int
 cbz_meta(fz_context *ctx, cbz_document *doc, int key, void *ptr, int size)
 {
@@ -208,6 +295,7 @@ cbz_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	doc->super.count_pages = (fz_document_count_pages_fn *)cbz_count_pages;
 	doc->super.load_page = (fz_document_load_page_fn *)cbz_load_page;
 	doc->super.meta = (fz_document_meta_fn *)cbz_meta;
+	doc->super.prefetch_pages = (fz_document_prefetch_pages_fn *)cbz_prefetch_pages;
 
 	fz_try(ctx)
 	{
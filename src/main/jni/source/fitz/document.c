@@ -226,6 +226,13 @@ fz_load_page(fz_context *ctx, fz_document *doc, int number)
 	return NULL;
 }
 
+void
+fz_prefetch_pages(fz_context *ctx, fz_document *doc, int number, int ahead, int behind, int w, int h, unsigned int budget)
+{
+	if (doc && doc->prefetch_pages)
+		doc->prefetch_pages(ctx, doc, number, ahead, behind, w, h, budget);
+}
+
 fz_link *
 fz_load_links(fz_context *ctx, fz_page *page)
 {
@@ -700,6 +700,138 @@ fz_paint_affine_color_N_near(byte *dp, byte *sp, int sw, int sh, int u, int v, i
 	}
 }
 
+/* Special case code for rgb -> gray */
+static inline int rgb2g(const byte *s)
+{
+	return ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
+}
+
+static inline void
+fz_paint_affine_alpha_rgb2g_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int alpha, byte *hp)
+{
+	while (w--)
+	{
+		int ui = u >> 16;
+		int vi = v >> 16;
+		if (ui >= 0 && ui < sw && vi >= 0 && vi < sh)
+		{
+			int uf = u & 0xffff;
+			int vf = v & 0xffff;
+			byte *a = sample_nearest(sp, sw, sh, 4, ui, vi);
+			byte *b = sample_nearest(sp, sw, sh, 4, ui+1, vi);
+			byte *c = sample_nearest(sp, sw, sh, 4, ui, vi+1);
+			byte *d = sample_nearest(sp, sw, sh, 4, ui+1, vi+1);
+			int y = bilerp(a[3], b[3], c[3], d[3], uf, vf);
+			int x = bilerp(rgb2g(a), rgb2g(b), rgb2g(c), rgb2g(d), uf, vf);
+			int t;
+			x = fz_mul255(x, alpha);
+			y = fz_mul255(y, alpha);
+			t = 255 - y;
+			dp[0] = x + fz_mul255(dp[0], t);
+			dp[1] = y + fz_mul255(dp[1], t);
+			if (hp)
+				hp[0] = y + fz_mul255(hp[0], t);
+		}
+		dp += 2;
+		if (hp)
+			hp++;
+		u += fa;
+		v += fb;
+	}
+}
+
+static inline void
+fz_paint_affine_solid_rgb2g_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, byte *hp)
+{
+	while (w--)
+	{
+		int ui = u >> 16;
+		int vi = v >> 16;
+		if (ui >= 0 && ui < sw && vi >= 0 && vi < sh)
+		{
+			int uf = u & 0xffff;
+			int vf = v & 0xffff;
+			byte *a = sample_nearest(sp, sw, sh, 4, ui, vi);
+			byte *b = sample_nearest(sp, sw, sh, 4, ui+1, vi);
+			byte *c = sample_nearest(sp, sw, sh, 4, ui, vi+1);
+			byte *d = sample_nearest(sp, sw, sh, 4, ui+1, vi+1);
+			int y = bilerp(a[3], b[3], c[3], d[3], uf, vf);
+			int t = 255 - y;
+			int x = bilerp(rgb2g(a), rgb2g(b), rgb2g(c), rgb2g(d), uf, vf);
+			dp[0] = x + fz_mul255(dp[0], t);
+			dp[1] = y + fz_mul255(dp[1], t);
+			if (hp)
+				hp[0] = y + fz_mul255(hp[0], t);
+		}
+		dp += 2;
+		if (hp)
+			hp++;
+		u += fa;
+		v += fb;
+	}
+}
+
+static inline void
+fz_paint_affine_alpha_rgb2g_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int alpha, byte *hp)
+{
+	while (w--)
+	{
+		int ui = u >> 16;
+		int vi = v >> 16;
+		if (ui >= 0 && ui < sw && vi >= 0 && vi < sh)
+		{
+			byte *sample = sp + ((vi * sw + ui) * 4);
+			int x = fz_mul255(rgb2g(sample), alpha);
+			int a = fz_mul255(sample[3], alpha);
+			int t = 255 - a;
+			dp[0] = x + fz_mul255(dp[0], t);
+			dp[1] = a + fz_mul255(dp[1], t);
+			if (hp)
+				hp[0] = a + fz_mul255(hp[0], t);
+		}
+		dp += 2;
+		if (hp)
+			hp++;
+		u += fa;
+		v += fb;
+	}
+}
+
+static inline void
+fz_paint_affine_solid_rgb2g_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, byte *hp)
+{
+	while (w--)
+	{
+		int ui = u >> 16;
+		int vi = v >> 16;
+		if (ui >= 0 && ui < sw && vi >= 0 && vi < sh)
+		{
+			byte *sample = sp + ((vi * sw + ui) * 4);
+			int a = sample[3];
+			if (a == 255)
+			{
+				dp[0] = rgb2g(sample);
+				dp[1] = 255;
+				if (hp)
+					hp[0] = 255;
+			}
+			else if (a != 0)
+			{
+				int t = 255 - a;
+				dp[0] = rgb2g(sample) + fz_mul255(dp[0], t);
+				dp[1] = a + fz_mul255(dp[1], t);
+				if (hp)
+					hp[0] = a + fz_mul255(hp[0], t);
+			}
+		}
+		dp += 2;
+		if (hp)
+			hp++;
+		u += fa;
+		v += fb;
+	}
+}
+
 static void
 fz_paint_affine_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
 {
@@ -738,6 +870,19 @@ fz_paint_affine_g2rgb_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int
 	}
 }
 
+static void
+fz_paint_affine_rgb2g_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
+{
+	if (alpha == 255)
+	{
+		fz_paint_affine_solid_rgb2g_lerp(dp, sp, sw, sh, u, v, fa, fb, w, hp);
+	}
+	else if (alpha > 0)
+	{
+		fz_paint_affine_alpha_rgb2g_lerp(dp, sp, sw, sh, u, v, fa, fb, w, alpha, hp);
+	}
+}
+
 static void
 fz_paint_affine_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused */, byte *hp)
 {
@@ -776,6 +921,19 @@ fz_paint_affine_g2rgb_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int
 	}
 }
 
+static void
+fz_paint_affine_rgb2g_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
+{
+	if (alpha == 255)
+	{
+		fz_paint_affine_solid_rgb2g_near(dp, sp, sw, sh, u, v, fa, fb, w, hp);
+	}
+	else if (alpha > 0)
+	{
+		fz_paint_affine_alpha_rgb2g_near(dp, sp, sw, sh, u, v, fa, fb, w, alpha, hp);
+	}
+}
+
 static void
 fz_paint_affine_color_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha/*unused*/, byte *color, byte *hp)
 {
@@ -1055,6 +1213,14 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 		else
 			paintfn = fz_paint_affine_g2rgb_near;
 	}
+	else if (dst->n == 2 && img->n == 4)
+	{
+		assert(!color);
+		if (dolerp)
+			paintfn = fz_paint_affine_rgb2g_lerp;
+		else
+			paintfn = fz_paint_affine_rgb2g_near;
+	}
 	else
 	{
 		if (dolerp)
@@ -1093,6 +1259,6 @@ fz_paint_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *sh
 void
 fz_paint_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, int alpha, int lerp_allowed)
 {
-	assert(dst->n == img->n || (dst->n == 4 && img->n == 2));
+	assert(dst->n == img->n || (dst->n == 4 && img->n == 2) || (dst->n == 2 && img->n == 4));
 	fz_paint_image_imp(dst, scissor, shape, img, ctm, NULL, alpha, lerp_allowed);
 }
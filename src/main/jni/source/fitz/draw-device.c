@@ -3,6 +3,12 @@
 
 #define STACK_SIZE 96
 
+/* Number of group/mask/clip buffers kept for reuse by a draw device */
+#define POOL_SIZE 8
+
+/* Draft rendering paints shadings at this fraction of the resolution */
+#define DRAFT_SHADE_SCALE 4
+
 /* Enable the following to attempt to support knockout and/or isolated
  * blending groups. */
 #define ATTEMPT_KNOCKOUT_AND_ISOLATED
@@ -17,9 +23,11 @@ typedef struct fz_draw_device_s fz_draw_device;
 
 enum {
 	FZ_DRAWDEV_FLAGS_TYPE3 = 1,
+	FZ_DRAWDEV_FLAGS_DRAFT = 2,
 };
 
 typedef struct fz_draw_state_s fz_draw_state;
+typedef struct fz_draw_buffer_s fz_draw_buffer;
 
 struct fz_draw_state_s {
 	fz_irect scissor;
@@ -35,6 +43,11 @@ struct fz_draw_state_s {
 	fz_irect area;
 };
 
+struct fz_draw_buffer_s {
+	unsigned char *samples;
+	unsigned int size;
+};
+
 struct fz_draw_device_s
 {
 	fz_device super;
@@ -46,6 +59,14 @@ struct fz_draw_device_s
 	fz_draw_state *stack;
 	int stack_cap;
 	fz_draw_state init_stack[STACK_SIZE];
+	fz_draw_buffer pool[POOL_SIZE + 1];
+	int pool_len;
+	unsigned int pool_size;
+	fz_draw_buffer *lent;
+	int lent_len;
+	int lent_cap;
+	unsigned int lent_size;
+	unsigned int lent_peak;
 };
 
 #ifdef DUMP_GROUP_BLENDS
@@ -134,14 +155,140 @@ push_stack(fz_context *ctx, fz_draw_device *dev)
 	return state;
 }
 
+/* Group, mask, clip and knockout pixmaps live only between a push and
+ * the matching pop, and nested content pushes the same few sizes over
+ * and over. Rather than allocating (and faulting in) fresh samples for
+ * each push, the device keeps the buffers of popped pixmaps in a small
+ * pool and wraps the next push's pixmap around one of them. Buffers are
+ * rounded up to size classes so that one can serve similar bboxes. The
+ * pool never holds more than the most this device has had pushed at
+ * once, and callers still clear only the bbox they push. */
+static unsigned int
+buffer_size_class(unsigned int size)
+{
+	unsigned int step = 4096;
+
+	while (step < (UINT_MAX >> 4) && step * 8 < size)
+		step *= 2;
+	if (size == 0)
+		size = 1;
+	return (size + step - 1) / step * step;
+}
+
+static void
+release_buffer(fz_context *ctx, fz_draw_device *dev, fz_draw_buffer buf)
+{
+	int i, k;
+
+	dev->pool[dev->pool_len++] = buf;
+	dev->pool_size += buf.size;
+
+	/* Too many buffers: lose the smallest. Too many bytes: the largest. */
+	while (dev->pool_len > POOL_SIZE || dev->pool_size > dev->lent_peak)
+	{
+		int fewer = dev->pool_len > POOL_SIZE;
+
+		k = 0;
+		for (i = 1; i < dev->pool_len; i++)
+			if (fewer ? dev->pool[i].size < dev->pool[k].size : dev->pool[i].size > dev->pool[k].size)
+				k = i;
+		dev->pool_size -= dev->pool[k].size;
+		fz_free(ctx, dev->pool[k].samples);
+		dev->pool[k] = dev->pool[--dev->pool_len];
+	}
+}
+
+static fz_pixmap *
+new_stack_pixmap(fz_context *ctx, fz_draw_device *dev, fz_colorspace *colorspace, const fz_irect *bbox)
+{
+	int n = colorspace ? colorspace->n + 1 : 1;
+	int w = bbox->x1 - bbox->x0;
+	int h = bbox->y1 - bbox->y0;
+	fz_draw_buffer buf = { NULL, 0 };
+	fz_pixmap *pix = NULL;
+	int i, best = -1;
+
+	/* Leave anything odd or huge to the ordinary allocator */
+	if (w <= 0 || h <= 0 || w > INT_MAX / n || h > (INT_MAX >> 1) / (w * n))
+		return fz_new_pixmap_with_bbox(ctx, colorspace, bbox);
+
+	for (i = 0; i < dev->pool_len; i++)
+		if (dev->pool[i].size >= (unsigned int)(w * h * n) && (best < 0 || dev->pool[i].size < dev->pool[best].size))
+			best = i;
+	if (best >= 0)
+	{
+		buf = dev->pool[best];
+		dev->pool_size -= buf.size;
+		dev->pool[best] = dev->pool[--dev->pool_len];
+	}
+	else
+	{
+		buf.size = buffer_size_class(w * h * n);
+		buf.samples = Memento_label(fz_malloc(ctx, buf.size), "draw device buffer");
+	}
+
+	fz_try(ctx)
+	{
+		if (dev->lent_len == dev->lent_cap)
+		{
+			int cap = dev->lent_cap ? dev->lent_cap * 2 : 16;
+			dev->lent = fz_resize_array(ctx, dev->lent, cap, sizeof(*dev->lent));
+			dev->lent_cap = cap;
+		}
+		pix = fz_new_pixmap_with_bbox_and_data(ctx, colorspace, bbox, buf.samples);
+	}
+	fz_catch(ctx)
+	{
+		release_buffer(ctx, dev, buf);
+		fz_rethrow(ctx);
+	}
+	dev->lent[dev->lent_len++] = buf;
+	dev->lent_size += buf.size;
+	if (dev->lent_peak < dev->lent_size)
+		dev->lent_peak = dev->lent_size;
+
+	return pix;
+}
+
+static void
+drop_stack_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *pix)
+{
+	int i;
+
+	if (pix == NULL)
+		return;
+
+	/* Pushes and pops nest, so look from the most recent end */
+	for (i = dev->lent_len - 1; i >= 0; i--)
+		if (dev->lent[i].samples == pix->samples)
+			break;
+	if (i >= 0)
+	{
+		fz_draw_buffer buf = dev->lent[i];
+
+		dev->lent[i] = dev->lent[--dev->lent_len];
+		dev->lent_size -= buf.size;
+		if (pix->storable.refs == 1)
+		{
+			pix->samples = NULL;
+			fz_drop_pixmap(ctx, pix);
+			release_buffer(ctx, dev, buf);
+			return;
+		}
+		/* Someone else still holds the pixmap; let it own the samples */
+		pix->free_samples = 1;
+	}
+	fz_drop_pixmap(ctx, pix);
+}
+
 static void emergency_pop_stack(fz_context *ctx, fz_draw_device *dev, fz_draw_state *state)
 {
 	if (state[1].mask != state[0].mask)
-		fz_drop_pixmap(ctx, state[1].mask);
+		drop_stack_pixmap(ctx, dev, state[1].mask);
 	if (state[1].dest != state[0].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		drop_stack_pixmap(ctx, dev, state[1].dest);
 	if (state[1].shape != state[0].shape)
-		fz_drop_pixmap(ctx, state[1].shape);
+		drop_stack_pixmap(ctx, dev, state[1].shape);
 	dev->top--;
 	STACK_POPPED("emergency");
 	fz_rethrow(ctx);
@@ -163,7 +310,7 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 
 	fz_pixmap_bbox(ctx, state->dest, &bbox);
 	fz_intersect_irect(&bbox, &state->scissor);
-	dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox);
+	dest = new_stack_pixmap(ctx, dev, state->dest->colorspace, &bbox);
 
 	if (isolated)
 	{
@@ -194,7 +341,7 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 	}
 	else
 	{
-		shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+		shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 		fz_clear_pixmap(ctx, shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
@@ -250,12 +397,12 @@ static void fz_knockout_end(fz_context *ctx, fz_draw_device *dev)
 	 * errors can cause the stack to get out of sync, and this saves our
 	 * bacon. */
 	if (state[0].dest != state[1].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		drop_stack_pixmap(ctx, dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
 			fz_paint_pixmap(state[0].shape, state[1].shape, 255);
-		fz_drop_pixmap(ctx, state[1].shape);
+		drop_stack_pixmap(ctx, dev, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, state[0].dest, " to get ");
@@ -424,13 +571,13 @@ fz_draw_clip_path(fz_context *ctx, fz_device *devp, fz_path *path, const fz_rect
 
 	fz_try(ctx)
 	{
-		state[1].mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+		state[1].mask = new_stack_pixmap(ctx, dev, NULL, &bbox);
 		fz_clear_pixmap(ctx, state[1].mask);
-		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox);
+		state[1].dest = new_stack_pixmap(ctx, dev, model, &bbox);
 		fz_clear_pixmap(ctx, state[1].dest);
 		if (state[1].shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			state[1].shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -486,13 +633,13 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, fz_path *path, const
 
 	fz_try(ctx)
 	{
-		state[1].mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+		state[1].mask = new_stack_pixmap(ctx, dev, NULL, &bbox);
 		fz_clear_pixmap(ctx, state[1].mask);
-		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox);
+		state[1].dest = new_stack_pixmap(ctx, dev, model, &bbox);
 		fz_clear_pixmap(ctx, state[1].dest);
 		if (state->shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			state[1].shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -737,13 +884,13 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, fz_text *text, const fz_matr
 	{
 		if (accumulate == 0 || accumulate == 1)
 		{
-			mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			mask = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, mask);
-			dest = fz_new_pixmap_with_bbox(ctx, model, &bbox);
+			dest = new_stack_pixmap(ctx, dev, model, &bbox);
 			fz_clear_pixmap(ctx, dest);
 			if (state->shape)
 			{
-				shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+				shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 				fz_clear_pixmap(ctx, shape);
 			}
 			else
@@ -851,13 +998,13 @@ fz_draw_clip_stroke_text(fz_context *ctx, fz_device *devp, fz_text *text, fz_str
 
 	fz_try(ctx)
 	{
-		state[1].mask = mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+		state[1].mask = mask = new_stack_pixmap(ctx, dev, NULL, &bbox);
 		fz_clear_pixmap(ctx, mask);
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox);
+		state[1].dest = dest = new_stack_pixmap(ctx, dev, model, &bbox);
 		fz_clear_pixmap(ctx, dest);
 		if (state->shape)
 		{
-			state[1].shape = shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			state[1].shape = shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, shape);
 		}
 		else
@@ -939,6 +1086,47 @@ fz_draw_ignore_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_mat
 {
 }
 
+/* Paint a shading into a small buffer and scale that up without
+ * interpolation. Unlike a flat average colour this keeps the outline of
+ * the shading, and stays far cheaper than a full resolution paint. */
+static void
+fz_paint_shade_draft(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap *dest, const fz_irect *bbox)
+{
+	fz_pixmap *small;
+	fz_irect small_bbox;
+	fz_matrix local_ctm, image_ctm;
+	float scale = 1.0f / DRAFT_SHADE_SCALE;
+
+	small_bbox.x0 = floorf(bbox->x0 * scale);
+	small_bbox.y0 = floorf(bbox->y0 * scale);
+	small_bbox.x1 = ceilf(bbox->x1 * scale);
+	small_bbox.y1 = ceilf(bbox->y1 * scale);
+	fz_concat(&local_ctm, ctm, fz_scale(&image_ctm, scale, scale));
+
+	small = fz_new_pixmap_with_bbox(ctx, dest->colorspace, &small_bbox);
+	fz_try(ctx)
+	{
+		fz_clear_pixmap(ctx, small);
+		fz_paint_shade(ctx, shade, &local_ctm, small, &small_bbox);
+
+		image_ctm.a = small->w * DRAFT_SHADE_SCALE;
+		image_ctm.b = 0;
+		image_ctm.c = 0;
+		image_ctm.d = small->h * DRAFT_SHADE_SCALE;
+		image_ctm.e = small->x * DRAFT_SHADE_SCALE;
+		image_ctm.f = small->y * DRAFT_SHADE_SCALE;
+		fz_paint_image(dest, bbox, NULL, small, &image_ctm, 255, 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, small);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 static void
 fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_matrix *ctm, float alpha)
 {
@@ -972,11 +1160,11 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 
 	if (alpha < 1)
 	{
-		dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox);
+		dest = new_stack_pixmap(ctx, dev, state->dest->colorspace, &bbox);
 		fz_clear_pixmap(ctx, dest);
 		if (shape)
 		{
-			shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, shape);
 		}
 	}
@@ -1013,18 +1201,21 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 		}
 	}
 
-	fz_paint_shade(ctx, shade, ctm, dest, &bbox);
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+		fz_paint_shade_draft(ctx, shade, ctm, dest, &bbox);
+	else
+		fz_paint_shade(ctx, shade, ctm, dest, &bbox);
 	if (shape)
 		fz_clear_pixmap_rect_with_value(ctx, shape, 255, &bbox);
 
 	if (alpha < 1)
 	{
 		fz_paint_pixmap(state->dest, dest, alpha * 255);
-		fz_drop_pixmap(ctx, dest);
+		drop_stack_pixmap(ctx, dev, dest);
 		if (shape)
 		{
 			fz_paint_pixmap(state->shape, shape, alpha * 255);
-			fz_drop_pixmap(ctx, shape);
+			drop_stack_pixmap(ctx, dev, shape);
 		}
 	}
 
@@ -1118,7 +1309,12 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
 
-	pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+	/* Drafts accept one more level of subsampling. Any finer version
+	 * already in the store is still used. */
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+		pixmap = fz_new_pixmap_from_image(ctx, image, dx / 2, dy / 2);
+	else
+		pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
 	orig_pixmap = pixmap;
 
 	/* convert images with more components (cmyk->rgb) before scaling */
@@ -1133,6 +1329,10 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 		after = 0;
 		if (pixmap->colorspace == fz_device_gray(ctx))
 			after = 1;
+		/* RGB images are painted into gray straight from the scaled
+		 * pixmap, so only the part that is drawn gets converted */
+		if (pixmap->colorspace == fz_device_rgb(ctx) && model == fz_device_gray(ctx))
+			after = 1;
 
 		if (pixmap->colorspace != model && !after)
 		{
@@ -1162,9 +1362,11 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 		if (pixmap->colorspace != model)
 		{
 			if ((pixmap->colorspace == fz_device_gray(ctx) && model == fz_device_rgb(ctx)) ||
-				(pixmap->colorspace == fz_device_gray(ctx) && model == fz_device_bgr(ctx)))
+				(pixmap->colorspace == fz_device_gray(ctx) && model == fz_device_bgr(ctx)) ||
+				(pixmap->colorspace == fz_device_rgb(ctx) && model == fz_device_gray(ctx)))
 			{
-				/* We have special case rendering code for gray -> rgb/bgr */
+				/* We have special case rendering code for gray -> rgb/bgr
+				 * and rgb -> gray */
 			}
 			else
 			{
@@ -1324,14 +1526,14 @@ fz_draw_clip_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 		pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
 		orig_pixmap = pixmap;
 
-		state[1].mask = mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+		state[1].mask = mask = new_stack_pixmap(ctx, dev, NULL, &bbox);
 		fz_clear_pixmap(ctx, mask);
 
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox);
+		state[1].dest = dest = new_stack_pixmap(ctx, dev, model, &bbox);
 		fz_clear_pixmap(ctx, dest);
 		if (state->shape)
 		{
-			state[1].shape = shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			state[1].shape = shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, shape);
 		}
 
@@ -1399,15 +1601,15 @@ fz_draw_pop_clip(fz_context *ctx, fz_device *devp)
 		if (state[0].shape != state[1].shape)
 		{
 			fz_paint_pixmap_with_mask(state[0].shape, state[1].shape, state[1].mask);
-			fz_drop_pixmap(ctx, state[1].shape);
+			drop_stack_pixmap(ctx, dev, state[1].shape);
 		}
 		/* The following tests should not be required, but just occasionally
 		 * errors can cause the stack to get out of sync, and this might save
 		 * our bacon. */
 		if (state[0].mask != state[1].mask)
-			fz_drop_pixmap(ctx, state[1].mask);
+			drop_stack_pixmap(ctx, dev, state[1].mask);
 		if (state[0].dest != state[1].dest)
-			fz_drop_pixmap(ctx, state[1].dest);
+			drop_stack_pixmap(ctx, dev, state[1].dest);
 #ifdef DUMP_GROUP_BLENDS
 		fz_dump_blend(ctx, state[0].dest, " to get ");
 		if (state[0].shape)
@@ -1433,11 +1635,21 @@ fz_draw_begin_mask(fz_context *ctx, fz_device *devp, const fz_rect *rect, int lu
 	fz_pixmap *shape = state->shape;
 
 	STACK_PUSHED("mask");
+
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+	{
+		/* Drafts leave out soft masked content altogether, as
+		 * drawing it unmasked can cover much of the page */
+		state[1].scissor = fz_empty_irect;
+		state[1].mask = NULL;
+		return;
+	}
+
 	fz_intersect_irect(fz_irect_from_rect(&bbox, rect), &state->scissor);
 
 	fz_try(ctx)
 	{
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), &bbox);
+		state[1].dest = dest = new_stack_pixmap(ctx, dev, fz_device_gray(ctx), &bbox);
 		if (state->shape)
 		{
 			/* FIXME: If we ever want to support AIS true, then
@@ -1494,6 +1706,10 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 	}
 	state = &dev->stack[dev->top-1];
 	STACK_CONVERT("(mask)");
+
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+		return;
+
 	/* pop soft mask buffer */
 	luminosity = state[1].luminosity;
 
@@ -1505,18 +1721,18 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 		/* convert to alpha mask */
 		temp = fz_alpha_from_gray(ctx, state[1].dest, luminosity);
 		if (state[1].mask != state[0].mask)
-			fz_drop_pixmap(ctx, state[1].mask);
+			drop_stack_pixmap(ctx, dev, state[1].mask);
 		state[1].mask = temp;
 		if (state[1].dest != state[0].dest)
-			fz_drop_pixmap(ctx, state[1].dest);
+			drop_stack_pixmap(ctx, dev, state[1].dest);
 		state[1].dest = NULL;
 		if (state[1].shape != state[0].shape)
-			fz_drop_pixmap(ctx, state[1].shape);
+			drop_stack_pixmap(ctx, dev, state[1].shape);
 		state[1].shape = NULL;
 
 		/* create new dest scratch buffer */
 		fz_pixmap_bbox(ctx, temp, &bbox);
-		dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox);
+		dest = new_stack_pixmap(ctx, dev, state->dest->colorspace, &bbox);
 		fz_clear_pixmap(ctx, dest);
 
 		/* push soft mask as clip mask */
@@ -1526,7 +1742,7 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 		 * clip mask when we pop. So create a new shape now. */
 		if (state[0].shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			state[1].shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 		state[1].scissor = bbox;
@@ -1546,6 +1762,17 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, const fz_rect *rect, int i
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
 
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+	{
+		/* Drafts draw group contents straight onto the backdrop,
+		 * without group alpha, blending or knockout */
+		state = push_stack(ctx, dev);
+		STACK_PUSHED("group");
+		fz_intersect_irect(fz_irect_from_rect(&bbox, rect), &state->scissor);
+		state[1].scissor = bbox;
+		return;
+	}
+
 	if (state->blendmode & FZ_BLEND_KNOCKOUT)
 		fz_knockout_begin(ctx, dev);
 
@@ -1555,7 +1782,7 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, const fz_rect *rect, int i
 
 	fz_try(ctx)
 	{
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox);
+		state[1].dest = dest = new_stack_pixmap(ctx, dev, model, &bbox);
 
 #ifndef ATTEMPT_KNOCKOUT_AND_ISOLATED
 		knockout = 0;
@@ -1579,7 +1806,7 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, const fz_rect *rect, int i
 		}
 		else
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox);
+			state[1].shape = new_stack_pixmap(ctx, dev, NULL, &bbox);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -1614,6 +1841,8 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 
 	state = &dev->stack[--dev->top];
 	STACK_POPPED("group");
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+		return;
 	alpha = state[1].alpha;
 	blendmode = state[1].blendmode & FZ_BLEND_MODEMASK;
 	isolated = state[1].blendmode & FZ_BLEND_ISOLATED;
@@ -1643,12 +1872,12 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 	 * errors can cause the stack to get out of sync, and this might save
 	 * our bacon. */
 	if (state[0].dest != state[1].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		drop_stack_pixmap(ctx, dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
 			fz_paint_pixmap(state[0].shape, state[1].shape, alpha * 255);
-		fz_drop_pixmap(ctx, state[1].shape);
+		drop_stack_pixmap(ctx, dev, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, state[0].dest, " to get ");
@@ -1726,6 +1955,7 @@ static fz_store_type fz_tile_store_type =
 	fz_keep_tile_key,
 	fz_drop_tile_key,
 	fz_cmp_tile_key,
+	FZ_STORE_TIER_TILES,
 #ifndef NDEBUG
 	fz_debug_tile
 #endif
@@ -1997,9 +2227,9 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	 * errors can cause the stack to get out of sync, and this might save
 	 * our bacon. */
 	if (state[0].dest != state[1].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		drop_stack_pixmap(ctx, dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
-		fz_drop_pixmap(ctx, state[1].shape);
+		drop_stack_pixmap(ctx, dev, state[1].shape);
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, state[0].dest, " to get ");
 	if (state[0].shape)
@@ -2025,11 +2255,11 @@ fz_draw_drop_imp(fz_context *ctx, fz_device *devp)
 	{
 		fz_draw_state *state = &dev->stack[dev->top];
 		if (state[1].mask != state[0].mask)
-			fz_drop_pixmap(ctx, state[1].mask);
+			drop_stack_pixmap(ctx, dev, state[1].mask);
 		if (state[1].dest != state[0].dest)
-			fz_drop_pixmap(ctx, state[1].dest);
+			drop_stack_pixmap(ctx, dev, state[1].dest);
 		if (state[1].shape != state[0].shape)
-			fz_drop_pixmap(ctx, state[1].shape);
+			drop_stack_pixmap(ctx, dev, state[1].shape);
 	}
 	/* We never free the dest/mask/shape at level 0, as:
 	 * 1) dest is passed in and ownership remains with the caller.
@@ -2037,6 +2267,9 @@ fz_draw_drop_imp(fz_context *ctx, fz_device *devp)
 	 */
 	if (dev->stack != &dev->init_stack[0])
 		fz_free(ctx, dev->stack);
+	while (dev->pool_len > 0)
+		fz_free(ctx, dev->pool[--dev->pool_len].samples);
+	fz_free(ctx, dev->lent);
 	fz_drop_scale_cache(ctx, dev->cache_x);
 	fz_drop_scale_cache(ctx, dev->cache_y);
 	fz_drop_gel(ctx, gel);
@@ -2128,6 +2361,24 @@ fz_new_draw_device_type3(fz_context *ctx, fz_pixmap *dest)
 	return (fz_device*)dev;
 }
 
+void
+fz_set_draw_device_draft(fz_context *ctx, fz_device *devp, int draft)
+{
+	fz_draw_device *dev = (fz_draw_device*)devp;
+
+	if (draft)
+	{
+		dev->flags |= FZ_DRAWDEV_FLAGS_DRAFT;
+		fz_enable_device_hints(ctx, devp, FZ_DONT_INTERPOLATE_IMAGES);
+	}
+	else
+	{
+		dev->flags &= ~FZ_DRAWDEV_FLAGS_DRAFT;
+		fz_disable_device_hints(ctx, devp, FZ_DONT_INTERPOLATE_IMAGES);
+	}
+	fz_set_gel_aa(ctx, dev->gel, !draft);
+}
+
 fz_irect *
 fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect *scissor, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
 {
@@ -165,8 +165,13 @@ struct fz_gel_s
 	fz_edge *edges;
 	int acap, alen;
 	fz_edge **active;
+	int aa;
 };
 
+/* A gel without antialiasing works in whole pixels */
+#define gel_hscale(gel) ((gel)->aa ? fz_aa_hscale : 1)
+#define gel_vscale(gel) ((gel)->aa ? fz_aa_vscale : 1)
+
 fz_gel *
 fz_new_gel(fz_context *ctx)
 {
@@ -189,6 +194,8 @@ fz_new_gel(fz_context *ctx)
 		gel->acap = 64;
 		gel->alen = 0;
 		gel->active = fz_malloc_array(ctx, gel->acap, sizeof(fz_edge*));
+
+		gel->aa = 1;
 	}
 	fz_catch(ctx)
 	{
@@ -201,6 +208,12 @@ fz_new_gel(fz_context *ctx)
 	return gel;
 }
 
+void
+fz_set_gel_aa(fz_context *ctx, fz_gel *gel, int aa)
+{
+	gel->aa = aa;
+}
+
 void
 fz_reset_gel(fz_context *ctx, fz_gel *gel, const fz_irect *clip)
 {
@@ -212,10 +225,10 @@ fz_reset_gel(fz_context *ctx, fz_gel *gel, const fz_irect *clip)
 		gel->clip.x1 = gel->clip.y1 = BBOX_MAX;
 	}
 	else {
-		gel->clip.x0 = clip->x0 * fz_aa_hscale;
-		gel->clip.x1 = clip->x1 * fz_aa_hscale;
-		gel->clip.y0 = clip->y0 * fz_aa_vscale;
-		gel->clip.y1 = clip->y1 * fz_aa_vscale;
+		gel->clip.x0 = clip->x0 * gel_hscale(gel);
+		gel->clip.x1 = clip->x1 * gel_hscale(gel);
+		gel->clip.y0 = clip->y0 * gel_vscale(gel);
+		gel->clip.y1 = clip->y1 * gel_vscale(gel);
 	}
 
 	gel->bbox.x0 = gel->bbox.y0 = BBOX_MAX;
@@ -245,10 +258,10 @@ fz_bound_gel(fz_context *ctx, const fz_gel *gel, fz_irect *bbox)
 	}
 	else
 	{
-		bbox->x0 = fz_idiv(gel->bbox.x0, fz_aa_hscale);
-		bbox->y0 = fz_idiv(gel->bbox.y0, fz_aa_vscale);
-		bbox->x1 = fz_idiv(gel->bbox.x1, fz_aa_hscale) + 1;
-		bbox->y1 = fz_idiv(gel->bbox.y1, fz_aa_vscale) + 1;
+		bbox->x0 = fz_idiv(gel->bbox.x0, gel_hscale(gel));
+		bbox->y0 = fz_idiv(gel->bbox.y0, gel_vscale(gel));
+		bbox->x1 = fz_idiv(gel->bbox.x1, gel_hscale(gel)) + 1;
+		bbox->y1 = fz_idiv(gel->bbox.y1, gel_vscale(gel)) + 1;
 	}
 	return bbox;
 }
@@ -258,10 +271,10 @@ fz_gel_scissor(fz_context *ctx, const fz_gel *gel, fz_rect *r)
 {
 	fz_aa_context *ctxaa = ctx->aa;
 
-	r->x0 = gel->clip.x0 / fz_aa_hscale;
-	r->x1 = gel->clip.x1 / fz_aa_vscale;
-	r->y0 = gel->clip.y0 / fz_aa_hscale;
-	r->y1 = gel->clip.y1 / fz_aa_vscale;
+	r->x0 = gel->clip.x0 / gel_hscale(gel);
+	r->x1 = gel->clip.x1 / gel_vscale(gel);
+	r->y0 = gel->clip.y0 / gel_hscale(gel);
+	r->y1 = gel->clip.y1 / gel_vscale(gel);
 
 	return r;
 }
@@ -368,19 +381,22 @@ fz_insert_gel(fz_context *ctx, fz_gel *gel, float fx0, float fy0, float fx1, flo
 	int d, v;
 	fz_aa_context *ctxaa = ctx->aa;
 
-	fx0 = floorf(fx0 * fz_aa_hscale);
-	fx1 = floorf(fx1 * fz_aa_hscale);
-	fy0 = floorf(fy0 * fz_aa_vscale);
-	fy1 = floorf(fy1 * fz_aa_vscale);
+	int hscale = gel_hscale(gel);
+	int vscale = gel_vscale(gel);
+
+	fx0 = floorf(fx0 * hscale);
+	fx1 = floorf(fx1 * hscale);
+	fy0 = floorf(fy0 * vscale);
+	fy1 = floorf(fy1 * vscale);
 
 	/* Call fz_clamp so that clamping is done in the float domain, THEN
 	 * cast down to an int. Calling fz_clampi causes problems due to the
 	 * implicit cast down from float to int of the first argument
 	 * over/underflowing and flipping sign at extreme values. */
-	x0 = (int)fz_clamp(fx0, BBOX_MIN * fz_aa_hscale, BBOX_MAX * fz_aa_hscale);
-	y0 = (int)fz_clamp(fy0, BBOX_MIN * fz_aa_vscale, BBOX_MAX * fz_aa_vscale);
-	x1 = (int)fz_clamp(fx1, BBOX_MIN * fz_aa_hscale, BBOX_MAX * fz_aa_hscale);
-	y1 = (int)fz_clamp(fy1, BBOX_MIN * fz_aa_vscale, BBOX_MAX * fz_aa_vscale);
+	x0 = (int)fz_clamp(fx0, BBOX_MIN * hscale, BBOX_MAX * hscale);
+	y0 = (int)fz_clamp(fy0, BBOX_MIN * vscale, BBOX_MAX * vscale);
+	x1 = (int)fz_clamp(fx1, BBOX_MIN * hscale, BBOX_MAX * hscale);
+	y1 = (int)fz_clamp(fy1, BBOX_MIN * vscale, BBOX_MAX * vscale);
 
 	d = clip_lerp_y(gel->clip.y0, 0, x0, y0, x1, y1, &v);
 	if (d == OUTSIDE) return;
@@ -997,7 +1013,7 @@ fz_scan_convert(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *clip,
 	if (fz_is_empty_irect(fz_intersect_irect(fz_pixmap_bbox_no_ctx(dst, &local_clip), clip)))
 		return;
 
-	if (fz_aa_bits > 0)
+	if (fz_aa_bits > 0 && gel->aa)
 		fz_scan_convert_aa(ctx, gel, eofill, &local_clip, dst, color);
 	else
 		fz_scan_convert_sharp(ctx, gel, eofill, &local_clip, dst, color);
@@ -96,12 +96,36 @@ do_purge(fz_context *ctx)
 	cache->total = 0;
 }
 
-void
+int
 fz_purge_glyph_cache(fz_context *ctx)
 {
+	int total;
+
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	total = ctx->glyph_cache->total;
 	do_purge(ctx);
 	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	return total;
+}
+
+void
+fz_purge_glyph_cache_font(fz_context *ctx, fz_font *font)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_entry *entry, *next;
+	int i;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	{
+		for (entry = cache->entry[i]; entry; entry = next)
+		{
+			next = entry->bucket_next;
+			if (entry->key.font == font)
+				drop_glyph_cache_entry(ctx, entry);
+		}
+	}
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
 void
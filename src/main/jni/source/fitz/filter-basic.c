@@ -621,9 +621,9 @@ struct fz_aesd_s
 	fz_aes aes;
 	unsigned char iv[16];
 	int ivcount;
-	unsigned char bp[16];
-	unsigned char *rp, *wp;
-	unsigned char buffer[256];
+	int partial;
+	int badpad;
+	unsigned char buffer[4096];
 };
 
 static int
@@ -631,11 +631,7 @@ next_aesd(fz_context *ctx, fz_stream *stm, int max)
 {
 	fz_aesd *state = stm->state;
 	unsigned char *p = state->buffer;
-	unsigned char *ep;
-
-	if (max > sizeof(state->buffer))
-		max = sizeof(state->buffer);
-	ep = p + max;
+	int n;
 
 	while (state->ivcount < 16)
 	{
@@ -645,39 +641,46 @@ next_aesd(fz_context *ctx, fz_stream *stm, int max)
 		state->iv[state->ivcount++] = c;
 	}
 
-	while (state->rp < state->wp && p < ep)
-		*p++ = *state->rp++;
+	/* Errors found at the end are reported once the good data is out */
+	if (state->partial)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "partial block in aes filter");
+	if (state->badpad)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "aes padding out of range: %d", state->badpad);
 
-	while (p < ep)
+	/* Decrypt as many whole blocks as the buffer holds in one call */
+	n = fz_read(ctx, state->chain, p, sizeof(state->buffer));
+	if (n == 0)
+		return EOF;
+
+	if (n & 15)
 	{
-		int n = fz_read(ctx, state->chain, state->bp, 16);
+		state->partial = 1;
+		n &= ~15;
 		if (n == 0)
-			break;
-		else if (n < 16)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "partial block in aes filter");
+	}
 
-		aes_crypt_cbc(&state->aes, AES_DECRYPT, 16, state->iv, state->bp, state->bp);
-		state->rp = state->bp;
-		state->wp = state->bp + 16;
+	aes_crypt_cbc(&state->aes, AES_DECRYPT, n, state->iv, p, p);
 
-		/* strip padding at end of file */
-		if (fz_is_eof(ctx, state->chain))
+	/* strip padding at end of file */
+	if (!state->partial && fz_is_eof(ctx, state->chain))
+	{
+		int pad = p[n - 1];
+		if (pad < 1 || pad > 16)
 		{
-			int pad = state->bp[15];
-			if (pad < 1 || pad > 16)
+			if (n == 16)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "aes padding out of range: %d", pad);
-			state->wp -= pad;
+			state->badpad = pad;
+			pad = 16;
 		}
-
-		while (state->rp < state->wp && p < ep)
-			*p++ = *state->rp++;
+		n -= pad;
 	}
 
-	stm->rp = state->buffer;
-	stm->wp = p;
-	stm->pos += p - state->buffer;
+	stm->rp = p;
+	stm->wp = p + n;
+	stm->pos += n;
 
-	if (p == stm->rp)
+	if (n == 0)
 		return EOF;
 
 	return *stm->rp++;
@@ -707,8 +710,8 @@ fz_open_aesd(fz_context *ctx, fz_stream *chain, unsigned char *key, unsigned key
 		if (aes_setkey_dec(&state->aes, key, keylen * 8))
 			fz_throw(ctx, FZ_ERROR_GENERIC, "AES key init failed (keylen=%d)", keylen * 8);
 		state->ivcount = 0;
-		state->rp = state->bp;
-		state->wp = state->bp;
+		state->partial = 0;
+		state->badpad = 0;
 	}
 	fz_catch(ctx)
 	{
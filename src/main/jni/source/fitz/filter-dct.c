@@ -150,6 +150,40 @@ static void skip_input_data(j_decompress_ptr cinfo, long num_bytes)
 	}
 }
 
+/* Guess the input colorspace from the ColorTransform value and any Adobe marker */
+static void
+set_jpeg_color_space(j_decompress_ptr cinfo, int color_transform)
+{
+	/* default value if ColorTransform is not set */
+	if (color_transform == -1)
+	{
+		if (cinfo->num_components == 3)
+			color_transform = 1;
+		else
+			color_transform = 0;
+	}
+
+	if (cinfo->saw_Adobe_marker)
+		color_transform = cinfo->Adobe_transform;
+
+	/* Guess the input colorspace, and set output colorspace accordingly */
+	switch (cinfo->num_components)
+	{
+	case 3:
+		if (color_transform)
+			cinfo->jpeg_color_space = JCS_YCbCr;
+		else
+			cinfo->jpeg_color_space = JCS_RGB;
+		break;
+	case 4:
+		if (color_transform)
+			cinfo->jpeg_color_space = JCS_YCCK;
+		else
+			cinfo->jpeg_color_space = JCS_CMYK;
+		break;
+	}
+}
+
 static int
 next_dctd(fz_context *ctx, fz_stream *stm, int max)
 {
@@ -209,34 +243,7 @@ next_dctd(fz_context *ctx, fz_stream *stm, int max)
 
 		jpeg_read_header(cinfo, 1);
 
-		/* default value if ColorTransform is not set */
-		if (state->color_transform == -1)
-		{
-			if (state->cinfo.num_components == 3)
-				state->color_transform = 1;
-			else
-				state->color_transform = 0;
-		}
-
-		if (cinfo->saw_Adobe_marker)
-			state->color_transform = cinfo->Adobe_transform;
-
-		/* Guess the input colorspace, and set output colorspace accordingly */
-		switch (cinfo->num_components)
-		{
-		case 3:
-			if (state->color_transform)
-				cinfo->jpeg_color_space = JCS_YCbCr;
-			else
-				cinfo->jpeg_color_space = JCS_RGB;
-			break;
-		case 4:
-			if (state->color_transform)
-				cinfo->jpeg_color_space = JCS_YCCK;
-			else
-				cinfo->jpeg_color_space = JCS_CMYK;
-			break;
-		}
+		set_jpeg_color_space(cinfo, state->color_transform);
 
 		cinfo->scale_num = 8/(1<<state->l2factor);
 		cinfo->scale_denom = 8;
@@ -343,3 +350,361 @@ fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2facto
 
 	return fz_new_stream(ctx, state, next_dctd, close_dctd);
 }
+
+#ifdef HAVE_PTHREADS
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define DCT_MAX_THREADS 4
+#define DCT_MIN_THREADED_AREA (1 << 20)
+
+typedef struct dct_band_s
+{
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr errmgr;
+#ifndef SHARE_JPEG
+	jpeg_cust_mem_data custm;
+#endif
+	jmp_buf jb;
+	unsigned char *data;
+	int len;
+	int color_transform;
+	int l2factor;
+	int width, n;
+	unsigned char *out;
+	int stride, skip, rows;
+	pthread_t thread;
+	int started;
+	int ok;
+} dct_band;
+
+#ifdef SHARE_JPEG
+#define DCT_BAND_FROM_CINFO(c) (dct_band *)(c->client_data)
+#else
+#define DCT_BAND_FROM_CINFO(c) (dct_band *)(GET_CUST_MEM_DATA(c)->priv)
+
+/* Workers run without a context, so allocate from the system heap */
+static void *
+dct_band_alloc(j_common_ptr cinfo, size_t size)
+{
+	return malloc(size);
+}
+
+static void
+dct_band_free(j_common_ptr cinfo, void *object, size_t size)
+{
+	free(object);
+}
+#endif
+
+static void
+dct_band_error_exit(j_common_ptr cinfo)
+{
+	dct_band *band = DCT_BAND_FROM_CINFO(cinfo);
+	longjmp(band->jb, 1);
+}
+
+static void
+dct_band_output_message(j_common_ptr cinfo)
+{
+	/* Warnings are counted and make the band fail; the caller then
+	 * decodes the image serially, where they will be reported. */
+}
+
+static void *
+dct_band_thread(void *arg)
+{
+	dct_band *band = arg;
+	j_decompress_ptr cinfo = &band->cinfo;
+	unsigned char *row;
+	int y;
+
+	cinfo->err = jpeg_std_error(&band->errmgr);
+	band->errmgr.error_exit = dct_band_error_exit;
+	band->errmgr.output_message = dct_band_output_message;
+#ifdef SHARE_JPEG
+	cinfo->client_data = band;
+#else
+	if (!jpeg_cust_mem_init(&band->custm, band, NULL, NULL, NULL,
+				dct_band_alloc, dct_band_free,
+				dct_band_alloc, dct_band_free, NULL))
+		return NULL;
+	cinfo->client_data = &band->custm;
+#endif
+
+	if (setjmp(band->jb))
+	{
+		jpeg_destroy_decompress(cinfo);
+		band->ok = 0;
+		return NULL;
+	}
+
+	jpeg_create_decompress(cinfo);
+	jpeg_mem_src(cinfo, band->data, band->len);
+	jpeg_read_header(cinfo, 1);
+	set_jpeg_color_space(cinfo, band->color_transform);
+	cinfo->scale_num = 8/(1<<band->l2factor);
+	cinfo->scale_denom = 8;
+	jpeg_start_decompress(cinfo);
+
+	if (cinfo->output_width == band->width && cinfo->output_components == band->n &&
+		cinfo->output_height >= band->skip + band->rows)
+	{
+		/* Context rows above the band are decoded into its first row
+		 * and overwritten; those below it are never decoded at all. */
+		for (y = 0; y < band->skip + band->rows; y++)
+		{
+			row = band->out + fz_maxi(y - band->skip, 0) * band->stride;
+			jpeg_read_scanlines(cinfo, &row, 1);
+		}
+		band->ok = (band->errmgr.num_warnings == 0);
+	}
+
+	jpeg_destroy_decompress(cinfo);
+	return NULL;
+}
+
+static inline int
+dct_read16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/*
+	Restart markers reset the entropy decoder, so the MCU rows between
+	them can be decoded independently. For a large baseline JPEG that
+	has them, we cut the scan into bands at restart boundaries and wrap
+	each band in a header of its own (with the height patched and the
+	markers renumbered) so that a separate libjpeg decoder can take it.
+	Each band is decoded with one extra step of MCU rows either side,
+	which keeps upsampling at the seams exactly as in the streaming
+	decoder; the extra rows are thrown away.
+
+	Returns a stream of the decoded samples (as fz_open_dctd would give)
+	or NULL if the data is not suitable, in which case the caller should
+	decode it with fz_open_dctd. l2factor is clamped as for that call.
+*/
+fz_stream *
+fz_open_dctd_bands(fz_context *ctx, fz_buffer *buffer, int color_transform, int *l2factor)
+{
+	dct_band band[DCT_MAX_THREADS];
+	unsigned char *s = buffer->data;
+	unsigned char *e = s + buffer->len;
+	unsigned char *p, *d;
+	unsigned char *sof = NULL, *sos = NULL, *eoi = NULL;
+	int *seg = NULL;
+	int nseg, maxseg, ri = 0;
+	int width = 0, height = 0, nf = 0, hmax = 1, vmax = 1;
+	int mw, mh, mpr, mcu_rows, step, count, i, k, ok;
+	int out_w, out_h, stride;
+	long cpus;
+	fz_buffer *out = NULL;
+	fz_stream *stm = NULL;
+
+	if (*l2factor > 3)
+		*l2factor = 3;
+
+	/* Skip over any stray returns at the start of the stream */
+	while (s < e && (*s == '\n' || *s == '\r'))
+		s++;
+	if (e - s < 4 || s[0] != 0xFF || s[1] != 0xD8)
+		return NULL;
+
+	/* Walk the header up to the (only) scan */
+	for (p = s + 2; !sos; p += 2 + dct_read16(p + 2))
+	{
+		while (p < e - 1 && p[0] == 0xFF && p[1] == 0xFF)
+			p++;
+		if (e - p < 4 || p[0] != 0xFF)
+			return NULL;
+		switch (p[1])
+		{
+		case 0xC0: case 0xC1:
+			if (sof || e - p < 10 || p[4] != 8)
+				return NULL;
+			sof = p;
+			height = dct_read16(p + 5);
+			width = dct_read16(p + 7);
+			nf = p[9];
+			if (nf < 1 || nf > 4 || e - p < 10 + 3 * nf)
+				return NULL;
+			for (i = 0; i < nf; i++)
+			{
+				int hv = p[11 + 3 * i];
+				if ((hv >> 4) < 1 || (hv & 15) < 1)
+					return NULL;
+				hmax = fz_maxi(hmax, hv >> 4);
+				vmax = fz_maxi(vmax, hv & 15);
+			}
+			break;
+		case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+		case 0xC9: case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+			/* progressive, lossless or arithmetic coded */
+			return NULL;
+		case 0xDD:
+			if (e - p < 6)
+				return NULL;
+			ri = dct_read16(p + 4);
+			break;
+		case 0xDA:
+			if (!sof || e - p < 5 || p[4] != nf)
+				return NULL;
+			sos = p;
+			break;
+		case JPEG_EOI:
+		case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+		case 0xD4: case 0xD5: case 0xD6: case 0xD7:
+		case 0xDC:
+			return NULL;
+		}
+	}
+
+	if (ri <= 0 || width <= 0 || height <= 0 || p > e)
+		return NULL;
+
+	out_w = (width + (1<<*l2factor) - 1) >> *l2factor;
+	out_h = (height + (1<<*l2factor) - 1) >> *l2factor;
+	if ((double)out_w * out_h < DCT_MIN_THREADED_AREA)
+		return NULL;
+
+	if (nf == 1)
+		hmax = vmax = 1;
+	mw = 8 * hmax;
+	mh = 8 * vmax;
+	mpr = (width + mw - 1) / mw;
+	mcu_rows = (height + mh - 1) / mh;
+	maxseg = (int)(((double)mpr * mcu_rows + ri - 1) / ri);
+
+	/* Bands must start on a row that also starts a restart interval */
+	for (step = ri, i = mpr; i; k = step % i, step = i, i = k);
+	step = ri / step;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	count = fz_mini(mcu_rows / step, fz_clampi(cpus, 1, DCT_MAX_THREADS));
+	if (count < 2)
+		return NULL;
+
+	/* Find the start of each restart interval in the entropy coded data;
+	 * anything but the expected run of markers and EOI, and we give up. */
+	seg = fz_malloc_array(ctx, maxseg + 1, sizeof(int));
+	seg[0] = p - s;
+	nseg = 1;
+	for (d = p; d < e - 1; d++)
+	{
+		if (d[0] != 0xFF || d[1] == 0x00 || d[1] == 0xFF)
+			continue;
+		if (d[1] == JPEG_EOI)
+		{
+			eoi = d;
+			break;
+		}
+		if (d[1] != JPEG_RST0 + ((nseg - 1) & 7) || nseg == maxseg)
+			break;
+		seg[nseg++] = d + 2 - s;
+		d++;
+	}
+	if (!eoi || nseg != maxseg)
+	{
+		fz_free(ctx, seg);
+		return NULL;
+	}
+	seg[nseg] = eoi + 2 - s;
+
+	memset(band, 0, sizeof band);
+
+	fz_var(out);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		stride = out_w * nf;
+		out = fz_new_buffer(ctx, stride * out_h);
+
+		for (i = 0; i < count; i++)
+		{
+			int r0 = mcu_rows / step * i / count * step;
+			int r1 = i == count - 1 ? mcu_rows : mcu_rows / step * (i + 1) / count * step;
+			int c0 = fz_maxi(r0 - step, 0);
+			int c1 = fz_mini(r1 + step, mcu_rows);
+			int s0 = c0 * mpr / ri;
+			int s1 = c1 == mcu_rows ? nseg : c1 * mpr / ri;
+			int h = fz_mini(c1 * mh, height) - c0 * mh;
+			int o0 = (r0 * mh) >> *l2factor;
+			int o1 = r1 == mcu_rows ? out_h : (r1 * mh) >> *l2factor;
+			int hlen = p - s;
+			int len = hlen;
+
+			/* Each interval is followed by a restart marker, the last by EOI */
+			for (k = s0; k < s1; k++)
+				len += seg[k + 1] - seg[k];
+			band[i].data = fz_malloc(ctx, len);
+			band[i].len = len;
+			memcpy(band[i].data, s, hlen);
+			band[i].data[sof - s + 5] = (h >> 8) & 0xFF;
+			band[i].data[sof - s + 6] = h & 0xFF;
+			d = band[i].data + hlen;
+			for (k = s0; k < s1; k++)
+			{
+				int n = seg[k + 1] - seg[k] - 2;
+				memcpy(d, s + seg[k], n);
+				d += n;
+				*d++ = 0xFF;
+				*d++ = k < s1 - 1 ? JPEG_RST0 + ((k - s0) & 7) : JPEG_EOI;
+			}
+
+			band[i].color_transform = color_transform;
+			band[i].l2factor = *l2factor;
+			band[i].width = out_w;
+			band[i].n = nf;
+			band[i].out = out->data + o0 * stride;
+			band[i].stride = stride;
+			band[i].skip = o0 - ((c0 * mh) >> *l2factor);
+			band[i].rows = o1 - o0;
+		}
+
+		/* The calling thread decodes the first band */
+		for (i = 1; i < count; i++)
+			band[i].started = !pthread_create(&band[i].thread, NULL, dct_band_thread, &band[i]);
+		dct_band_thread(&band[0]);
+
+		ok = band[0].ok;
+		for (i = 1; i < count; i++)
+		{
+			if (band[i].started)
+				pthread_join(band[i].thread, NULL);
+			else
+				dct_band_thread(&band[i]);
+			ok &= band[i].ok;
+		}
+
+		if (ok)
+		{
+			out->len = stride * out_h;
+			stm = fz_open_buffer(ctx, out);
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < count; i++)
+			fz_free(ctx, band[i].data);
+		fz_free(ctx, seg);
+		fz_drop_buffer(ctx, out);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return stm;
+}
+
+#else
+
+fz_stream *
+fz_open_dctd_bands(fz_context *ctx, fz_buffer *buffer, int color_transform, int *l2factor)
+{
+	return NULL;
+}
+
+#endif
@@ -2,6 +2,8 @@
 
 #include <zlib.h>
 
+#define MIN_BOMB (100 << 20)
+
 typedef struct fz_flate_s fz_flate;
 
 struct fz_flate_s
@@ -131,3 +133,109 @@ fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits)
 	}
 	return fz_new_stream(ctx, state, next_flated, close_flated);
 }
+
+/*
+	Inflate a whole buffer of deflated data into a single output
+	buffer. The output starts at the initial size (an exact decoded
+	length lets zlib finish in one call, on its fast path throughout)
+	and only grows if that proves too small. Damaged data is treated
+	as by the flate filter read through fz_read_best.
+*/
+fz_buffer *
+fz_inflate_buffer(fz_context *ctx, fz_buffer *in, int window_bits, int initial, int *truncated)
+{
+	fz_buffer *out = NULL;
+	z_stream z;
+	int code;
+	int init = 0;
+
+	fz_var(out);
+	fz_var(init);
+
+	if (truncated)
+		*truncated = 0;
+
+	memset(&z, 0, sizeof z);
+	z.zalloc = zalloc;
+	z.zfree = zfree;
+	z.opaque = ctx;
+	z.next_in = in->data;
+	z.avail_in = in->len;
+
+	fz_try(ctx)
+	{
+		if (initial < 1024)
+			initial = 1024;
+
+		out = fz_new_buffer(ctx, initial);
+
+		code = inflateInit2(&z, window_bits);
+		if (code != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: inflateInit: %s", z.msg);
+		init = 1;
+
+		while (1)
+		{
+			if (out->len == out->cap)
+				fz_grow_buffer(ctx, out);
+
+			if (out->len >= MIN_BOMB && out->len / 200 > initial)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "compression bomb detected");
+
+			z.next_out = out->data + out->len;
+			z.avail_out = out->cap - out->len;
+
+			code = inflate(&z, Z_FINISH);
+
+			out->len = z.next_out - out->data;
+
+			if (code == Z_STREAM_END)
+			{
+				break;
+			}
+			else if (code == Z_BUF_ERROR || code == Z_OK)
+			{
+				/* Out of room: grow and carry on */
+				if (z.avail_out == 0)
+					continue;
+				fz_warn(ctx, "premature end of data in flate filter");
+				break;
+			}
+			else if (code == Z_DATA_ERROR && z.avail_in == 0)
+			{
+				fz_warn(ctx, "ignoring zlib error: %s", z.msg);
+				break;
+			}
+			else if (code == Z_DATA_ERROR && !strcmp(z.msg, "incorrect data check"))
+			{
+				fz_warn(ctx, "ignoring zlib error: %s", z.msg);
+				break;
+			}
+			else
+			{
+				/* As fz_read would, keep what we have decoded so far */
+				fz_warn(ctx, "zlib error: %s; treating as end of file", z.msg);
+				break;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		if (init)
+			inflateEnd(&z);
+	}
+	fz_catch(ctx)
+	{
+		if (truncated && out)
+		{
+			*truncated = 1;
+		}
+		else
+		{
+			fz_drop_buffer(ctx, out);
+			fz_rethrow(ctx);
+		}
+	}
+
+	return out;
+}
@@ -19,8 +19,6 @@ struct fz_predict_s
 	unsigned char *out;
 	unsigned char *ref;
 	unsigned char *rp, *wp;
-
-	unsigned char buffer[4096];
 };
 
 static inline int getcomponent(unsigned char *line, int x, int bpc)
@@ -55,43 +53,160 @@ static inline int paeth(int a, int b, int c)
 	int pa = fz_absi(ac);
 	int pb = fz_absi(bc);
 	int pc = fz_absi(abcc);
-	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+	/* Choosing between b and c first lets compilers use conditional
+	 * moves here rather than branches, which mispredict badly. */
+	int bc_pick = pb <= pc ? b : c;
+	return pa <= pb && pa <= pc ? a : bc_pick;
+}
+
+/* Horizontal differencing of 8 bit samples, with n constant when inlined */
+static inline void
+tiff_row_8(unsigned char *out, const unsigned char *in, int columns, int n)
+{
+	unsigned char left[FZ_MAX_COLORS];
+	int i, k;
+
+	for (k = 0; k < n; k++)
+		left[k] = 0;
+	for (i = 0; i < columns; i++)
+		for (k = 0; k < n; k++)
+			*out++ = left[k] = *in++ + left[k];
 }
 
 static void
 fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in, int len)
 {
 	int left[FZ_MAX_COLORS];
-	int i, k;
+	int i, k, s;
 	const int mask = (1 << state->bpc)-1;
 
 	for (k = 0; k < state->colors; k++)
 		left[k] = 0;
 
-	/* special fast case */
+	/* special fast cases */
 	if (state->bpc == 8)
+	{
+		switch (state->colors)
+		{
+		case 1: tiff_row_8(out, in, state->columns, 1); break;
+		case 3: tiff_row_8(out, in, state->columns, 3); break;
+		case 4: tiff_row_8(out, in, state->columns, 4); break;
+		default: tiff_row_8(out, in, state->columns, state->colors); break;
+		}
+		return;
+	}
+
+	if (state->bpc == 16)
 	{
 		for (i = 0; i < state->columns; i++)
+		{
 			for (k = 0; k < state->colors; k++)
-				*out++ = left[k] = (*in++ + left[k]) & 0xFF;
+			{
+				int c = (((in[0] << 8) | in[1]) + left[k]) & 0xFFFF;
+				*out++ = c >> 8;
+				*out++ = c;
+				in += 2;
+				left[k] = c;
+			}
+		}
 		return;
 	}
 
-	/* putcomponent assumes zeroed memory for bpc < 8 */
-	if (state->bpc < 8)
-		memset(out, 0, state->stride);
-
-	for (i = 0; i < state->columns; i++)
+	/* Sub-byte samples are taken a byte at a time, high bits first;
+	 * any padding bits at the end of the row are left clear. */
+	k = 0;
+	i = state->columns * state->colors;
+	for (len = state->stride; len > 0; len--)
 	{
-		for (k = 0; k < state->colors; k++)
+		int a = *in++;
+		int b = 0;
+		for (s = 8 - state->bpc; s >= 0 && i > 0; s -= state->bpc, i--)
 		{
-			int a = getcomponent(in, i * state->colors + k, state->bpc);
-			int b = a + left[k];
-			int c = b & mask;
-			putcomponent(out, i * state->colors + k, state->bpc, c);
+			int c = ((a >> s) + left[k]) & mask;
+			b |= c << s;
 			left[k] = c;
+			if (++k == state->colors)
+				k = 0;
+		}
+		*out++ = b;
+	}
+}
+
+/*
+	The PNG filters that look left are done a pixel at a time, with
+	bpp constant when inlined, so the previous pixel stays in registers
+	rather than being read back from the row just written. Any odd
+	bytes of a short final row are finished off a byte at a time.
+*/
+
+static inline void
+png_sub(unsigned char *out, const unsigned char *in, int len, int bpp)
+{
+	int a[8];
+	int i, k;
+
+	for (k = 0; k < bpp; k++)
+		out[k] = a[k] = in[k];
+	for (i = bpp; i + bpp <= len; i += bpp)
+	{
+		for (k = 0; k < bpp; k++)
+		{
+			a[k] = (in[i + k] + a[k]) & 0xFF;
+			out[i + k] = a[k];
+		}
+	}
+	for (; i < len; i++)
+		out[i] = in[i] + out[i - bpp];
+}
+
+static inline void
+png_average(unsigned char *out, const unsigned char *in, const unsigned char *ref, int len, int bpp)
+{
+	int a[8];
+	int i, k;
+
+	for (k = 0; k < bpp; k++)
+	{
+		a[k] = (in[k] + ref[k] / 2) & 0xFF;
+		out[k] = a[k];
+	}
+	for (i = bpp; i + bpp <= len; i += bpp)
+	{
+		for (k = 0; k < bpp; k++)
+		{
+			a[k] = (in[i + k] + (a[k] + ref[i + k]) / 2) & 0xFF;
+			out[i + k] = a[k];
+		}
+	}
+	for (; i < len; i++)
+		out[i] = in[i] + (out[i - bpp] + ref[i]) / 2;
+}
+
+static inline void
+png_paeth(unsigned char *out, const unsigned char *in, const unsigned char *ref, int len, int bpp)
+{
+	int a[8], c[8];
+	int i, k;
+
+	/* paeth(0, b, 0) is b */
+	for (k = 0; k < bpp; k++)
+	{
+		a[k] = (in[k] + ref[k]) & 0xFF;
+		c[k] = ref[k];
+		out[k] = a[k];
+	}
+	for (i = bpp; i + bpp <= len; i += bpp)
+	{
+		for (k = 0; k < bpp; k++)
+		{
+			int b = ref[i + k];
+			a[k] = (in[i + k] + paeth(a[k], b, c[k])) & 0xFF;
+			c[k] = b;
+			out[i + k] = a[k];
 		}
 	}
+	for (; i < len; i++)
+		out[i] = in[i] + paeth(out[i - bpp], ref[i], ref[i - bpp]);
 }
 
 static void
@@ -104,6 +219,45 @@ fz_predict_png(fz_predict *state, unsigned char *out, unsigned char *in, int len
 	if (bpp > len)
 		bpp = len;
 
+	/* Common pixel sizes: 1 (gray or sub-byte), 2 (gray 16 bit),
+	 * 3 and 4 (RGB and CMYK), 6 and 8 (the same at 16 bit). */
+	switch (predictor)
+	{
+	case 1:
+		switch (bpp)
+		{
+		case 1: png_sub(out, in, len, 1); return;
+		case 2: png_sub(out, in, len, 2); return;
+		case 3: png_sub(out, in, len, 3); return;
+		case 4: png_sub(out, in, len, 4); return;
+		case 6: png_sub(out, in, len, 6); return;
+		case 8: png_sub(out, in, len, 8); return;
+		}
+		break;
+	case 3:
+		switch (bpp)
+		{
+		case 1: png_average(out, in, ref, len, 1); return;
+		case 2: png_average(out, in, ref, len, 2); return;
+		case 3: png_average(out, in, ref, len, 3); return;
+		case 4: png_average(out, in, ref, len, 4); return;
+		case 6: png_average(out, in, ref, len, 6); return;
+		case 8: png_average(out, in, ref, len, 8); return;
+		}
+		break;
+	case 4:
+		switch (bpp)
+		{
+		case 1: png_paeth(out, in, ref, len, 1); return;
+		case 2: png_paeth(out, in, ref, len, 2); return;
+		case 3: png_paeth(out, in, ref, len, 3); return;
+		case 4: png_paeth(out, in, ref, len, 4); return;
+		case 6: png_paeth(out, in, ref, len, 6); return;
+		case 8: png_paeth(out, in, ref, len, 8); return;
+		}
+		break;
+	}
+
 	switch (predictor)
 	{
 	case 0:
@@ -121,14 +275,9 @@ fz_predict_png(fz_predict *state, unsigned char *out, unsigned char *in, int len
 		}
 		break;
 	case 2:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + *ref++;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out++ = *in++ + *ref++;
-		}
+		/* No dependency between bytes, so this vectorizes as it stands */
+		for (i = 0; i < len; i++)
+			out[i] = in[i] + ref[i];
 		break;
 	case 3:
 		for (i = bpp; i > 0; i--)
@@ -153,6 +302,10 @@ fz_predict_png(fz_predict *state, unsigned char *out, unsigned char *in, int len
 			out++;
 		}
 		break;
+	default:
+		/* Unknown filter type; repeat the previous row */
+		memcpy(out, ref, len);
+		break;
 	}
 }
 
@@ -160,47 +313,41 @@ static int
 next_predict(fz_context *ctx, fz_stream *stm, int len)
 {
 	fz_predict *state = stm->state;
-	unsigned char *buf = state->buffer;
-	unsigned char *p = buf;
-	unsigned char *ep;
 	int ispng = state->predictor >= 10;
 	int n;
 
-	if (len >= sizeof(state->buffer))
-		len = sizeof(state->buffer);
-	ep = buf + len;
-
-	while (state->rp < state->wp && p < ep)
-		*p++ = *state->rp++;
-
-	while (p < ep)
+	/* Rows are handed out straight from the buffer they were decoded
+	 * into; the caller is done with one before we decode the next. */
+	while (state->rp == state->wp)
 	{
 		n = fz_read(ctx, state->chain, state->in, state->stride + ispng);
 		if (n == 0)
-			break;
+			return EOF;
 
 		if (state->predictor == 1)
-			memcpy(state->out, state->in, n);
+			state->rp = state->in;
 		else if (state->predictor == 2)
+		{
 			fz_predict_tiff(state, state->out, state->in, n);
+			state->rp = state->out;
+		}
 		else
 		{
+			/* The row just decoded is the reference for the next one */
+			unsigned char *ref = state->out;
 			fz_predict_png(state, state->out, state->in + 1, n - 1, state->in[0]);
-			memcpy(state->ref, state->out, state->stride);
+			state->out = state->ref;
+			state->ref = ref;
+			state->rp = ref;
 		}
 
-		state->rp = state->out;
-		state->wp = state->out + n - ispng;
-
-		while (state->rp < state->wp && p < ep)
-			*p++ = *state->rp++;
+		state->wp = state->rp + n - ispng;
 	}
 
-	stm->rp = buf;
-	stm->wp = p;
-	if (stm->rp == stm->wp)
-		return EOF;
-	stm->pos += p - buf;
+	stm->rp = state->rp;
+	stm->wp = state->wp;
+	state->rp = state->wp;
+	stm->pos += stm->wp - stm->rp;
 
 	return *stm->rp++;
 }
@@ -6,6 +6,7 @@
 #include FT_STROKER_H
 
 #define MAX_BBOX_TABLE_SIZE 4096
+#define MAX_SHARED_FONTS 32
 
 /* 20 degrees */
 #define SHEAR 0.36397f
@@ -175,12 +176,23 @@ fz_set_font_bbox(fz_context *ctx, fz_font *font, float xmin, float ymin, float x
  * Freetype hooks
  */
 
+typedef struct fz_shared_font_s fz_shared_font;
+
+struct fz_shared_font_s
+{
+	unsigned char *data;
+	int index;
+	fz_font *font;
+};
+
 struct fz_font_context_s {
 	int ctx_refs;
 	FT_Library ftlib;
 	int ftlib_refs;
 	fz_load_system_font_func load_font;
 	fz_load_system_cjk_font_func load_cjk_font;
+	int shared_count;
+	fz_shared_font shared[MAX_SHARED_FONTS];
 };
 
 #undef __FTERRORS_H__
@@ -201,6 +213,7 @@ void fz_new_font_context(fz_context *ctx)
 	ctx->font->ftlib = NULL;
 	ctx->font->ftlib_refs = 0;
 	ctx->font->load_font = NULL;
+	ctx->font->shared_count = 0;
 }
 
 fz_font_context *
@@ -216,7 +229,12 @@ void fz_drop_font_context(fz_context *ctx)
 	if (!ctx)
 		return;
 	if (fz_drop_imp(ctx, ctx->font, &ctx->font->ctx_refs))
+	{
+		int i;
+		for (i = 0; i < ctx->font->shared_count; i++)
+			fz_drop_font(ctx, ctx->font->shared[i].font);
 		fz_free(ctx, ctx->font);
+	}
 }
 
 void fz_install_load_system_font_funcs(fz_context *ctx, fz_load_system_font_func f, fz_load_system_cjk_font_func f_cjk)
@@ -398,6 +416,64 @@ fz_new_font_from_memory(fz_context *ctx, const char *name, unsigned char *data,
 	return font;
 }
 
+/*
+	Fonts made from data that lives as long as the process are kept in the
+	font context, which cloned contexts share, so every document asking for
+	the same built-in font gets the same fz_font and the glyph cache holds
+	its glyphs only once. The table keeps one reference to each font until
+	the font context goes away.
+*/
+fz_font *
+fz_new_shared_font_from_memory(fz_context *ctx, const char *name, unsigned char *data, int len, int index, int use_glyph_bbox)
+{
+	fz_font_context *fct = ctx->font;
+	fz_font *font = NULL;
+	fz_font *spare = NULL;
+	int i;
+
+	/* Take references by hand; fz_keep_font takes the same lock. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < fct->shared_count; i++)
+	{
+		if (fct->shared[i].data == data && fct->shared[i].index == index)
+		{
+			font = fct->shared[i].font;
+			font->refs++;
+			break;
+		}
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (font)
+		return font;
+
+	font = fz_new_font_from_memory(ctx, name, data, len, index, use_glyph_bbox);
+
+	/* Another thread may have loaded the same font meanwhile. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < fct->shared_count; i++)
+	{
+		if (fct->shared[i].data == data && fct->shared[i].index == index)
+		{
+			spare = font;
+			font = fct->shared[i].font;
+			font->refs++;
+			break;
+		}
+	}
+	if (!spare && fct->shared_count < MAX_SHARED_FONTS)
+	{
+		fct->shared[fct->shared_count].data = data;
+		fct->shared[fct->shared_count].index = index;
+		fct->shared[fct->shared_count].font = font;
+		fct->shared_count++;
+		font->refs++;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_drop_font(ctx, spare);
+
+	return font;
+}
+
 fz_font *
 fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox)
 {
@@ -0,0 +1,288 @@
+#include "mupdf/fitz.h"
+
+/*
+ * The prefetcher keeps a list of images in priority order and one worker
+ * thread that decodes them in turn with its own (cloned) context. Decoding
+ * through fz_new_pixmap_from_image puts the pixmap in the shared store, keyed
+ * on the image and subsample factor, which is where the draw device looks
+ * for it later. The prefetcher also keeps a reference to each pixmap it
+ * decoded, up to the budget, so the store cannot evict them before they are
+ * drawn; once an image drops off the list its pixmap becomes an ordinary
+ * store item again.
+ */
+
+#ifdef HAVE_PTHREADS
+
+#include <pthread.h>
+
+enum
+{
+	PREFETCH_PENDING,
+	PREFETCH_BUSY,
+	PREFETCH_DONE
+};
+
+typedef struct prefetch_entry_s
+{
+	fz_image *image;
+	fz_pixmap *pixmap;
+	int state;
+} prefetch_entry;
+
+struct fz_prefetcher_s
+{
+	fz_context *ctx; /* Used by the worker thread only */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	int quit;
+
+	/* Everything below is protected by lock */
+	int w, h;
+	unsigned int budget;
+	unsigned int held;
+	int len;
+	prefetch_entry *entry;
+};
+
+static void
+prefetch_unpin(fz_context *ctx, fz_prefetcher *pf, prefetch_entry *e)
+{
+	if (e->pixmap)
+	{
+		pf->held -= fz_pixmap_size(ctx, e->pixmap);
+		fz_drop_pixmap(ctx, e->pixmap);
+		e->pixmap = NULL;
+	}
+}
+
+static void *
+prefetch_thread(void *arg)
+{
+	fz_prefetcher *pf = arg;
+	fz_context *ctx = pf->ctx;
+	fz_image *image;
+	fz_pixmap *pix;
+	prefetch_entry *e;
+	unsigned int size;
+	int i, w, h;
+
+	pthread_mutex_lock(&pf->lock);
+	while (!pf->quit)
+	{
+		for (i = 0; i < pf->len; i++)
+			if (pf->entry[i].state == PREFETCH_PENDING)
+				break;
+		if (i == pf->len)
+		{
+			pthread_cond_wait(&pf->work, &pf->lock);
+			continue;
+		}
+
+		e = &pf->entry[i];
+		e->state = PREFETCH_BUSY;
+		image = fz_keep_image(ctx, e->image);
+		w = pf->w;
+		h = pf->h;
+		pthread_mutex_unlock(&pf->lock);
+
+		pix = NULL;
+		fz_try(ctx)
+			pix = fz_new_pixmap_from_image(ctx, image, w, h);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot prefetch image");
+
+		pthread_mutex_lock(&pf->lock);
+
+		/* The list may have been replaced while we were decoding */
+		for (i = 0; i < pf->len; i++)
+			if (pf->entry[i].image == image && pf->entry[i].state == PREFETCH_BUSY)
+				break;
+		if (i < pf->len)
+		{
+			e = &pf->entry[i];
+			e->state = PREFETCH_DONE;
+			if (pix && pf->w == w && pf->h == h)
+			{
+				size = fz_pixmap_size(ctx, pix);
+				if (pf->held + size <= pf->budget)
+				{
+					e->pixmap = pix;
+					pf->held += size;
+					pix = NULL;
+				}
+				else
+				{
+					/* Anything after this is wanted even less */
+					for (; i < pf->len; i++)
+						if (pf->entry[i].state == PREFETCH_PENDING)
+							pf->entry[i].state = PREFETCH_DONE;
+				}
+			}
+		}
+
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_image(ctx, image);
+	}
+	pthread_mutex_unlock(&pf->lock);
+
+	return NULL;
+}
+
+fz_prefetcher *
+fz_new_prefetcher(fz_context *ctx)
+{
+	fz_prefetcher *pf;
+	fz_context *wctx;
+
+	wctx = fz_clone_context(ctx);
+	if (!wctx)
+		return NULL;
+
+	fz_try(ctx)
+		pf = fz_malloc_struct(ctx, fz_prefetcher);
+	fz_catch(ctx)
+	{
+		fz_drop_context(wctx);
+		fz_rethrow(ctx);
+	}
+
+	pf->ctx = wctx;
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->work, NULL);
+	if (pthread_create(&pf->thread, NULL, prefetch_thread, pf))
+	{
+		fz_warn(ctx, "cannot start prefetch thread");
+		pthread_cond_destroy(&pf->work);
+		pthread_mutex_destroy(&pf->lock);
+		fz_drop_context(wctx);
+		fz_free(ctx, pf);
+		return NULL;
+	}
+
+	return pf;
+}
+
+void
+fz_drop_prefetcher(fz_context *ctx, fz_prefetcher *pf)
+{
+	int i;
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->quit = 1;
+	pthread_cond_signal(&pf->work);
+	pthread_mutex_unlock(&pf->lock);
+	pthread_join(pf->thread, NULL);
+
+	for (i = 0; i < pf->len; i++)
+	{
+		prefetch_unpin(ctx, pf, &pf->entry[i]);
+		fz_drop_image(ctx, pf->entry[i].image);
+	}
+	fz_free(ctx, pf->entry);
+
+	pthread_cond_destroy(&pf->work);
+	pthread_mutex_destroy(&pf->lock);
+	fz_drop_context(pf->ctx);
+	fz_free(ctx, pf);
+}
+
+void
+fz_prefetch_images(fz_context *ctx, fz_prefetcher *pf, fz_image **images, int count, int w, int h, unsigned int budget)
+{
+	prefetch_entry *entry, *old;
+	int i, k, old_len, resize;
+
+	if (!pf)
+		return;
+
+	if (budget == 0)
+		count = 0;
+	entry = count ? fz_malloc_array(ctx, count, sizeof *entry) : NULL;
+
+	pthread_mutex_lock(&pf->lock);
+
+	old = pf->entry;
+	old_len = pf->len;
+	resize = (pf->w != w || pf->h != h);
+
+	if (resize)
+	{
+		/* Everything held was decoded for another size */
+		for (k = 0; k < old_len; k++)
+			prefetch_unpin(ctx, pf, &old[k]);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		entry[i].image = NULL;
+		for (k = 0; k < old_len; k++)
+		{
+			if (old[k].image == images[i])
+			{
+				entry[i] = old[k];
+				old[k].image = NULL;
+				break;
+			}
+		}
+		if (!entry[i].image)
+		{
+			entry[i].image = fz_keep_image(ctx, images[i]);
+			entry[i].pixmap = NULL;
+			entry[i].state = PREFETCH_PENDING;
+		}
+		else if (resize || (entry[i].state == PREFETCH_DONE && !entry[i].pixmap))
+		{
+			/* Try again at the new size, or with the new budget. A
+			 * decode still in progress will be thrown away. */
+			entry[i].state = PREFETCH_PENDING;
+		}
+	}
+
+	for (k = 0; k < old_len; k++)
+	{
+		if (old[k].image)
+		{
+			prefetch_unpin(ctx, pf, &old[k]);
+			fz_drop_image(ctx, old[k].image);
+		}
+	}
+
+	pf->entry = entry;
+	pf->len = count;
+	pf->w = w;
+	pf->h = h;
+	pf->budget = budget;
+
+	/* Give back the least wanted pixmaps if the budget shrank */
+	for (i = count - 1; i >= 0 && pf->held > budget; i--)
+		prefetch_unpin(ctx, pf, &entry[i]);
+
+	pthread_cond_signal(&pf->work);
+	pthread_mutex_unlock(&pf->lock);
+
+	fz_free(ctx, old);
+}
+
+#else
+
+fz_prefetcher *
+fz_new_prefetcher(fz_context *ctx)
+{
+	return NULL;
+}
+
+void
+fz_drop_prefetcher(fz_context *ctx, fz_prefetcher *pf)
+{
+}
+
+void
+fz_prefetch_images(fz_context *ctx, fz_prefetcher *pf, fz_image **images, int count, int w, int h, unsigned int budget)
+{
+}
+
+#endif
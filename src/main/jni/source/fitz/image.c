@@ -81,6 +81,7 @@ static fz_store_type fz_image_store_type =
 	fz_keep_image_key,
 	fz_drop_image_key,
 	fz_cmp_image_key,
+	FZ_STORE_TIER_IMAGES,
 #ifndef NDEBUG
 	fz_debug_image
 #endif
@@ -299,6 +300,14 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	case FZ_IMAGE_JXR:
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
+	case FZ_IMAGE_JPX:
+		/* Let openjpeg drop resolution levels rather than subsample */
+		native_l2factor = l2factor;
+		tile = fz_load_jpx_region(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->colorspace, 0, NULL, &native_l2factor);
+		fz_decode_tile(ctx, tile, image->decode);
+		if (l2factor - native_l2factor > 0)
+			fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
+		break;
 	case FZ_IMAGE_JPEG:
 		/* Scan JPEG stream and patch missing height values in header */
 		{
@@ -320,7 +329,12 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 
 	default:
 		native_l2factor = l2factor;
-		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &native_l2factor);
+		stm = NULL;
+		/* Large baseline JPEGs with restart markers can be decoded in bands */
+		if (image->buffer->params.type == FZ_IMAGE_JPEG)
+			stm = fz_open_dctd_bands(ctx, image->buffer->buffer, image->buffer->params.u.jpeg.color_transform, &native_l2factor);
+		if (!stm)
+			stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &native_l2factor);
 
 		indexed = fz_colorspace_is_indexed(ctx, image->colorspace);
 		tile = fz_decomp_image_from_stream(ctx, stm, image, indexed, l2factor, native_l2factor);
@@ -1,5 +1,9 @@
 #include "mupdf/fitz.h"
 
+#ifndef _MSC_VER
+#include <sys/time.h>
+#endif
+
 typedef struct fz_display_node_s fz_display_node;
 typedef struct fz_list_device_s fz_list_device;
 
@@ -116,6 +120,7 @@ struct fz_display_list_s
 	fz_display_node *list;
 	int max;
 	int len;
+	unsigned int text_size;
 };
 
 struct fz_list_device_s
@@ -768,6 +773,16 @@ fz_list_clip_stroke_path(fz_context *ctx, fz_device *dev, fz_path *path, const f
 		0); /* private_data_len */
 }
 
+/* Text is held by reference rather than packed into the nodes, but
+ * nothing else keeps it once the page has been run, so count it. Text
+ * used by several nodes is counted for each, erring towards the budget. */
+static void
+fz_list_count_text(fz_device *dev, fz_text *text)
+{
+	fz_display_list *list = ((fz_list_device *)dev)->list;
+	list->text_size += sizeof(*text) + text->cap * sizeof(fz_text_item);
+}
+
 static void
 fz_list_fill_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matrix *ctm,
 	fz_colorspace *colorspace, float *color, float alpha)
@@ -792,6 +807,7 @@ fz_list_fill_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matri
 			NULL, /* stroke */
 			&cloned_text, /* private_data */
 			sizeof(cloned_text)); /* private_data_len */
+		fz_list_count_text(dev, text);
 	}
 	fz_catch(ctx)
 	{
@@ -824,6 +840,7 @@ fz_list_stroke_text(fz_context *ctx, fz_device *dev, fz_text *text, fz_stroke_st
 			stroke,
 			&cloned_text, /* private_data */
 			sizeof(cloned_text)); /* private_data_len */
+		fz_list_count_text(dev, text);
 	}
 	fz_catch(ctx)
 	{
@@ -858,6 +875,7 @@ fz_list_clip_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matri
 			NULL, /* stroke */
 			&cloned_text, /* private_data */
 			sizeof(cloned_text)); /* private_data_len */
+		fz_list_count_text(dev, text);
 	}
 	fz_catch(ctx)
 	{
@@ -889,6 +907,7 @@ fz_list_clip_stroke_text(fz_context *ctx, fz_device *dev, fz_text *text, fz_stro
 			stroke, /* stroke */
 			&cloned_text, /* private_data */
 			sizeof(cloned_text)); /* private_data_len */
+		fz_list_count_text(dev, text);
 	}
 	fz_catch(ctx)
 	{
@@ -920,6 +939,7 @@ fz_list_ignore_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_mat
 			NULL, /* stroke */
 			&cloned_text, /* private_data */
 			sizeof(cloned_text)); /* private_data_len */
+		fz_list_count_text(dev, text);
 	}
 	fz_catch(ctx)
 	{
@@ -1373,6 +1393,7 @@ fz_new_display_list(fz_context *ctx)
 	list->list = NULL;
 	list->max = 0;
 	list->len = 0;
+	list->text_size = 0;
 	return list;
 }
 
@@ -1388,118 +1409,175 @@ fz_drop_display_list(fz_context *ctx, fz_display_list *list)
 	fz_drop_storable(ctx, &list->storable);
 }
 
-void
-fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, const fz_matrix *top_ctm, const fz_rect *scissor, fz_cookie *cookie)
+unsigned int
+fz_display_list_size(fz_context *ctx, fz_display_list *list)
+{
+	if (list == NULL)
+		return 0;
+	return sizeof(*list) + list->max * sizeof(fz_display_node) + list->text_size;
+}
+
+struct fz_list_runner_s
 {
+	fz_display_list *list;
+	fz_device *dev;
+	fz_matrix top_ctm;
+	fz_rect scissor;
 	fz_display_node *node;
-	fz_display_node *node_end;
-	fz_display_node *next_node;
-	int clipped = 0;
-	int tiled = 0;
-	int progress = 0;
+	int clipped;
+	int tiled;
+	int progress;
+	int tile_skip_depth;
 
 	/* Current graphics state as unpacked from list */
-	fz_path *path = NULL;
-	float alpha = 1.0f;
-	fz_matrix ctm = fz_identity;
-	fz_stroke_state *stroke = NULL;
-	float color[FZ_MAX_COLORS] = { 0 };
-	fz_colorspace *colorspace = fz_device_gray(ctx);
-	fz_rect rect = { 0 };
+	fz_path *path;
+	float alpha;
+	fz_matrix ctm;
+	fz_stroke_state *stroke;
+	float color[FZ_MAX_COLORS];
+	fz_colorspace *colorspace;
+	fz_rect rect;
+};
+
+static void
+init_list_runner(fz_context *ctx, fz_list_runner *r, fz_display_list *list, fz_device *dev, const fz_matrix *top_ctm, const fz_rect *scissor)
+{
+	memset(r, 0, sizeof(*r));
+	r->list = list;
+	r->dev = dev;
+	r->top_ctm = *top_ctm;
+	r->scissor = scissor ? *scissor : fz_infinite_rect;
+	r->node = list->list;
+	r->alpha = 1.0f;
+	r->ctm = fz_identity;
+	r->colorspace = fz_device_gray(ctx);
+}
+
+static void
+fin_list_runner(fz_context *ctx, fz_list_runner *r)
+{
+	fz_drop_colorspace(ctx, r->colorspace);
+	fz_drop_stroke_state(ctx, r->stroke);
+	fz_drop_path(ctx, r->path);
+}
+
+/* Milliseconds since start. Only the difference is scaled, so this does
+ * not overflow where time_t and long are 32 bits. */
+static int
+ms_since(const struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int)(now.tv_sec - start->tv_sec) * 1000 + (int)(now.tv_usec - start->tv_usec) / 1000;
+}
+
+/* Run nodes from where the runner stopped, until the end of the list,
+ * max_nodes of them (if non-zero) or max_ms milliseconds (if non-zero).
+ * Returns 1 once the end of the list has been reached. */
+static int
+run_list_nodes(fz_context *ctx, fz_list_runner *r, int max_nodes, int max_ms, fz_cookie *cookie)
+{
+	fz_display_node *node;
+	fz_display_node *node_end;
+	fz_display_node *next_node;
+	int count = 0;
+	struct timeval start;
 
 	/* Transformed versions of graphic state entries */
 	fz_rect trans_rect;
 	fz_matrix trans_ctm;
-	int tile_skip_depth = 0;
-
-	fz_var(colorspace);
-
-	if (!scissor)
-		scissor = &fz_infinite_rect;
 
 	if (cookie)
-	{
-		cookie->progress_max = list->len;
-		cookie->progress = 0;
-	}
+		cookie->progress_max = r->list->len;
+	if (max_ms)
+		gettimeofday(&start, NULL);
 
-	node = list->list;
-	node_end = &list->list[list->len];
-	for (; node != node_end ; node = next_node)
+	node_end = &r->list->list[r->list->len];
+	for (node = r->node; node != node_end; node = next_node)
 	{
 		int empty;
-		fz_display_node n = *node;
-
-		next_node = node + n.size;
+		fz_display_node n;
 
-		/* Check the cookie for aborting */
-		if (cookie)
+		/* Check the cookie for aborting, and the budget for pausing.
+		 * Either way, the next call starts again from this node. */
+		if (cookie && cookie->abort)
 		{
-			if (cookie->abort)
-				break;
-			cookie->progress = progress++;
+			r->node = node;
+			return 0;
 		}
+		if ((max_nodes && count == max_nodes) || (max_ms && ms_since(&start) >= max_ms))
+		{
+			r->node = node;
+			return 0;
+		}
+		count++;
+
+		n = *node;
+		next_node = node + n.size;
+		r->node = next_node;
+		if (cookie)
+			cookie->progress = r->progress++;
 
 		node++;
 		if (n.rect)
 		{
-			rect = *(fz_rect *)node;
+			r->rect = *(fz_rect *)node;
 			node += SIZE_IN_NODES(sizeof(fz_rect));
 		}
 		if (n.cs)
 		{
 			int i;
 
-			fz_drop_colorspace(ctx, colorspace);
+			fz_drop_colorspace(ctx, r->colorspace);
 			switch (n.cs)
 			{
 			default:
 			case CS_GRAY_0:
-				colorspace = fz_device_gray(ctx);
-				color[0] = 0.0f;
+				r->colorspace = fz_device_gray(ctx);
+				r->color[0] = 0.0f;
 				break;
 			case CS_GRAY_1:
-				colorspace = fz_device_gray(ctx);
-				color[0] = 1.0f;
+				r->colorspace = fz_device_gray(ctx);
+				r->color[0] = 1.0f;
 				break;
 			case CS_RGB_0:
-				colorspace = fz_device_rgb(ctx);
-				color[0] = 0.0f;
-				color[1] = 0.0f;
-				color[2] = 0.0f;
+				r->colorspace = fz_device_rgb(ctx);
+				r->color[0] = 0.0f;
+				r->color[1] = 0.0f;
+				r->color[2] = 0.0f;
 				break;
 			case CS_RGB_1:
-				colorspace = fz_device_rgb(ctx);
-				color[0] = 1.0f;
-				color[1] = 1.0f;
-				color[2] = 1.0f;
+				r->colorspace = fz_device_rgb(ctx);
+				r->color[0] = 1.0f;
+				r->color[1] = 1.0f;
+				r->color[2] = 1.0f;
 				break;
 			case CS_CMYK_0:
-				colorspace = fz_device_cmyk(ctx);
-				color[0] = 0.0f;
-				color[1] = 0.0f;
-				color[2] = 0.0f;
-				color[3] = 0.0f;
+				r->colorspace = fz_device_cmyk(ctx);
+				r->color[0] = 0.0f;
+				r->color[1] = 0.0f;
+				r->color[2] = 0.0f;
+				r->color[3] = 0.0f;
 				break;
 			case CS_CMYK_1:
-				colorspace = fz_device_cmyk(ctx);
-				color[0] = 0.0f;
-				color[1] = 0.0f;
-				color[2] = 0.0f;
-				color[3] = 1.0f;
+				r->colorspace = fz_device_cmyk(ctx);
+				r->color[0] = 0.0f;
+				r->color[1] = 0.0f;
+				r->color[2] = 0.0f;
+				r->color[3] = 1.0f;
 				break;
 			case CS_OTHER_0:
-				colorspace = fz_keep_colorspace(ctx, *(fz_colorspace **)(node));
+				r->colorspace = fz_keep_colorspace(ctx, *(fz_colorspace **)(node));
 				node += SIZE_IN_NODES(sizeof(fz_colorspace *));
-				for (i = 0; i < colorspace->n; i++)
-					color[i] = 0.0f;
+				for (i = 0; i < r->colorspace->n; i++)
+					r->color[i] = 0.0f;
 				break;
 			}
 		}
 		if (n.color)
 		{
-			memcpy(color, (float *)node, colorspace->n * sizeof(float));
-			node += SIZE_IN_NODES(colorspace->n * sizeof(float));
+			memcpy(r->color, (float *)node, r->colorspace->n * sizeof(float));
+			node += SIZE_IN_NODES(r->colorspace->n * sizeof(float));
 		}
 		if (n.alpha)
 		{
@@ -1507,13 +1585,13 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 			{
 			default:
 			case ALPHA_0:
-				alpha = 0.0f;
+				r->alpha = 0.0f;
 				break;
 			case ALPHA_1:
-				alpha = 1.0f;
+				r->alpha = 1.0f;
 				break;
 			case ALPHA_PRESENT:
-				alpha = *(float *)node;
+				r->alpha = *(float *)node;
 				node += SIZE_IN_NODES(sizeof(float));
 				break;
 			}
@@ -1523,52 +1601,52 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 			float *packed_ctm = (float *)node;
 			if (n.ctm & CTM_CHANGE_AD)
 			{
-				ctm.a = *packed_ctm++;
-				ctm.d = *packed_ctm++;
+				r->ctm.a = *packed_ctm++;
+				r->ctm.d = *packed_ctm++;
 				node += SIZE_IN_NODES(2*sizeof(float));
 			}
 			if (n.ctm & CTM_CHANGE_BC)
 			{
-				ctm.b = *packed_ctm++;
-				ctm.c = *packed_ctm++;
+				r->ctm.b = *packed_ctm++;
+				r->ctm.c = *packed_ctm++;
 				node += SIZE_IN_NODES(2*sizeof(float));
 			}
 			if (n.ctm & CTM_CHANGE_EF)
 			{
-				ctm.e = *packed_ctm++;
-				ctm.f = *packed_ctm;
+				r->ctm.e = *packed_ctm++;
+				r->ctm.f = *packed_ctm;
 				node += SIZE_IN_NODES(2*sizeof(float));
 			}
 		}
 		if (n.stroke)
 		{
-			fz_drop_stroke_state(ctx, stroke);
-			stroke = fz_keep_stroke_state(ctx, *(fz_stroke_state **)node);
+			fz_drop_stroke_state(ctx, r->stroke);
+			r->stroke = fz_keep_stroke_state(ctx, *(fz_stroke_state **)node);
 			node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
 		}
 		if (n.path)
 		{
-			fz_drop_path(ctx, path);
-			path = fz_keep_path(ctx, (fz_path *)node);
-			node += SIZE_IN_NODES(fz_packed_path_size(path));
+			fz_drop_path(ctx, r->path);
+			r->path = fz_keep_path(ctx, (fz_path *)node);
+			node += SIZE_IN_NODES(fz_packed_path_size(r->path));
 		}
 
-		if (tile_skip_depth > 0)
+		if (r->tile_skip_depth > 0)
 		{
 			if (n.cmd == FZ_CMD_BEGIN_TILE)
-				tile_skip_depth++;
+				r->tile_skip_depth++;
 			else if (n.cmd == FZ_CMD_END_TILE)
-				tile_skip_depth--;
-			if (tile_skip_depth > 0)
+				r->tile_skip_depth--;
+			if (r->tile_skip_depth > 0)
 				continue;
 		}
 
-		trans_rect = rect;
-		fz_transform_rect(&trans_rect, top_ctm);
+		trans_rect = r->rect;
+		fz_transform_rect(&trans_rect, &r->top_ctm);
 
 		/* cull objects to draw using a quick visibility test */
 
-		if (tiled ||
+		if (r->tiled ||
 			n.cmd == FZ_CMD_BEGIN_TILE || n.cmd == FZ_CMD_END_TILE ||
 			n.cmd == FZ_CMD_BEGIN_PAGE || n.cmd == FZ_CMD_END_PAGE)
 		{
@@ -1577,11 +1655,11 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 		else
 		{
 			fz_rect irect = trans_rect;
-			fz_intersect_rect(&irect, scissor);
+			fz_intersect_rect(&irect, &r->scissor);
 			empty = fz_is_empty_rect(&irect);
 		}
 
-		if (clipped || empty)
+		if (r->clipped || empty)
 		{
 			switch (n.cmd)
 			{
@@ -1591,21 +1669,21 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 			case FZ_CMD_CLIP_IMAGE_MASK:
 			case FZ_CMD_BEGIN_MASK:
 			case FZ_CMD_BEGIN_GROUP:
-				clipped++;
+				r->clipped++;
 				continue;
 			case FZ_CMD_CLIP_TEXT:
 				/* Accumulated text has no extra pops */
 				if (n.flags != 2)
-					clipped++;
+					r->clipped++;
 				continue;
 			case FZ_CMD_POP_CLIP:
 			case FZ_CMD_END_GROUP:
-				if (!clipped)
+				if (!r->clipped)
 					goto visible;
-				clipped--;
+				r->clipped--;
 				continue;
 			case FZ_CMD_END_MASK:
-				if (!clipped)
+				if (!r->clipped)
 					goto visible;
 				continue;
 			default:
@@ -1614,91 +1692,91 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 		}
 
 visible:
-		fz_concat(&trans_ctm, &ctm, top_ctm);
+		fz_concat(&trans_ctm, &r->ctm, &r->top_ctm);
 
 		fz_try(ctx)
 		{
 			switch (n.cmd)
 			{
 			case FZ_CMD_BEGIN_PAGE:
-				fz_begin_page(ctx, dev, &trans_rect, &trans_ctm);
+				fz_begin_page(ctx, r->dev, &trans_rect, &trans_ctm);
 				break;
 			case FZ_CMD_END_PAGE:
-				fz_end_page(ctx, dev);
+				fz_end_page(ctx, r->dev);
 				break;
 			case FZ_CMD_FILL_PATH:
-				fz_fill_path(ctx, dev, path, n.flags, &trans_ctm, colorspace, color, alpha);
+				fz_fill_path(ctx, r->dev, r->path, n.flags, &trans_ctm, r->colorspace, r->color, r->alpha);
 				break;
 			case FZ_CMD_STROKE_PATH:
-				fz_stroke_path(ctx, dev, path, stroke, &trans_ctm, colorspace, color, alpha);
+				fz_stroke_path(ctx, r->dev, r->path, r->stroke, &trans_ctm, r->colorspace, r->color, r->alpha);
 				break;
 			case FZ_CMD_CLIP_PATH:
-				fz_clip_path(ctx, dev, path, &trans_rect, n.flags, &trans_ctm);
+				fz_clip_path(ctx, r->dev, r->path, &trans_rect, n.flags, &trans_ctm);
 				break;
 			case FZ_CMD_CLIP_STROKE_PATH:
-				fz_clip_stroke_path(ctx, dev, path, &trans_rect, stroke, &trans_ctm);
+				fz_clip_stroke_path(ctx, r->dev, r->path, &trans_rect, r->stroke, &trans_ctm);
 				break;
 			case FZ_CMD_FILL_TEXT:
-				fz_fill_text(ctx, dev, *(fz_text **)node, &trans_ctm, colorspace, color, alpha);
+				fz_fill_text(ctx, r->dev, *(fz_text **)node, &trans_ctm, r->colorspace, r->color, r->alpha);
 				break;
 			case FZ_CMD_STROKE_TEXT:
-				fz_stroke_text(ctx, dev, *(fz_text **)node, stroke, &trans_ctm, colorspace, color, alpha);
+				fz_stroke_text(ctx, r->dev, *(fz_text **)node, r->stroke, &trans_ctm, r->colorspace, r->color, r->alpha);
 				break;
 			case FZ_CMD_CLIP_TEXT:
-				fz_clip_text(ctx, dev, *(fz_text **)node, &trans_ctm, n.flags);
+				fz_clip_text(ctx, r->dev, *(fz_text **)node, &trans_ctm, n.flags);
 				break;
 			case FZ_CMD_CLIP_STROKE_TEXT:
-				fz_clip_stroke_text(ctx, dev, *(fz_text **)node, stroke, &trans_ctm);
+				fz_clip_stroke_text(ctx, r->dev, *(fz_text **)node, r->stroke, &trans_ctm);
 				break;
 			case FZ_CMD_IGNORE_TEXT:
-				fz_ignore_text(ctx, dev, *(fz_text **)node, &trans_ctm);
+				fz_ignore_text(ctx, r->dev, *(fz_text **)node, &trans_ctm);
 				break;
 			case FZ_CMD_FILL_SHADE:
-				if ((dev->hints & FZ_IGNORE_SHADE) == 0)
-					fz_fill_shade(ctx, dev, *(fz_shade **)node, &trans_ctm, alpha);
+				if ((r->dev->hints & FZ_IGNORE_SHADE) == 0)
+					fz_fill_shade(ctx, r->dev, *(fz_shade **)node, &trans_ctm, r->alpha);
 				break;
 			case FZ_CMD_FILL_IMAGE:
-				if ((dev->hints & FZ_IGNORE_IMAGE) == 0)
-					fz_fill_image(ctx, dev, *(fz_image **)node, &trans_ctm, alpha);
+				if ((r->dev->hints & FZ_IGNORE_IMAGE) == 0)
+					fz_fill_image(ctx, r->dev, *(fz_image **)node, &trans_ctm, r->alpha);
 				break;
 			case FZ_CMD_FILL_IMAGE_MASK:
-				if ((dev->hints & FZ_IGNORE_IMAGE) == 0)
-					fz_fill_image_mask(ctx, dev, *(fz_image **)node, &trans_ctm, colorspace, color, alpha);
+				if ((r->dev->hints & FZ_IGNORE_IMAGE) == 0)
+					fz_fill_image_mask(ctx, r->dev, *(fz_image **)node, &trans_ctm, r->colorspace, r->color, r->alpha);
 				break;
 			case FZ_CMD_CLIP_IMAGE_MASK:
-				if ((dev->hints & FZ_IGNORE_IMAGE) == 0)
-					fz_clip_image_mask(ctx, dev, *(fz_image **)node, &trans_rect, &trans_ctm);
+				if ((r->dev->hints & FZ_IGNORE_IMAGE) == 0)
+					fz_clip_image_mask(ctx, r->dev, *(fz_image **)node, &trans_rect, &trans_ctm);
 				break;
 			case FZ_CMD_POP_CLIP:
-				fz_pop_clip(ctx, dev);
+				fz_pop_clip(ctx, r->dev);
 				break;
 			case FZ_CMD_BEGIN_MASK:
-				fz_begin_mask(ctx, dev, &trans_rect, n.flags, colorspace, color);
+				fz_begin_mask(ctx, r->dev, &trans_rect, n.flags, r->colorspace, r->color);
 				break;
 			case FZ_CMD_END_MASK:
-				fz_end_mask(ctx, dev);
+				fz_end_mask(ctx, r->dev);
 				break;
 			case FZ_CMD_BEGIN_GROUP:
-				fz_begin_group(ctx, dev, &trans_rect, (n.flags & ISOLATED) != 0, (n.flags & KNOCKOUT) != 0, (n.flags>>2), alpha);
+				fz_begin_group(ctx, r->dev, &trans_rect, (n.flags & ISOLATED) != 0, (n.flags & KNOCKOUT) != 0, (n.flags>>2), r->alpha);
 				break;
 			case FZ_CMD_END_GROUP:
-				fz_end_group(ctx, dev);
+				fz_end_group(ctx, r->dev);
 				break;
 			case FZ_CMD_BEGIN_TILE:
 			{
 				int cached;
 				fz_list_tile_data *data = (fz_list_tile_data *)node;
 				fz_rect tile_rect;
-				tiled++;
+				r->tiled++;
 				tile_rect = data->view;
-				cached = fz_begin_tile_id(ctx, dev, &rect, &tile_rect, data->xstep, data->ystep, &trans_ctm, n.flags);
+				cached = fz_begin_tile_id(ctx, r->dev, &r->rect, &tile_rect, data->xstep, data->ystep, &trans_ctm, n.flags);
 				if (cached)
-					tile_skip_depth = 1;
+					r->tile_skip_depth = 1;
 				break;
 			}
 			case FZ_CMD_END_TILE:
-				tiled--;
-				fz_end_tile(ctx, dev);
+				r->tiled--;
+				fz_end_tile(ctx, r->dev);
 				break;
 			}
 		}
@@ -1708,11 +1786,48 @@ visible:
 			if (cookie)
 				cookie->errors++;
 			if (fz_caught(ctx) == FZ_ERROR_ABORT)
-				break;
+				return 0;
 			fz_warn(ctx, "Ignoring error during interpretation");
 		}
 	}
-	fz_drop_colorspace(ctx, colorspace);
-	fz_drop_stroke_state(ctx, stroke);
-	fz_drop_path(ctx, path);
+	r->node = node_end;
+	return 1;
+}
+
+void
+fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, const fz_matrix *top_ctm, const fz_rect *scissor, fz_cookie *cookie)
+{
+	fz_list_runner runner;
+
+	if (cookie)
+		cookie->progress = 0;
+
+	init_list_runner(ctx, &runner, list, dev, top_ctm, scissor);
+	run_list_nodes(ctx, &runner, 0, 0, cookie);
+	fin_list_runner(ctx, &runner);
+}
+
+fz_list_runner *
+fz_new_list_runner(fz_context *ctx, fz_display_list *list, fz_device *dev, const fz_matrix *ctm, const fz_rect *area)
+{
+	fz_list_runner *runner = fz_malloc_struct(ctx, fz_list_runner);
+
+	init_list_runner(ctx, runner, fz_keep_display_list(ctx, list), dev, ctm, area);
+	return runner;
+}
+
+int
+fz_run_list_runner(fz_context *ctx, fz_list_runner *runner, int max_nodes, int max_ms, fz_cookie *cookie)
+{
+	return run_list_nodes(ctx, runner, max_nodes, max_ms, cookie);
+}
+
+void
+fz_drop_list_runner(fz_context *ctx, fz_list_runner *runner)
+{
+	if (!runner)
+		return;
+	fin_list_runner(ctx, runner);
+	fz_drop_display_list(ctx, runner->list);
+	fz_free(ctx, runner);
 }
@@ -57,8 +57,11 @@ static OPJ_OFF_T fz_opj_stream_skip(OPJ_OFF_T skip, void * p_user_data)
 
 	if (skip > sb->size - sb->pos)
 		skip = sb->size - sb->pos;
+	if (skip <= 0)
+		return (OPJ_OFF_T)-1; /* End of file! */
 	sb->pos += skip;
-	return sb->pos;
+	/* openjpeg wants the number of bytes skipped, not the new position */
+	return skip;
 }
 
 static OPJ_BOOL fz_opj_stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
@@ -71,26 +74,19 @@ static OPJ_BOOL fz_opj_stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
 	return OPJ_TRUE;
 }
 
-fz_pixmap *
-fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+/*
+	Open a decoder on the codestream and read its main header. Without a
+	context (as on worker threads) all messages are dropped.
+*/
+static opj_codec_t *
+jpx_read_header(fz_context *ctx, stream_block *sb, int indexed, opj_stream_t **stream, opj_image_t **jpx)
 {
-	fz_pixmap *img;
 	opj_dparameters_t params;
 	opj_codec_t *codec;
-	opj_image_t *jpx;
-	opj_stream_t *stream;
-	fz_colorspace *colorspace;
-	unsigned char *p;
 	OPJ_CODEC_FORMAT format;
-	int a, n, w, h, depth, sgnd;
-	int x, y, k, v;
-	stream_block sb;
-
-	if (size < 2)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "not enough data to determine image format");
 
 	/* Check for SOC marker -- if found we have a bare J2K stream */
-	if (data[0] == 0xFF && data[1] == 0x4F)
+	if (sb->data[0] == 0xFF && sb->data[1] == 0x4F)
 		format = OPJ_CODEC_J2K;
 	else
 		format = OPJ_CODEC_JP2;
@@ -100,78 +96,119 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
 
 	codec = opj_create_decompress(format);
-	opj_set_info_handler(codec, fz_opj_info_callback, ctx);
-	opj_set_warning_handler(codec, fz_opj_warning_callback, ctx);
-	opj_set_error_handler(codec, fz_opj_error_callback, ctx);
+	if (!codec)
+		return NULL;
+	if (ctx)
+	{
+		opj_set_info_handler(codec, fz_opj_info_callback, ctx);
+		opj_set_warning_handler(codec, fz_opj_warning_callback, ctx);
+		opj_set_error_handler(codec, fz_opj_error_callback, ctx);
+	}
+	else
+	{
+		opj_set_info_handler(codec, fz_opj_info_callback, NULL);
+		opj_set_warning_handler(codec, fz_opj_info_callback, NULL);
+		opj_set_error_handler(codec, fz_opj_info_callback, NULL);
+	}
 	if (!opj_setup_decoder(codec, &params))
 	{
 		opj_destroy_codec(codec);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
+		return NULL;
 	}
 
-	stream = opj_stream_default_create(OPJ_TRUE);
-	sb.data = data;
-	sb.pos = 0;
-	sb.size = size;
+	*stream = opj_stream_default_create(OPJ_TRUE);
+	if (!*stream)
+	{
+		opj_destroy_codec(codec);
+		return NULL;
+	}
+	sb->pos = 0;
 
-	opj_stream_set_read_function(stream, fz_opj_stream_read);
-	opj_stream_set_skip_function(stream, fz_opj_stream_skip);
-	opj_stream_set_seek_function(stream, fz_opj_stream_seek);
-	opj_stream_set_user_data(stream, &sb);
+	opj_stream_set_read_function(*stream, fz_opj_stream_read);
+	opj_stream_set_skip_function(*stream, fz_opj_stream_skip);
+	opj_stream_set_seek_function(*stream, fz_opj_stream_seek);
+	opj_stream_set_user_data(*stream, sb);
 	/* Set the length to avoid an assert */
-	opj_stream_set_user_data_length(stream, size);
+	opj_stream_set_user_data_length(*stream, sb->size);
 
-	if (!opj_read_header(stream, codec, &jpx))
+	*jpx = NULL;
+	if (!opj_read_header(*stream, codec, jpx))
 	{
-		opj_stream_destroy(stream);
+		opj_stream_destroy(*stream);
 		opj_destroy_codec(codec);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
+		return NULL;
 	}
 
-	if (!opj_decode(codec, stream, jpx))
+	return codec;
+}
+
+/*
+	Decode the part of the image that lies in x0,y0-x1,y1 on the
+	reference grid, dropping the top reduce resolution levels. Only the
+	tiles that intersect the region are decoded.
+*/
+static opj_image_t *
+jpx_decode_region(fz_context *ctx, unsigned char *data, int size, int indexed, int reduce, int x0, int y0, int x1, int y1)
+{
+	opj_codec_t *codec;
+	opj_stream_t *stream;
+	opj_image_t *jpx;
+	stream_block sb;
+	int k, ok = 1;
+
+	sb.data = data;
+	sb.size = size;
+	codec = jpx_read_header(ctx, &sb, indexed, &stream, &jpx);
+	if (!codec)
+		return NULL;
+
+	if (reduce > 0)
 	{
-		opj_stream_destroy(stream);
-		opj_destroy_codec(codec);
-		opj_image_destroy(jpx);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
+		ok = opj_set_decoded_resolution_factor(codec, reduce);
+		/* openjpeg only updates its private copy of the header */
+		for (k = 0; ok && k < (int)jpx->numcomps; k++)
+			jpx->comps[k].factor = reduce;
 	}
+	if (ok)
+		ok = opj_set_decode_area(codec, jpx, x0, y0, x1, y1);
+	if (ok)
+		ok = opj_decode(codec, stream, jpx);
 
 	opj_stream_destroy(stream);
 	opj_destroy_codec(codec);
 
-	/* jpx should never be NULL here, but check anyway */
-	if (!jpx)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "opj_decode failed");
+	if (!ok)
+	{
+		opj_image_destroy(jpx);
+		return NULL;
+	}
+	return jpx;
+}
 
-	for (k = 1; k < (int)jpx->numcomps; k++)
+static const char *
+jpx_check_components(opj_image_t *jpx)
+{
+	int k;
+
+	for (k = 0; k < (int)jpx->numcomps; k++)
 	{
 		if (!jpx->comps[k].data)
-		{
-			opj_image_destroy(jpx);
-			fz_throw(ctx, FZ_ERROR_GENERIC, "image components are missing data");
-		}
+			return "image components are missing data";
 		if (jpx->comps[k].w != jpx->comps[0].w)
-		{
-			opj_image_destroy(jpx);
-			fz_throw(ctx, FZ_ERROR_GENERIC, "image components have different width");
-		}
+			return "image components have different width";
 		if (jpx->comps[k].h != jpx->comps[0].h)
-		{
-			opj_image_destroy(jpx);
-			fz_throw(ctx, FZ_ERROR_GENERIC, "image components have different height");
-		}
+			return "image components have different height";
 		if (jpx->comps[k].prec != jpx->comps[0].prec)
-		{
-			opj_image_destroy(jpx);
-			fz_throw(ctx, FZ_ERROR_GENERIC, "image components have different precision");
-		}
+			return "image components have different precision";
 	}
+	return NULL;
+}
 
-	n = jpx->numcomps;
-	w = jpx->comps[0].w;
-	h = jpx->comps[0].h;
-	depth = jpx->comps[0].prec;
-	sgnd = jpx->comps[0].sgnd;
+static fz_colorspace *
+jpx_colorspace(fz_context *ctx, opj_image_t *jpx, fz_colorspace *defcs, int *np, int *ap)
+{
+	int n = jpx->numcomps;
+	int a;
 
 	if (jpx->color_space == OPJ_CLRSPC_SRGB && n == 4) { n = 3; a = 1; }
 	else if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 4) { n = 3; a = 1; }
@@ -179,40 +216,35 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	else if (n > 4) { n = 4; a = 1; }
 	else { a = 0; }
 
+	*np = n;
+	*ap = a;
+
 	if (defcs)
 	{
 		if (defcs->n == n)
-		{
-			colorspace = defcs;
-		}
-		else
-		{
+			return defcs;
+		/* A lazily decoded CMYK image with alpha is already labelled RGB */
+		if (!(a && n == 4 && defcs == fz_device_rgb(ctx)))
 			fz_warn(ctx, "jpx file and dict colorspaces do not match");
-			defcs = NULL;
-		}
 	}
 
-	if (!defcs)
+	switch (n)
 	{
-		switch (n)
-		{
-		case 1: colorspace = fz_device_gray(ctx); break;
-		case 3: colorspace = fz_device_rgb(ctx); break;
-		case 4: colorspace = fz_device_cmyk(ctx); break;
-		}
+	case 1: return fz_device_gray(ctx);
+	case 3: return fz_device_rgb(ctx);
+	default: return fz_device_cmyk(ctx);
 	}
+}
 
-	fz_try(ctx)
-	{
-		img = fz_new_pixmap(ctx, colorspace, w, h);
-	}
-	fz_catch(ctx)
-	{
-		opj_image_destroy(jpx);
-		fz_rethrow_message(ctx, "out of memory loading jpx");
-	}
+static unsigned char *
+jpx_copy_samples(unsigned char *p, opj_image_t *jpx, int n, int a)
+{
+	int w = jpx->comps[0].w;
+	int h = jpx->comps[0].h;
+	int depth = jpx->comps[0].prec;
+	int sgnd = jpx->comps[0].sgnd;
+	int x, y, k, v;
 
-	p = img->samples;
 	for (y = 0; y < h; y++)
 	{
 		for (x = 0; x < w; x++)
@@ -230,9 +262,236 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 				*p++ = 255;
 		}
 	}
+	return p;
+}
+
+#ifdef HAVE_PTHREADS
 
+#include <pthread.h>
+#include <unistd.h>
+
+#define JPX_MAX_THREADS 4
+#define JPX_MIN_THREADED_AREA (1 << 20)
+
+typedef struct jpx_band_s
+{
+	unsigned char *data;
+	int size;
+	int indexed;
+	int reduce;
+	int x0, y0, x1, y1;
+	opj_image_t *jpx;
+	pthread_t thread;
+	int started;
+} jpx_band;
+
+static void *
+jpx_band_thread(void *arg)
+{
+	jpx_band *band = arg;
+	band->jpx = jpx_decode_region(NULL, band->data, band->size, band->indexed, band->reduce, band->x0, band->y0, band->x1, band->y1);
+	return NULL;
+}
+
+/*
+	Tiles are coded independently, so rows of tiles can be decoded by
+	separate decoders at once. Each worker opens its own codec on the
+	(read only) data and decodes one band of tile rows; the bands are
+	returned top to bottom. Returns 0, having decoded nothing, if the
+	image is too small to be worth splitting or any band fails; the
+	caller then decodes the whole region itself.
+*/
+static int
+jpx_decode_bands(unsigned char *data, int size, int indexed, int reduce, int x0, int y0, int x1, int y1,
+	int ty0, int tdy, opj_image_t **bands)
+{
+	jpx_band band[JPX_MAX_THREADS];
+	long cpus;
+	int t0, t1, rows, count, i, ok;
+
+	if (tdy <= 0 || (double)((x1 - x0) >> reduce) * ((y1 - y0) >> reduce) < JPX_MIN_THREADED_AREA)
+		return 0;
+
+	t0 = (y0 - ty0) / tdy;
+	t1 = (y1 - ty0 + tdy - 1) / tdy;
+	rows = t1 - t0;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	count = fz_mini(rows, fz_clampi(cpus, 1, JPX_MAX_THREADS));
+	if (count < 2)
+		return 0;
+
+	for (i = 0; i < count; i++)
+	{
+		band[i].data = data;
+		band[i].size = size;
+		band[i].indexed = indexed;
+		band[i].reduce = reduce;
+		band[i].x0 = x0;
+		band[i].x1 = x1;
+		band[i].y0 = fz_maxi(y0, ty0 + (t0 + rows * i / count) * tdy);
+		band[i].y1 = fz_mini(y1, ty0 + (t0 + rows * (i + 1) / count) * tdy);
+		band[i].jpx = NULL;
+		band[i].started = 0;
+	}
+
+	/* The calling thread decodes the first band */
+	for (i = 1; i < count; i++)
+		band[i].started = !pthread_create(&band[i].thread, NULL, jpx_band_thread, &band[i]);
+	jpx_band_thread(&band[0]);
+
+	ok = 1;
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
+		{
+			if (band[i].started)
+				pthread_join(band[i].thread, NULL);
+			else
+				jpx_band_thread(&band[i]);
+		}
+		if (!band[i].jpx || jpx_check_components(band[i].jpx) ||
+			band[i].jpx->numcomps != band[0].jpx->numcomps ||
+			band[i].jpx->comps[0].w != band[0].jpx->comps[0].w ||
+			band[i].jpx->comps[0].prec != band[0].jpx->comps[0].prec ||
+			band[i].jpx->comps[0].sgnd != band[0].jpx->comps[0].sgnd)
+			ok = 0;
+	}
+
+	if (!ok)
+	{
+		for (i = 0; i < count; i++)
+			opj_image_destroy(band[i].jpx);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++)
+		bands[i] = band[i].jpx;
+	return count;
+}
+
+#else
+
+static int
+jpx_decode_bands(unsigned char *data, int size, int indexed, int reduce, int x0, int y0, int x1, int y1,
+	int ty0, int tdy, opj_image_t **bands)
+{
+	return 0;
+}
+
+#define JPX_MAX_THREADS 1
+
+#endif
+
+fz_pixmap *
+fz_load_jpx_region(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, const fz_irect *area, int *l2factor)
+{
+	fz_pixmap *img;
+	opj_codec_t *codec;
+	opj_codestream_info_v2_t *info;
+	opj_stream_t *stream;
+	opj_image_t *jpx;
+	opj_image_t *bands[JPX_MAX_THREADS];
+	fz_colorspace *colorspace;
+	const char *err;
+	unsigned char *p;
+	int a, n, w, h, k, count;
+	int x0, y0, x1, y1, ty0, tdy, reduce;
+	stream_block sb;
+
+	if (size < 2)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "not enough data to determine image format");
+
+	/* Read the header to find the image and tile geometry */
+	sb.data = data;
+	sb.size = size;
+	codec = jpx_read_header(ctx, &sb, indexed, &stream, &jpx);
+	if (!codec)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
+
+	x0 = jpx->x0;
+	y0 = jpx->y0;
+	x1 = jpx->x1;
+	y1 = jpx->y1;
+	if (area)
+	{
+		x0 = fz_maxi(x0, jpx->x0 + area->x0);
+		y0 = fz_maxi(y0, jpx->y0 + area->y0);
+		x1 = fz_mini(x1, jpx->x0 + area->x1);
+		y1 = fz_mini(y1, jpx->y0 + area->y1);
+	}
+
+	/* Never drop more levels than every component has, nor any levels
+	 * of palette indices. */
+	reduce = (l2factor && !indexed) ? *l2factor : 0;
+	ty0 = tdy = 0;
+	info = opj_get_cstr_info(codec);
+	if (info)
+	{
+		for (k = 0; k < (int)info->nbcomps && k < (int)jpx->numcomps; k++)
+			reduce = fz_mini(reduce, (int)info->m_default_tile_info.tccp_info[k].numresolutions - 1);
+		ty0 = info->ty0;
+		tdy = info->tdy;
+		opj_destroy_cstr_info(&info);
+	}
+	else
+		reduce = 0;
+	reduce = fz_maxi(reduce, 0);
+
+	opj_stream_destroy(stream);
+	opj_destroy_codec(codec);
 	opj_image_destroy(jpx);
 
+	if (x0 >= x1 || y0 >= y1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "JPX decode area is empty");
+
+	count = jpx_decode_bands(data, size, indexed, reduce, x0, y0, x1, y1, ty0, tdy, bands);
+	if (count == 0)
+	{
+		bands[0] = jpx_decode_region(ctx, data, size, indexed, reduce, x0, y0, x1, y1);
+		if (!bands[0] && reduce > 0)
+		{
+			/* Some tiles may have fewer levels than the main header says */
+			reduce = 0;
+			bands[0] = jpx_decode_region(ctx, data, size, indexed, reduce, x0, y0, x1, y1);
+		}
+		if (!bands[0])
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
+		count = 1;
+
+		err = jpx_check_components(bands[0]);
+		if (err)
+		{
+			opj_image_destroy(bands[0]);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s", err);
+		}
+	}
+
+	jpx = bands[0];
+	w = jpx->comps[0].w;
+	h = 0;
+	for (k = 0; k < count; k++)
+		h += bands[k]->comps[0].h;
+
+	colorspace = jpx_colorspace(ctx, jpx, defcs, &n, &a);
+
+	fz_try(ctx)
+	{
+		img = fz_new_pixmap(ctx, colorspace, w, h);
+	}
+	fz_catch(ctx)
+	{
+		for (k = 0; k < count; k++)
+			opj_image_destroy(bands[k]);
+		fz_rethrow_message(ctx, "out of memory loading jpx");
+	}
+
+	p = img->samples;
+	for (k = 0; k < count; k++)
+	{
+		p = jpx_copy_samples(p, bands[k], n, a);
+		opj_image_destroy(bands[k]);
+	}
+
 	if (a)
 	{
 		if (n == 4)
@@ -245,5 +504,45 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		fz_premultiply_pixmap(ctx, img);
 	}
 
+	if (l2factor)
+		*l2factor = reduce;
+
 	return img;
 }
+
+fz_pixmap *
+fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+{
+	return fz_load_jpx_region(ctx, data, size, defcs, indexed, NULL, NULL);
+}
+
+void
+fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
+{
+	opj_codec_t *codec;
+	opj_stream_t *stream;
+	opj_image_t *jpx;
+	stream_block sb;
+	int n, a;
+
+	if (size < 2)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "not enough data to determine image format");
+
+	sb.data = data;
+	sb.size = size;
+	codec = jpx_read_header(ctx, &sb, 0, &stream, &jpx);
+	if (!codec)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
+
+	*wp = jpx->comps[0].w;
+	*hp = jpx->comps[0].h;
+	*xresp = 96;
+	*yresp = 96;
+	*cspacep = jpx_colorspace(ctx, jpx, NULL, &n, &a);
+	if (a && n == 4)
+		*cspacep = fz_device_rgb(ctx);
+
+	opj_stream_destroy(stream);
+	opj_destroy_codec(codec);
+	opj_image_destroy(jpx);
+}
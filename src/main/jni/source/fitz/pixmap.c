@@ -285,6 +285,109 @@ fz_copy_pixmap_rect(fz_context *ctx, fz_pixmap *dest, fz_pixmap *src, const fz_i
 	}
 }
 
+/* 4x4 ordered dither thresholds, 0 to 15. */
+static const unsigned char dither_4x4[4][4] =
+{
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 }
+};
+
+void
+fz_copy_pixmap_rect_to_rgb565(fz_context *ctx, unsigned char *dest, int stride, const fz_irect *dest_bbox, fz_pixmap *src, const fz_irect *b)
+{
+	const unsigned char *srcp;
+	int x, y, w, srcspan;
+	fz_irect local_b, bb;
+
+	local_b = *b;
+	fz_intersect_irect(&local_b, dest_bbox);
+	fz_intersect_irect(&local_b, fz_pixmap_bbox(ctx, src, &bb));
+	w = local_b.x1 - local_b.x0;
+	if (w <= 0 || local_b.y1 <= local_b.y0)
+		return;
+	if (src->n != 4 && src->n != 2)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot convert pixmap with %d components to rgb565", src->n);
+
+	srcspan = src->w * src->n;
+	srcp = src->samples + (unsigned int)(srcspan * (local_b.y0 - src->y) + src->n * (local_b.x0 - src->x));
+	dest += (unsigned int)(stride * (local_b.y0 - dest_bbox->y0) + 2 * (local_b.x0 - dest_bbox->x0));
+
+	for (y = local_b.y0; y < local_b.y1; y++)
+	{
+		const unsigned char *dither = dither_4x4[y & 3];
+		const unsigned char *s = srcp;
+		unsigned short *d = (unsigned short *)dest;
+
+		for (x = local_b.x0; x < local_b.x0 + w; x++)
+		{
+			/* Subtracting the top bits keeps full intensity from
+			 * overflowing once the threshold is added. */
+			int t = dither[x & 3];
+			int r = s[0];
+			int g = src->n == 4 ? s[1] : r;
+			int bl = src->n == 4 ? s[2] : r;
+			r = (r + (t >> 1) - (r >> 5)) >> 3;
+			g = (g + (t >> 2) - (g >> 6)) >> 2;
+			bl = (bl + (t >> 1) - (bl >> 5)) >> 3;
+			*d++ = (unsigned short)((r << 11) | (g << 5) | bl);
+			s += src->n;
+		}
+		srcp += srcspan;
+		dest += stride;
+	}
+}
+
+void
+fz_copy_pixmap_rect_to_gray(fz_context *ctx, unsigned char *dest, int stride, const fz_irect *dest_bbox, fz_pixmap *src, const fz_irect *b)
+{
+	const unsigned char *srcp;
+	int x, y, w, srcspan;
+	fz_irect local_b, bb;
+
+	local_b = *b;
+	fz_intersect_irect(&local_b, dest_bbox);
+	fz_intersect_irect(&local_b, fz_pixmap_bbox(ctx, src, &bb));
+	w = local_b.x1 - local_b.x0;
+	y = local_b.y1 - local_b.y0;
+	if (w <= 0 || y <= 0)
+		return;
+	if (src->n != 4 && src->n != 2)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot convert pixmap with %d components to gray", src->n);
+
+	srcspan = src->w * src->n;
+	srcp = src->samples + (unsigned int)(srcspan * (local_b.y0 - src->y) + src->n * (local_b.x0 - src->x));
+	dest += (unsigned int)(stride * (local_b.y0 - dest_bbox->y0) + (local_b.x0 - dest_bbox->x0));
+
+	do
+	{
+		const unsigned char *s = srcp;
+		unsigned char *d = dest;
+
+		if (src->n == 2)
+		{
+			for (x = w; x > 0; x--)
+			{
+				*d++ = s[0];
+				s += 2;
+			}
+		}
+		else
+		{
+			/* Same weights as fz_convert_pixmap uses */
+			for (x = w; x > 0; x--)
+			{
+				*d++ = ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
+				s += 4;
+			}
+		}
+		srcp += srcspan;
+		dest += stride;
+	}
+	while (--y);
+}
+
 void
 fz_clear_pixmap_rect_with_value(fz_context *ctx, fz_pixmap *dest, int value, const fz_irect *b)
 {
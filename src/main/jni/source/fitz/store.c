@@ -26,7 +26,10 @@ struct fz_store_s
 	 * entries (those whose keys are indirect objects). */
 	fz_hash_table *hash;
 
-	/* We keep track of the size of the store, and keep it below max. */
+	/* We keep track of the size of the store, and keep it below max.
+	 * Memory pressure may lower max below the limit it was created
+	 * with. */
+	unsigned int limit;
 	unsigned int max;
 	unsigned int size;
 };
@@ -49,6 +52,7 @@ fz_new_store_context(fz_context *ctx, unsigned int max)
 	store->head = NULL;
 	store->tail = NULL;
 	store->size = 0;
+	store->limit = max;
 	store->max = max;
 	ctx->store = store;
 }
@@ -438,6 +442,103 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_type
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
+/* Evict the least recently used items of a tier that nobody else is
+ * using until at least tofree bytes are gone. */
+static unsigned int
+evict_tier(fz_context *ctx, int tier, unsigned int tofree)
+{
+	fz_store *store = ctx->store;
+	fz_item *item, *prev;
+	unsigned int count = 0;
+
+	for (item = store->tail; item && count < tofree; item = prev)
+	{
+		prev = item->prev;
+		if (item->type->tier != tier || item->val->refs != 1)
+			continue;
+		count += item->size;
+		/* Pin prev while evict drops the lock (see ensure_space) */
+		if (prev)
+			prev->val->refs++;
+		evict(ctx, item); /* Drops then retakes lock */
+		if (prev)
+			--prev->val->refs;
+	}
+	return count;
+}
+
+unsigned int
+fz_store_pressure(fz_context *ctx, int level, unsigned int *freed)
+{
+	/* Budget at each level, in quarters of the store limit */
+	static const int quarters[] = { 4, 3, 2, 1 };
+	fz_store *store;
+	unsigned int total = 0;
+	unsigned int n;
+	int tier;
+
+	if (freed)
+		memset(freed, 0, FZ_STORE_TIER_MAX * sizeof *freed);
+	if (ctx == NULL || ctx->store == NULL)
+		return 0;
+	store = ctx->store;
+	level = fz_clampi(level, FZ_STORE_PRESSURE_NONE, FZ_STORE_PRESSURE_CRITICAL);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (store->limit != FZ_STORE_UNLIMITED)
+		store->max = fz_maxi(store->limit / 4 * quarters[level], 1);
+	for (tier = 0; tier < FZ_STORE_TIER_GLYPHS; tier++)
+	{
+		if (tier < level)
+			n = evict_tier(ctx, tier, UINT_MAX);
+		else if (store->max != FZ_STORE_UNLIMITED && store->size > store->max)
+			n = evict_tier(ctx, tier, store->size - store->max);
+		else
+			n = 0;
+		if (freed)
+			freed[tier] = n;
+		total += n;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (level == FZ_STORE_PRESSURE_CRITICAL)
+	{
+		n = fz_purge_glyph_cache(ctx);
+		if (freed)
+			freed[FZ_STORE_TIER_GLYPHS] = n;
+		total += n;
+	}
+
+	return total;
+}
+
+void
+fz_filter_store(fz_context *ctx, fz_store_drop_fn *drop, fz_store_filter_fn *fn, void *arg, fz_store_type *type)
+{
+	fz_store *store = ctx->store;
+	fz_item *item, *prev;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (item = store->tail; item; item = prev)
+	{
+		prev = item->prev;
+		if (item->type != type || (drop && item->val->drop != drop))
+			continue;
+		if (!fn(ctx, arg, item->key, item->val))
+			continue;
+		/* Pin prev while evict drops the lock (see ensure_space) */
+		if (prev)
+			prev->val->refs++;
+		evict(ctx, item); /* Drops then retakes lock */
+		if (prev)
+			--prev->val->refs;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void
 fz_empty_store(fz_context *ctx)
 {
@@ -1,5 +1,6 @@
 #include "mupdf/fitz/stream.h"
 #include "mupdf/fitz/string.h"
+#include "mupdf/fitz/math.h"
 
 #if (defined(_WIN32) || defined(_WIN64)) && !defined(NDEBUG)
 #include "windows.h"
@@ -166,8 +167,8 @@ fz_open_fd_progressive(fz_context *ctx, int fd, int bps)
 	return stm;
 }
 
-fz_stream *
-fz_open_file_progressive(fz_context *ctx, const char *name, int bps)
+static int
+open_prog_fd(fz_context *ctx, const char *name)
 {
 #if defined(_WIN32) || defined(_WIN64)
 	char *s = (char*)name;
@@ -186,5 +187,391 @@ fz_open_file_progressive(fz_context *ctx, const char *name, int bps)
 #endif
 	if (fd == -1)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open %s", name);
-	return fz_open_fd_progressive(ctx, fd, bps);
+	return fd;
+}
+
+fz_stream *
+fz_open_file_progressive(fz_context *ctx, const char *name, int bps)
+{
+	return fz_open_fd_progressive(ctx, open_prog_fd(ctx, name), bps);
+}
+
+/* Ranged stream - random access to a remote file by byte range
+ * requests. Data is kept in fixed size blocks as it arrives. Reading
+ * a block that has not arrived asks for it, together with some read
+ * ahead that grows while the reads are sequential, and throws
+ * FZ_ERROR_TRYLATER. */
+
+enum
+{
+	RANGE_BLOCK = 16 << 10,
+	RANGE_AHEAD_MIN = 64 << 10,
+	RANGE_AHEAD_MAX = 1 << 20
+};
+
+typedef struct range_state
+{
+	int length;
+	int nblocks;
+	unsigned char **block;
+	int *fill; /* bytes held from the start of each block */
+	unsigned char *requested;
+	int held;
+	int ahead;
+	int last_end;
+	void *opaque;
+	fz_range_request_fn *request;
+	fz_range_poll_fn *poll;
+	fz_range_close_fn *close;
+} range_state;
+
+static int
+range_block_size(range_state *rs, int b)
+{
+	int size = rs->length - b * RANGE_BLOCK;
+	return size < RANGE_BLOCK ? size : RANGE_BLOCK;
+}
+
+static void
+request_range(fz_context *ctx, range_state *rs, int offset, int len)
+{
+	int b, e, start;
+
+	if (offset < 0)
+	{
+		len += offset;
+		offset = 0;
+	}
+	if (len > rs->length - offset)
+		len = rs->length - offset;
+	if (len <= 0)
+		return;
+
+	b = offset / RANGE_BLOCK;
+	e = (offset + len - 1) / RANGE_BLOCK + 1;
+	while (b < e)
+	{
+		if (rs->requested[b] || rs->fill[b] == range_block_size(rs, b))
+		{
+			b++;
+			continue;
+		}
+		start = b;
+		while (b < e && !rs->requested[b] && rs->fill[b] < range_block_size(rs, b))
+			rs->requested[b++] = 1;
+		offset = start * RANGE_BLOCK + rs->fill[start];
+		len = (b - start) * RANGE_BLOCK;
+		if (len > rs->length - start * RANGE_BLOCK)
+			len = rs->length - start * RANGE_BLOCK;
+		rs->request(ctx, rs->opaque, offset, len - rs->fill[start]);
+	}
+}
+
+static int next_ranged(fz_context *ctx, fz_stream *stm, int len)
+{
+	range_state *rs = (range_state *)stm->state;
+	int b, ofs;
+
+	if (stm->pos >= rs->length)
+		return EOF;
+
+	b = stm->pos / RANGE_BLOCK;
+	ofs = stm->pos - b * RANGE_BLOCK;
+	if (rs->fill[b] <= ofs && rs->poll)
+		rs->poll(ctx, rs->opaque, stm);
+	if (rs->fill[b] <= ofs)
+	{
+		if (!rs->requested[b])
+		{
+			if (b * RANGE_BLOCK == rs->last_end)
+				rs->ahead = fz_mini(rs->ahead * 2, RANGE_AHEAD_MAX);
+			else
+				rs->ahead = RANGE_AHEAD_MIN;
+			rs->last_end = fz_mini(b * RANGE_BLOCK + rs->ahead, rs->length);
+			request_range(ctx, rs, stm->pos, rs->last_end - stm->pos);
+		}
+		show_progress(rs->held, stm->pos);
+		fz_throw(ctx, FZ_ERROR_TRYLATER, "Not enough data yet");
+	}
+
+	stm->rp = rs->block[b] + ofs;
+	stm->wp = rs->block[b] + rs->fill[b];
+	stm->pos += stm->wp - stm->rp;
+	return *stm->rp++;
+}
+
+static void seek_ranged(fz_context *ctx, fz_stream *stm, int offset, int whence)
+{
+	range_state *rs = (range_state *)stm->state;
+
+	if (whence == SEEK_END)
+		offset += rs->length;
+	else if (whence == SEEK_CUR)
+		offset += stm->pos;
+	if (offset < 0)
+		offset = 0;
+	if (offset > rs->length)
+		offset = rs->length;
+	stm->pos = offset;
+	stm->wp = stm->rp;
+}
+
+static void close_ranged(fz_context *ctx, void *state)
+{
+	range_state *rs = (range_state *)state;
+	int b;
+
+	if (rs->close)
+		rs->close(ctx, rs->opaque);
+	for (b = 0; b < rs->nblocks; b++)
+		fz_free(ctx, rs->block[b]);
+	fz_free(ctx, rs->block);
+	fz_free(ctx, rs->fill);
+	fz_free(ctx, rs->requested);
+	fz_free(ctx, rs);
+}
+
+static int meta_ranged(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr)
+{
+	range_state *rs = (range_state *)stm->state;
+	switch(key)
+	{
+	case FZ_STREAM_META_PROGRESSIVE:
+		return 1;
+	case FZ_STREAM_META_LENGTH:
+		return rs->length;
+	case FZ_STREAM_META_WANT:
+		if (size > 0 && ptr)
+			request_range(ctx, rs, *(int *)ptr, size);
+		return 1;
+	}
+	return -1;
+}
+
+fz_stream *
+fz_open_ranged(fz_context *ctx, int length, void *opaque, fz_range_request_fn *request, fz_range_poll_fn *poll, fz_range_close_fn *close)
+{
+	fz_stream *stm;
+	range_state *rs;
+
+	if (length < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "negative length for ranged stream");
+
+	rs = fz_malloc_struct(ctx, range_state);
+	fz_try(ctx)
+	{
+		rs->length = length;
+		rs->nblocks = (length + RANGE_BLOCK - 1) / RANGE_BLOCK;
+		rs->block = fz_calloc(ctx, rs->nblocks, sizeof(*rs->block));
+		rs->fill = fz_calloc(ctx, rs->nblocks, sizeof(*rs->fill));
+		rs->requested = fz_calloc(ctx, rs->nblocks, sizeof(*rs->requested));
+		rs->ahead = RANGE_AHEAD_MIN;
+		rs->last_end = -1;
+		rs->request = request;
+		stm = fz_new_stream(ctx, rs, next_ranged, close_ranged);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, rs->block);
+		fz_free(ctx, rs->fill);
+		fz_free(ctx, rs->requested);
+		fz_free(ctx, rs);
+		fz_rethrow(ctx);
+	}
+	/* Only take ownership of opaque once nothing can fail */
+	rs->opaque = opaque;
+	rs->poll = poll;
+	rs->close = close;
+	stm->seek = seek_ranged;
+	stm->meta = meta_ranged;
+
+	return stm;
+}
+
+void
+fz_range_supply(fz_context *ctx, fz_stream *stm, int offset, const unsigned char *data, int len)
+{
+	range_state *rs;
+
+	if (stm->next != next_ranged)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "not a ranged stream");
+	rs = (range_state *)stm->state;
+
+	if (offset < 0)
+	{
+		data -= offset;
+		len += offset;
+		offset = 0;
+	}
+	if (len > rs->length - offset)
+		len = rs->length - offset;
+
+	while (len > 0)
+	{
+		int b = offset / RANGE_BLOCK;
+		int ofs = offset - b * RANGE_BLOCK;
+		int n = fz_mini(len, range_block_size(rs, b) - ofs);
+
+		/* Only ever append to a block, as the stream may be reading
+		 * from the part that is already held. */
+		if (ofs <= rs->fill[b] && ofs + n > rs->fill[b])
+		{
+			if (!rs->block[b])
+				rs->block[b] = fz_malloc(ctx, range_block_size(rs, b));
+			memcpy(rs->block[b] + rs->fill[b], data + rs->fill[b] - ofs, ofs + n - rs->fill[b]);
+			rs->held += ofs + n - rs->fill[b];
+			rs->fill[b] = ofs + n;
+		}
+
+		offset += n;
+		data += n;
+		len -= n;
+	}
+}
+
+int
+fz_range_missing(fz_context *ctx, fz_stream *stm, int *ranges, int max)
+{
+	range_state *rs;
+	int b, count = 0;
+
+	if (stm->next != next_ranged)
+		return 0;
+	rs = (range_state *)stm->state;
+
+	b = 0;
+	while (b < rs->nblocks)
+	{
+		int start;
+		if (!rs->requested[b] || rs->fill[b] == range_block_size(rs, b))
+		{
+			b++;
+			continue;
+		}
+		start = b;
+		while (b < rs->nblocks && rs->requested[b] && rs->fill[b] < range_block_size(rs, b))
+			b++;
+		if (count < max)
+		{
+			ranges[2 * count] = start * RANGE_BLOCK + rs->fill[start];
+			ranges[2 * count + 1] = fz_mini(b * RANGE_BLOCK, rs->length) - ranges[2 * count];
+		}
+		count++;
+	}
+	return count;
+}
+
+int
+fz_range_fetched(fz_context *ctx, fz_stream *stm)
+{
+	if (stm->next != next_ranged)
+		return 0;
+	return ((range_state *)stm->state)->held;
+}
+
+/* Local file standing in for a range server: requests are queued and
+ * served from the file when the stream polls, at a simulated rate. */
+
+typedef struct range_file_state
+{
+	int fd;
+	int bps;
+	clock_t start_time;
+	int sent;
+	int len;
+	int cap;
+	int *queue; /* offset, length pairs */
+	unsigned char buffer[4096];
+} range_file_state;
+
+static void request_range_file(fz_context *ctx, void *opaque, int offset, int len)
+{
+	range_file_state *fs = (range_file_state *)opaque;
+
+	if (fs->len == fs->cap)
+	{
+		int cap = fs->cap ? fs->cap * 2 : 32;
+		int *queue = fz_resize_array_no_throw(ctx, fs->queue, cap, 2 * sizeof(int));
+		if (!queue)
+			return;
+		fs->queue = queue;
+		fs->cap = cap;
+	}
+	fs->queue[2 * fs->len] = offset;
+	fs->queue[2 * fs->len + 1] = len;
+	fs->len++;
+}
+
+static void poll_range_file(fz_context *ctx, void *opaque, fz_stream *stm)
+{
+	range_file_state *fs = (range_file_state *)opaque;
+	int budget = INT_MAX;
+
+	if (fs->bps > 0)
+		budget = (int)((float)(clock() - fs->start_time) * fs->bps / (CLOCKS_PER_SEC*8)) - fs->sent;
+
+	while (fs->len > 0 && budget > 0)
+	{
+		int n = fz_mini(fz_mini(fs->queue[1], budget), sizeof fs->buffer);
+		if (lseek(fs->fd, fs->queue[0], SEEK_SET) < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot lseek: %s", strerror(errno));
+		n = read(fs->fd, fs->buffer, n);
+		if (n < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "read error: %s", strerror(errno));
+		fz_range_supply(ctx, stm, fs->queue[0], fs->buffer, n);
+		fs->sent += n;
+		budget -= n;
+		fs->queue[0] += n;
+		fs->queue[1] -= n;
+		if (fs->queue[1] == 0 || n == 0)
+		{
+			fs->len--;
+			memmove(fs->queue, fs->queue + 2, fs->len * 2 * sizeof(int));
+		}
+	}
+}
+
+static void close_range_file(fz_context *ctx, void *opaque)
+{
+	range_file_state *fs = (range_file_state *)opaque;
+	int n = close(fs->fd);
+	if (n < 0)
+		fz_warn(ctx, "close error: %s", strerror(errno));
+	fz_free(ctx, fs->queue);
+	fz_free(ctx, fs);
+}
+
+fz_stream *
+fz_open_file_ranged(fz_context *ctx, const char *name, int bps)
+{
+	range_file_state *fs;
+	fz_stream *stm;
+	int fd, length;
+
+	fd = open_prog_fd(ctx, name);
+	length = lseek(fd, 0, SEEK_END);
+
+	fz_try(ctx)
+	{
+		fs = fz_malloc_struct(ctx, range_file_state);
+	}
+	fz_catch(ctx)
+	{
+		close(fd);
+		fz_rethrow(ctx);
+	}
+	fs->fd = fd;
+	fs->bps = bps;
+	fs->start_time = clock();
+
+	fz_try(ctx)
+	{
+		stm = fz_open_ranged(ctx, length, fs, request_range_file, poll_range_file, close_range_file);
+	}
+	fz_catch(ctx)
+	{
+		close_range_file(ctx, fs);
+		fz_rethrow(ctx);
+	}
+	return stm;
 }
@@ -28,7 +28,7 @@ fz_load_html_font(fz_context *ctx, fz_html_font_set *set,
 		data = pdf_lookup_builtin_font(ctx, font_names[idx], &size);
 		if (!data)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot load html font: %s", font_names[idx]);
-		set->fonts[idx] = fz_new_font_from_memory(ctx, font_names[idx], data, size, 0, 1);
+		set->fonts[idx] = fz_new_shared_font_from_memory(ctx, font_names[idx], data, size, 0, 1);
 	}
 
 	return set->fonts[idx];
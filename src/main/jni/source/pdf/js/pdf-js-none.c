@@ -29,3 +29,24 @@ void pdf_js_execute(pdf_js *js, char *code)
 void pdf_js_execute_count(pdf_js *js, char *code, int count)
 {
 }
+
+void pdf_js_execute_obj(pdf_js *js, pdf_obj *code)
+{
+}
+
+int pdf_js_calculate_needed(pdf_js *js, pdf_obj *field)
+{
+	return 1;
+}
+
+void pdf_js_begin_calculate(pdf_js *js)
+{
+}
+
+void pdf_js_end_calculate(pdf_js *js, pdf_obj *field)
+{
+}
+
+void pdf_js_abort_calculate(pdf_js *js, pdf_obj *field)
+{
+}
@@ -3,6 +3,31 @@
 /* TODO: js->doc -> doc */
 /* TODO: js->ctx -> ctx */
 
+typedef struct pdf_js_script_s pdf_js_script;
+typedef struct pdf_js_input_s pdf_js_input;
+typedef struct pdf_js_calc_s pdf_js_calc;
+
+struct pdf_js_script_s
+{
+	pdf_obj *code;
+	pdf_jsimp_script *script; /* NULL if it failed to compile */
+};
+
+/* A field read by a calculation, and the value it had. Both are
+ * kept, so a new value can never turn up at the same address. */
+struct pdf_js_input_s
+{
+	pdf_obj *field;
+	pdf_obj *value;
+};
+
+struct pdf_js_calc_s
+{
+	pdf_obj *field;
+	int len;
+	pdf_js_input *input;
+};
+
 struct pdf_js_s
 {
 	fz_context *ctx;
@@ -14,6 +39,18 @@ struct pdf_js_s
 	pdf_jsimp_type *eventtype;
 	pdf_jsimp_type *fieldtype;
 	pdf_jsimp_type *apptype;
+
+	/* Compiled scripts, keyed on the object holding the source */
+	fz_hash_table *scripts;
+
+	/* Inputs of each calculated field, keyed on the field */
+	fz_hash_table *calcs;
+
+	/* Fields looked up by getField() during a calculation */
+	int tracing;
+	int trace_len;
+	int trace_cap;
+	pdf_obj **trace;
 };
 
 static pdf_jsimp_obj *app_alert(void *jsctx, void *obj, int argc, pdf_jsimp_obj *args[])
@@ -467,6 +504,32 @@ static char *utf8_to_pdf(fz_context *ctx, char *utf8)
 	return pdf;
 }
 
+static void trace_field(pdf_js *js, pdf_obj *field)
+{
+	fz_context *ctx = js->ctx;
+	int i;
+
+	for (i = 0; i < js->trace_len; i++)
+		if (js->trace[i] == field)
+			return;
+
+	fz_try(ctx)
+	{
+		if (js->trace_len == js->trace_cap)
+		{
+			int new_cap = js->trace_cap ? js->trace_cap * 2 : 16;
+			js->trace = fz_resize_array(ctx, js->trace, new_cap, sizeof *js->trace);
+			js->trace_cap = new_cap;
+		}
+		js->trace[js->trace_len++] = field;
+	}
+	fz_catch(ctx)
+	{
+		/* Without a complete list, the calculation must always run */
+		js->tracing = 0;
+	}
+}
+
 static pdf_jsimp_obj *doc_getField(void *jsctx, void *obj, int argc, pdf_jsimp_obj *args[])
 {
 	pdf_js *js = (pdf_js *)jsctx;
@@ -501,6 +564,9 @@ static pdf_jsimp_obj *doc_getField(void *jsctx, void *obj, int argc, pdf_jsimp_o
 		dict = NULL;
 	}
 
+	if (dict && js->tracing)
+		trace_field(js, dict);
+
 	return dict ? pdf_jsimp_new_obj(js->imp, js->fieldtype, dict) : NULL;
 }
 
@@ -774,11 +840,54 @@ static void preload_helpers(pdf_js *js)
 	);
 }
 
+static void drop_calc(fz_context *ctx, pdf_js_calc *calc)
+{
+	int i;
+
+	if (calc)
+	{
+		for (i = 0; i < calc->len; i++)
+		{
+			pdf_drop_obj(ctx, calc->input[i].field);
+			pdf_drop_obj(ctx, calc->input[i].value);
+		}
+		fz_free(ctx, calc->input);
+		pdf_drop_obj(ctx, calc->field);
+		fz_free(ctx, calc);
+	}
+}
+
 static void pdf_drop_js(pdf_js *js)
 {
 	if (js)
 	{
 		fz_context *ctx = js->ctx;
+		int i, n;
+
+		if (js->scripts)
+		{
+			n = fz_hash_len(ctx, js->scripts);
+			for (i = 0; i < n; i++)
+			{
+				pdf_js_script *s = fz_hash_get_val(ctx, js->scripts, i);
+				if (s)
+				{
+					pdf_jsimp_drop_script(js->imp, s->script);
+					pdf_drop_obj(ctx, s->code);
+					fz_free(ctx, s);
+				}
+			}
+			fz_drop_hash(ctx, js->scripts);
+		}
+		if (js->calcs)
+		{
+			n = fz_hash_len(ctx, js->calcs);
+			for (i = 0; i < n; i++)
+				drop_calc(ctx, fz_hash_get_val(ctx, js->calcs, i));
+			fz_drop_hash(ctx, js->calcs);
+		}
+		fz_free(ctx, js->trace);
+
 		fz_free(ctx, js->event.value);
 		pdf_jsimp_drop_type(js->imp, js->apptype);
 		pdf_jsimp_drop_type(js->imp, js->eventtype);
@@ -807,6 +916,9 @@ static pdf_js *pdf_new_js(fz_context *ctx, pdf_document *doc)
 		acroform = pdf_dict_get(ctx, root, PDF_NAME_AcroForm);
 		js->form = pdf_dict_get(ctx, acroform, PDF_NAME_Fields);
 
+		js->scripts = fz_new_hash_table(ctx, 64, sizeof(pdf_obj *), -1);
+		js->calcs = fz_new_hash_table(ctx, 64, sizeof(pdf_obj *), -1);
+
 		/* Initialise the javascript engine, passing the main context
 		 * for use in memory allocation and exception handling. Also
 		 * pass our js context, for it to pass back to us. */
@@ -924,6 +1036,152 @@ void pdf_js_execute_count(pdf_js *js, char *code, int count)
 	}
 }
 
+static pdf_js_script *compile_script(pdf_js *js, pdf_obj *code)
+{
+	fz_context *ctx = js->ctx;
+	pdf_js_script *s = NULL;
+	char *text = NULL;
+
+	fz_var(s);
+	fz_var(text);
+	fz_try(ctx)
+	{
+		s = fz_malloc_struct(ctx, pdf_js_script);
+		text = pdf_to_utf8(ctx, js->doc, code);
+		s->script = pdf_jsimp_compile(js->imp, text);
+		fz_hash_insert(ctx, js->scripts, &code, s);
+		s->code = pdf_keep_obj(ctx, code);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, text);
+	}
+	fz_catch(ctx)
+	{
+		if (s)
+			pdf_jsimp_drop_script(js->imp, s->script);
+		fz_free(ctx, s);
+		fz_rethrow(ctx);
+	}
+
+	return s;
+}
+
+void pdf_js_execute_obj(pdf_js *js, pdf_obj *code)
+{
+	if (js && code)
+	{
+		fz_context *ctx = js->ctx;
+		fz_try(ctx)
+		{
+			pdf_js_script *s = fz_hash_find(ctx, js->scripts, &code);
+			if (!s)
+				s = compile_script(js, code);
+			if (s->script)
+				pdf_jsimp_run(js->imp, s->script);
+		}
+		fz_catch(ctx)
+		{
+			/* A calculation that did not finish may not have
+			 * looked up all of its inputs */
+			js->tracing = 0;
+		}
+	}
+}
+
+int pdf_js_calculate_needed(pdf_js *js, pdf_obj *field)
+{
+	fz_context *ctx;
+	pdf_js_calc *calc;
+	int i;
+
+	if (!js)
+		return 1;
+
+	ctx = js->ctx;
+	calc = fz_hash_find(ctx, js->calcs, &field);
+	if (!calc)
+		return 1;
+
+	for (i = 0; i < calc->len; i++)
+		if (pdf_get_inheritable(ctx, js->doc, calc->input[i].field, PDF_NAME_V) != calc->input[i].value)
+			return 1;
+
+	return 0;
+}
+
+void pdf_js_begin_calculate(pdf_js *js)
+{
+	if (js)
+	{
+		js->tracing = 1;
+		js->trace_len = 0;
+	}
+}
+
+static void forget_calc(pdf_js *js, pdf_obj *field)
+{
+	fz_context *ctx = js->ctx;
+	pdf_js_calc *calc = fz_hash_find(ctx, js->calcs, &field);
+
+	if (calc)
+	{
+		fz_hash_remove(ctx, js->calcs, &field);
+		drop_calc(ctx, calc);
+	}
+}
+
+void pdf_js_end_calculate(pdf_js *js, pdf_obj *field)
+{
+	fz_context *ctx;
+	pdf_js_calc *calc = NULL;
+	int i;
+
+	if (!js)
+		return;
+
+	ctx = js->ctx;
+
+	/* Forget what we knew; if the trace is incomplete, that is all */
+	forget_calc(js, field);
+	if (!js->tracing)
+		return;
+	js->tracing = 0;
+
+	fz_var(calc);
+	fz_try(ctx)
+	{
+		calc = fz_malloc_struct(ctx, pdf_js_calc);
+		calc->input = fz_malloc_array(ctx, js->trace_len + 1, sizeof *calc->input);
+		calc->field = pdf_keep_obj(ctx, field);
+
+		/* The field's own value counts too, so that typing over
+		 * a calculated value gets it calculated again. */
+		for (i = 0; i <= js->trace_len; i++)
+		{
+			pdf_obj *f = (i < js->trace_len) ? js->trace[i] : field;
+			calc->input[i].field = pdf_keep_obj(ctx, f);
+			calc->input[i].value = pdf_keep_obj(ctx, pdf_get_inheritable(ctx, js->doc, f, PDF_NAME_V));
+			calc->len++;
+		}
+
+		fz_hash_insert(ctx, js->calcs, &field, calc);
+	}
+	fz_catch(ctx)
+	{
+		drop_calc(ctx, calc);
+	}
+}
+
+void pdf_js_abort_calculate(pdf_js *js, pdf_obj *field)
+{
+	if (js)
+	{
+		js->tracing = 0;
+		forget_calc(js, field);
+	}
+}
+
 void pdf_enable_js(fz_context *ctx, pdf_document *doc)
 {
 	if (!doc->js) {
@@ -174,6 +174,23 @@ void pdf_jsimp_execute_count(pdf_jsimp *imp, char *code, int count)
 	if (err != NULL)
 		fz_throw(pdf_jsimp_ctx_cpp(imp), FZ_ERROR_GENERIC, "%s", err);
 }
+
+/* Scripts are kept as source and evaluated afresh each time */
+pdf_jsimp_script *pdf_jsimp_compile(pdf_jsimp *imp, char *code)
+{
+	return (pdf_jsimp_script *)fz_strdup(pdf_jsimp_ctx_cpp(imp), code);
+}
+
+void pdf_jsimp_run(pdf_jsimp *imp, pdf_jsimp_script *script)
+{
+	pdf_jsimp_execute(imp, (char *)script);
+}
+
+void pdf_jsimp_drop_script(pdf_jsimp *imp, pdf_jsimp_script *script)
+{
+	if (imp)
+		fz_free(pdf_jsimp_ctx_cpp(imp), script);
+}
 pdf_jsimp_obj *pdf_jsimp_call_method(pdf_jsimp *imp, pdf_jsimp_method *meth, void *jsctx, void *obj, int argc, pdf_jsimp_obj *args[])
 {
 	fz_context *ctx = pdf_jsimp_ctx_cpp(imp);
@@ -516,3 +516,20 @@ void pdf_jsimp_execute_count(pdf_jsimp *imp, char *code, int count)
 	pdf_jsimp_execute(imp, terminated);
 	fz_free(imp->ctx, terminated);
 }
+
+/* Scripts are kept as source and evaluated afresh each time */
+pdf_jsimp_script *pdf_jsimp_compile(pdf_jsimp *imp, char *code)
+{
+	return (pdf_jsimp_script *)fz_strdup(imp->ctx, code);
+}
+
+void pdf_jsimp_run(pdf_jsimp *imp, pdf_jsimp_script *script)
+{
+	pdf_jsimp_execute(imp, (char *)script);
+}
+
+void pdf_jsimp_drop_script(pdf_jsimp *imp, pdf_jsimp_script *script)
+{
+	if (imp)
+		fz_free(imp->ctx, script);
+}
@@ -15,6 +15,8 @@ struct pdf_jsimp_s
 	js_State *J;
 };
 
+/* mujs raises its own out of memory error when this returns NULL; an
+ * fz_throw would jump straight past its error handling. */
 static void *alloc(void *ud, void *ptr, unsigned int n)
 {
 	fz_context *ctx = ud;
@@ -23,8 +25,8 @@ static void *alloc(void *ud, void *ptr, unsigned int n)
 		return NULL;
 	}
 	if (ptr)
-		return fz_resize_array(ctx, ptr, n, 1);
-	return fz_malloc_array(ctx, n, 1);
+		return fz_resize_array_no_throw(ctx, ptr, n, 1);
+	return fz_malloc_array_no_throw(ctx, n, 1);
 }
 
 pdf_jsimp *pdf_new_jsimp(fz_context *ctx, void *jsctx)
@@ -316,3 +318,36 @@ void pdf_jsimp_execute_count(pdf_jsimp *imp, char *code, int count)
 	pdf_jsimp_execute(imp, terminated);
 	fz_free(imp->ctx, terminated);
 }
+
+/* A compiled script is the registry reference to its function object */
+pdf_jsimp_script *pdf_jsimp_compile(pdf_jsimp *imp, char *code)
+{
+	js_State *J = imp->J;
+	if (js_ploadstring(J, "[string]", code))
+	{
+		fprintf(stderr, "%s\n", js_tostring(J, -1));
+		js_pop(J, 1);
+		return NULL;
+	}
+	return (pdf_jsimp_script *)js_ref(J);
+}
+
+void pdf_jsimp_run(pdf_jsimp *imp, pdf_jsimp_script *script)
+{
+	js_State *J = imp->J;
+	js_getregistry(J, (const char *)script);
+	js_pushglobal(J);
+	if (js_pcall(J, 0))
+	{
+		fprintf(stderr, "%s\n", js_tostring(J, -1));
+		js_pop(J, 1);
+		fz_throw(imp->ctx, FZ_ERROR_GENERIC, "script failed");
+	}
+	js_pop(J, 1);
+}
+
+void pdf_jsimp_drop_script(pdf_jsimp *imp, pdf_jsimp_script *script)
+{
+	if (imp && script)
+		js_unref(imp->J, (const char *)script);
+}
@@ -188,7 +188,7 @@ pdf_load_builtin_font(fz_context *ctx, pdf_font_desc *fontdesc, char *fontname,
 		if (!data)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find builtin font: '%s'", fontname);
 
-		fontdesc->font = fz_new_font_from_memory(ctx, fontname, data, len, 0, 1);
+		fontdesc->font = fz_new_shared_font_from_memory(ctx, clean_name, data, len, 0, 1);
 	}
 
 	if (!strcmp(clean_name, "Symbol") || !strcmp(clean_name, "ZapfDingbats"))
@@ -513,6 +513,12 @@ pdf_load_simple_font_by_name(fz_context *ctx, pdf_document *doc, pdf_obj *dict,
 			}
 		}
 
+		/* Built-in fonts are shared between documents and threads, so
+		 * hold the lock from selecting the charmap until the builtin
+		 * encoding has been read through it. */
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		has_lock = 1;
+
 		if (cmap)
 		{
 			fterr = FT_Set_Charmap(face, cmap);
@@ -569,9 +575,6 @@ pdf_load_simple_font_by_name(fz_context *ctx, pdf_document *doc, pdf_obj *dict,
 		for (i = 0; i < 256; i++)
 			etable[i] = ft_char_index(face, i);
 
-		fz_lock(ctx, FZ_LOCK_FREETYPE);
-		has_lock = 1;
-
 		/* built-in and substitute fonts may be a different type than what the document expects */
 		subtype = pdf_dict_get(ctx, dict, PDF_NAME_Subtype);
 		if (pdf_name_eq(ctx, subtype, PDF_NAME_Type1))
@@ -811,6 +814,7 @@ static fz_store_type hail_mary_store_type =
 	hail_mary_keep_key,
 	hail_mary_drop_key,
 	hail_mary_cmp_key,
+	FZ_STORE_TIER_RESOURCES,
 #ifndef NDEBUG
 	hail_mary_debug_key
 #endif
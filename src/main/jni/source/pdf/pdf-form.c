@@ -339,21 +339,7 @@ static void execute_action(fz_context *ctx, pdf_document *doc, pdf_obj *obj, pdf
 		{
 			pdf_obj *js = pdf_dict_get(ctx, a, PDF_NAME_JS);
 			if (js)
-			{
-				char *code = pdf_to_utf8(ctx, doc, js);
-				fz_try(ctx)
-				{
-					pdf_js_execute(doc->js, code);
-				}
-				fz_always(ctx)
-				{
-					fz_free(ctx, code);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow(ctx);
-				}
-			}
+				pdf_js_execute_obj(doc->js, js);
 		}
 		else if (pdf_name_eq(ctx, type, PDF_NAME_ResetForm))
 		{
@@ -439,6 +425,10 @@ static void set_check_grp(fz_context *ctx, pdf_document *doc, pdf_obj *grp, pdf_
 	}
 }
 
+/* Calculations are run in the order given by /CO, but only those
+ * whose inputs (the fields their scripts looked up with getField the
+ * last time they ran) have changed, so an edit only recalculates the
+ * fields downstream of it. */
 static void recalculate(fz_context *ctx, pdf_document *doc)
 {
 	if (doc->recalculating)
@@ -458,17 +448,37 @@ static void recalculate(fz_context *ctx, pdf_document *doc)
 				pdf_obj *field = pdf_array_get(ctx, co, i);
 				pdf_obj *calc = pdf_dict_getp(ctx, field, "AA/C");
 
-				if (calc)
+				if (calc && pdf_js_calculate_needed(doc->js, field))
 				{
 					pdf_js_event e;
+					char *value;
 
 					e.target = field;
 					e.value = pdf_field_value(ctx, doc, field);
-					pdf_js_setup_event(doc->js, &e);
-					execute_action(ctx, doc, field, calc);
-					/* A calculate action, updates event.value. We need
-					* to place the value in the field */
-					update_field_value(ctx, doc, field, pdf_js_get_event(doc->js)->value);
+					fz_try(ctx)
+					{
+						pdf_js_setup_event(doc->js, &e);
+						pdf_js_begin_calculate(doc->js);
+						execute_action(ctx, doc, field, calc);
+						/* A calculate action, updates event.value. We need
+						* to place the value in the field. Leave it alone if
+						* unchanged, or the fields using it would look changed. */
+						value = pdf_js_get_event(doc->js)->value;
+						if (!value)
+							value = "";
+						if (!e.value || strcmp(e.value, value))
+							update_field_value(ctx, doc, field, value);
+						pdf_js_end_calculate(doc->js, field);
+					}
+					fz_always(ctx)
+					{
+						fz_free(ctx, e.value);
+					}
+					fz_catch(ctx)
+					{
+						pdf_js_abort_calculate(doc->js, field);
+						fz_rethrow(ctx);
+					}
 				}
 			}
 		}
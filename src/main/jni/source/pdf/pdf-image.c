@@ -206,11 +206,15 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 {
 	fz_buffer *buf = NULL;
 	fz_colorspace *colorspace = NULL;
+	fz_colorspace *cspace;
+	fz_compressed_buffer *bc;
 	fz_pixmap *pix = NULL;
 	pdf_obj *obj;
 	int indexed = 0;
 	fz_image *mask = NULL;
 	fz_image *img = NULL;
+	float decode[FZ_MAX_COLORS * 2];
+	int w, h, xres, yres, i;
 
 	fz_var(pix);
 	fz_var(buf);
@@ -229,7 +233,18 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 			indexed = fz_colorspace_is_indexed(ctx, colorspace);
 		}
 
-		pix = fz_load_jpx(ctx, buf->data, buf->len, colorspace, indexed);
+		/* Ordinary images are only decoded when drawn, so that they
+		 * can be decoded at the resolution they are drawn at. */
+		cspace = NULL;
+		if (!forcemask && !indexed)
+		{
+			fz_load_jpx_info(ctx, buf->data, buf->len, &w, &h, &xres, &yres, &cspace);
+			if (colorspace && colorspace->n != cspace->n)
+				cspace = NULL;
+		}
+
+		if (!cspace)
+			pix = fz_load_jpx(ctx, buf->data, buf->len, colorspace, indexed);
 
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME_SMask, PDF_NAME_Mask);
 		if (pdf_is_dict(ctx, obj))
@@ -240,19 +255,39 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 				mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
 		}
 
+		if (cspace)
+		{
+			if (!colorspace)
+				colorspace = fz_keep_colorspace(ctx, cspace);
+
+			obj = pdf_dict_geta(ctx, dict, PDF_NAME_Decode, PDF_NAME_D);
+			for (i = 0; i < colorspace->n * 2; i++)
+				decode[i] = obj ? pdf_to_real(ctx, pdf_array_get(ctx, obj, i)) : i & 1;
+
+			bc = fz_malloc_struct(ctx, fz_compressed_buffer);
+			bc->buffer = fz_keep_buffer(ctx, buf);
+			bc->params.type = FZ_IMAGE_JPX;
+			bc->params.u.jpx.smask_in_data = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_SMaskInData));
+
+			img = fz_new_image(ctx, w, h, 8, colorspace, xres, yres, 0, 0, decode, NULL, bc, NULL);
+			colorspace = NULL;
+			img->mask = mask;
+			mask = NULL;
+			break; /* Out of fz_try */
+		}
+
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME_Decode, PDF_NAME_D);
 		if (obj && !indexed)
 		{
-			float decode[FZ_MAX_COLORS * 2];
-			int i;
-
 			for (i = 0; i < pix->n * 2; i++)
 				decode[i] = pdf_to_real(ctx, pdf_array_get(ctx, obj, i));
 
 			fz_decode_tile(ctx, pix, decode);
 		}
 
-		img = fz_new_image_from_pixmap(ctx, pix, mask);
+		img = fz_new_image_from_pixmap(ctx, pix, NULL);
+		img->mask = mask;
+		mask = NULL;
 	}
 	fz_always(ctx)
 	{
@@ -262,6 +297,7 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 	}
 	fz_catch(ctx)
 	{
+		fz_drop_image(ctx, mask);
 		fz_rethrow(ctx);
 	}
 
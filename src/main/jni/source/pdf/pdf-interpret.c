@@ -40,6 +40,474 @@ pdf_clear_stack(fz_context *ctx, pdf_csi *csi)
 	csi->top = 0;
 }
 
+/*
+	Tokenized content streams.
+
+	The first time a content stream is interpreted, every token the
+	interpreter pulls out of the lexer is recorded, together with the
+	arrays, dictionaries and inline images that were parsed from it.
+	If the stream is processed to the end without needing data that
+	is not yet available, the recording is put into the store keyed
+	on the stream object. Later passes over the same stream replay the
+	recording through the same interpreter loop instead of lexing the
+	bytes again, so any processor sees exactly the same operators.
+*/
+
+enum
+{
+	PDF_CACHED_OBJ = PDF_NUM_TOKENS,
+	PDF_CACHED_IMAGE,
+	PDF_CACHED_ERROR
+};
+
+typedef struct pdf_cached_token_s pdf_cached_token;
+
+struct pdf_cached_token_s
+{
+	unsigned char tok;
+	int len; /* length of name/string, or the opcode for keywords */
+	union
+	{
+		int i;
+		float f;
+		int ofs;
+	} u;
+};
+
+struct pdf_content_tokens_s
+{
+	fz_storable storable;
+	unsigned int size;
+
+	int len, cap;
+	pdf_cached_token *tokens;
+
+	int pool_len, pool_cap;
+	char *pool;
+
+	int obj_len, obj_cap;
+	pdf_obj **objs;
+
+	int image_len, image_cap;
+	fz_image **images;
+
+	/* Inline images depend on the resources they were loaded with */
+	pdf_obj *rdb;
+
+	/* Streams held by an indirect array of contents */
+	int part_len;
+	int *parts;
+};
+
+static void
+pdf_drop_content_tokens_imp(fz_context *ctx, fz_storable *tokens_)
+{
+	pdf_content_tokens *tokens = (pdf_content_tokens *)tokens_;
+	int i;
+
+	for (i = 0; i < tokens->obj_len; i++)
+		pdf_drop_obj(ctx, tokens->objs[i]);
+	for (i = 0; i < tokens->image_len; i++)
+		fz_drop_image(ctx, tokens->images[i]);
+	pdf_drop_obj(ctx, tokens->rdb);
+	fz_free(ctx, tokens->tokens);
+	fz_free(ctx, tokens->pool);
+	fz_free(ctx, tokens->objs);
+	fz_free(ctx, tokens->images);
+	fz_free(ctx, tokens->parts);
+	fz_free(ctx, tokens);
+}
+
+static void
+pdf_drop_content_tokens(fz_context *ctx, pdf_content_tokens *tokens)
+{
+	if (tokens)
+		fz_drop_storable(ctx, &tokens->storable);
+}
+
+static pdf_content_tokens *
+pdf_new_content_tokens(fz_context *ctx)
+{
+	pdf_content_tokens *tokens = fz_malloc_struct(ctx, pdf_content_tokens);
+	FZ_INIT_STORABLE(tokens, 1, pdf_drop_content_tokens_imp);
+	tokens->size = sizeof *tokens;
+	return tokens;
+}
+
+static int
+pdf_keyword_opcode(const char *word)
+{
+	int key = word[0];
+	if (word[0] && word[1])
+	{
+		key |= word[1] << 8;
+		if (word[2])
+		{
+			key |= word[2] << 16;
+			if (word[3])
+				key = 0;
+		}
+	}
+	return key;
+}
+
+static pdf_cached_token *
+pdf_push_cached_token(fz_context *ctx, pdf_content_tokens *tokens, int tok)
+{
+	pdf_cached_token *t;
+	if (tokens->len == tokens->cap)
+	{
+		int cap = tokens->cap ? tokens->cap * 2 : 256;
+		tokens->tokens = fz_resize_array(ctx, tokens->tokens, cap, sizeof *tokens->tokens);
+		tokens->size += (cap - tokens->cap) * sizeof *tokens->tokens;
+		tokens->cap = cap;
+	}
+	t = &tokens->tokens[tokens->len++];
+	t->tok = tok;
+	t->len = 0;
+	t->u.i = 0;
+	return t;
+}
+
+static int
+pdf_push_cached_bytes(fz_context *ctx, pdf_content_tokens *tokens, const char *s, int len)
+{
+	int ofs = tokens->pool_len;
+	if (tokens->pool_len + len + 1 > tokens->pool_cap)
+	{
+		int cap = tokens->pool_cap ? tokens->pool_cap : 1024;
+		while (tokens->pool_len + len + 1 > cap)
+			cap *= 2;
+		tokens->pool = fz_resize_array(ctx, tokens->pool, cap, 1);
+		tokens->size += cap - tokens->pool_cap;
+		tokens->pool_cap = cap;
+	}
+	memcpy(tokens->pool + ofs, s, len);
+	tokens->pool[ofs + len] = 0;
+	tokens->pool_len += len + 1;
+	return ofs;
+}
+
+/* Recording never throws; on failure the recording is abandoned. */
+static void
+pdf_abandon_recording(fz_context *ctx, pdf_csi *csi)
+{
+	pdf_drop_content_tokens(ctx, csi->record);
+	csi->record = NULL;
+}
+
+static void
+pdf_record_token(fz_context *ctx, pdf_csi *csi, pdf_token tok, pdf_lexbuf *buf)
+{
+	pdf_content_tokens *tokens = csi->record;
+	pdf_cached_token *t;
+
+	if (!tokens)
+		return;
+
+	fz_try(ctx)
+	{
+		t = pdf_push_cached_token(ctx, tokens, tok);
+		switch (tok)
+		{
+		case PDF_TOK_INT:
+			t->u.i = buf->i;
+			break;
+		case PDF_TOK_REAL:
+			t->u.f = buf->f;
+			break;
+		case PDF_TOK_STRING:
+		case PDF_TOK_NAME:
+			t->len = buf->len;
+			t->u.ofs = pdf_push_cached_bytes(ctx, tokens, buf->scratch, buf->len);
+			break;
+		case PDF_TOK_KEYWORD:
+			t->len = csi->opcode;
+			t->u.ofs = pdf_push_cached_bytes(ctx, tokens, buf->scratch, strlen(buf->scratch));
+			break;
+		case PDF_TOK_R: case PDF_TOK_TRUE: case PDF_TOK_FALSE: case PDF_TOK_NULL:
+		case PDF_TOK_OBJ: case PDF_TOK_ENDOBJ: case PDF_TOK_STREAM:
+		case PDF_TOK_XREF: case PDF_TOK_TRAILER: case PDF_TOK_STARTXREF:
+			t->len = buf->len;
+			t->u.ofs = pdf_push_cached_bytes(ctx, tokens, buf->scratch, buf->len);
+			break;
+		default:
+			break;
+		}
+	}
+	fz_catch(ctx)
+		pdf_abandon_recording(ctx, csi);
+}
+
+static void
+pdf_record_obj(fz_context *ctx, pdf_csi *csi, pdf_obj *obj)
+{
+	pdf_content_tokens *tokens = csi->record;
+
+	if (!tokens)
+		return;
+
+	fz_try(ctx)
+	{
+		if (tokens->obj_len == tokens->obj_cap)
+		{
+			int cap = tokens->obj_cap ? tokens->obj_cap * 2 : 16;
+			tokens->objs = fz_resize_array(ctx, tokens->objs, cap, sizeof *tokens->objs);
+			tokens->obj_cap = cap;
+		}
+		pdf_push_cached_token(ctx, tokens, PDF_CACHED_OBJ)->u.i = tokens->obj_len;
+		tokens->objs[tokens->obj_len++] = pdf_keep_obj(ctx, obj);
+		/* A rough estimate; objects don't know their own size */
+		tokens->size += sizeof(pdf_obj *) + 16 * (1 + pdf_array_len(ctx, obj) + 2 * pdf_dict_len(ctx, obj));
+	}
+	fz_catch(ctx)
+		pdf_abandon_recording(ctx, csi);
+}
+
+static void
+pdf_record_image(fz_context *ctx, pdf_csi *csi, fz_image *img)
+{
+	pdf_content_tokens *tokens = csi->record;
+
+	if (!tokens)
+		return;
+
+	fz_try(ctx)
+	{
+		if (tokens->image_len == tokens->image_cap)
+		{
+			int cap = tokens->image_cap ? tokens->image_cap * 2 : 4;
+			tokens->images = fz_resize_array(ctx, tokens->images, cap, sizeof *tokens->images);
+			tokens->image_cap = cap;
+		}
+		pdf_push_cached_token(ctx, tokens, PDF_CACHED_IMAGE)->u.i = tokens->image_len;
+		tokens->images[tokens->image_len++] = fz_keep_image(ctx, img);
+		tokens->size += sizeof(fz_image *) + sizeof(fz_image);
+		if (img->buffer)
+			tokens->size += fz_compressed_buffer_size(img->buffer);
+		if (img->tile)
+			tokens->size += fz_pixmap_size(ctx, img->tile);
+		if (!tokens->rdb)
+			tokens->rdb = pdf_keep_obj(ctx, csi->rdb);
+	}
+	fz_catch(ctx)
+		pdf_abandon_recording(ctx, csi);
+}
+
+static void
+pdf_record_error(fz_context *ctx, pdf_csi *csi)
+{
+	if (!csi->record)
+		return;
+	fz_try(ctx)
+		pdf_push_cached_token(ctx, csi->record, PDF_CACHED_ERROR);
+	fz_catch(ctx)
+		pdf_abandon_recording(ctx, csi);
+}
+
+static pdf_cached_token *
+pdf_next_cached_token(fz_context *ctx, pdf_csi *csi)
+{
+	pdf_content_tokens *tokens = csi->replay;
+	if (csi->replay_pos >= tokens->len)
+		return NULL;
+	return &tokens->tokens[csi->replay_pos++];
+}
+
+static pdf_token
+pdf_replay_token(fz_context *ctx, pdf_csi *csi, pdf_lexbuf *buf)
+{
+	pdf_cached_token *t = pdf_next_cached_token(ctx, csi);
+	int len;
+
+	if (!t)
+		return PDF_TOK_EOF;
+
+	switch (t->tok)
+	{
+	case PDF_TOK_INT:
+		buf->i = t->u.i;
+		break;
+	case PDF_TOK_REAL:
+		buf->f = t->u.f;
+		break;
+	case PDF_TOK_KEYWORD:
+		csi->opcode = t->len;
+		len = strlen(csi->replay->pool + t->u.ofs);
+		while (len >= buf->size)
+			pdf_lexbuf_grow(ctx, buf);
+		memcpy(buf->scratch, csi->replay->pool + t->u.ofs, len + 1);
+		buf->len = len;
+		break;
+	case PDF_TOK_STRING:
+	case PDF_TOK_NAME:
+	case PDF_TOK_R: case PDF_TOK_TRUE: case PDF_TOK_FALSE: case PDF_TOK_NULL:
+	case PDF_TOK_OBJ: case PDF_TOK_ENDOBJ: case PDF_TOK_STREAM:
+	case PDF_TOK_XREF: case PDF_TOK_TRAILER: case PDF_TOK_STARTXREF:
+		while (t->len >= buf->size)
+			pdf_lexbuf_grow(ctx, buf);
+		memcpy(buf->scratch, csi->replay->pool + t->u.ofs, t->len + 1);
+		buf->len = t->len;
+		break;
+	case PDF_CACHED_ERROR:
+		fz_throw(ctx, FZ_ERROR_GENERIC, "syntax error in content stream");
+	case PDF_CACHED_OBJ:
+	case PDF_CACHED_IMAGE:
+		/* Cannot happen unless the recording is out of step */
+		fz_throw(ctx, FZ_ERROR_GENERIC, "content stream cache out of step");
+	default:
+		break;
+	}
+
+	return t->tok;
+}
+
+static pdf_token
+pdf_csi_lex(fz_context *ctx, pdf_csi *csi, fz_stream *stm, pdf_lexbuf *buf)
+{
+	pdf_token tok;
+
+	if (csi->replay)
+		return pdf_replay_token(ctx, csi, buf);
+
+	csi->lexing = 1;
+	tok = pdf_lex(ctx, stm, buf);
+	csi->lexing = 0;
+	if (tok == PDF_TOK_KEYWORD)
+		csi->opcode = pdf_keyword_opcode(buf->scratch);
+	pdf_record_token(ctx, csi, tok, buf);
+	return tok;
+}
+
+static pdf_obj *
+pdf_replay_obj(fz_context *ctx, pdf_csi *csi)
+{
+	pdf_cached_token *t = pdf_next_cached_token(ctx, csi);
+	if (!t || t->tok != PDF_CACHED_OBJ)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "syntax error in content stream");
+	return pdf_keep_obj(ctx, csi->replay->objs[t->u.i]);
+}
+
+static pdf_obj *
+pdf_csi_parse_array(fz_context *ctx, pdf_csi *csi, fz_stream *stm, pdf_lexbuf *buf)
+{
+	pdf_obj *obj;
+
+	if (csi->replay)
+		return pdf_replay_obj(ctx, csi);
+
+	csi->lexing = 1;
+	obj = pdf_parse_array(ctx, csi->doc, stm, buf);
+	csi->lexing = 0;
+	pdf_record_obj(ctx, csi, obj);
+	return obj;
+}
+
+static pdf_obj *
+pdf_csi_parse_dict(fz_context *ctx, pdf_csi *csi, fz_stream *stm, pdf_lexbuf *buf)
+{
+	pdf_obj *obj;
+
+	if (csi->replay)
+		return pdf_replay_obj(ctx, csi);
+
+	csi->lexing = 1;
+	obj = pdf_parse_dict(ctx, csi->doc, stm, buf);
+	csi->lexing = 0;
+	pdf_record_obj(ctx, csi, obj);
+	return obj;
+}
+
+/* An indirect key only names the array when the contents are an indirect
+ * array of streams, so remember the streams it held for eviction. The
+ * store filter runs under the store lock and cannot resolve the key. */
+static void
+pdf_record_content_parts(fz_context *ctx, pdf_content_tokens *tokens, pdf_obj *stmobj)
+{
+	pdf_obj *arr;
+	int i, n;
+
+	if (!pdf_is_indirect(ctx, stmobj))
+		return;
+	arr = pdf_resolve_indirect(ctx, stmobj);
+	if (!pdf_is_array(ctx, arr))
+		return;
+
+	n = pdf_array_len(ctx, arr);
+	tokens->parts = fz_malloc_array(ctx, n, sizeof *tokens->parts);
+	tokens->size += n * sizeof *tokens->parts;
+	for (i = 0; i < n; i++)
+	{
+		pdf_obj *item = pdf_array_get(ctx, arr, i);
+		if (pdf_is_indirect(ctx, item))
+			tokens->parts[tokens->part_len++] = pdf_to_num(ctx, item);
+	}
+}
+
+static int
+pdf_content_tokens_depend_on(fz_context *ctx, pdf_document *doc, int num, pdf_obj *key, pdf_content_tokens *tokens)
+{
+	int i, n;
+
+	if (pdf_is_indirect(ctx, key))
+	{
+		if (pdf_get_indirect_document(ctx, key) != doc)
+			return 0;
+		if (pdf_to_num(ctx, key) == num)
+			return 1;
+		for (i = 0; i < tokens->part_len; i++)
+			if (tokens->parts[i] == num)
+				return 1;
+		return 0;
+	}
+
+	n = pdf_array_len(ctx, key);
+	for (i = 0; i < n; i++)
+	{
+		pdf_obj *item = pdf_array_get(ctx, key, i);
+		if (pdf_is_indirect(ctx, item) && pdf_to_num(ctx, item) == num && pdf_get_indirect_document(ctx, item) == doc)
+			return 1;
+	}
+	return 0;
+}
+
+typedef struct
+{
+	pdf_document *doc;
+	int num;
+} pdf_forget_tokens_arg;
+
+static int
+pdf_forget_tokens_filter(fz_context *ctx, void *arg_, void *key, fz_storable *val)
+{
+	pdf_forget_tokens_arg *arg = (pdf_forget_tokens_arg *)arg_;
+	return pdf_content_tokens_depend_on(ctx, arg->doc, arg->num, (pdf_obj *)key, (pdf_content_tokens *)val);
+}
+
+void
+pdf_forget_content_tokens(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_forget_tokens_arg arg;
+	arg.doc = doc;
+	arg.num = num;
+	pdf_filter_store(ctx, pdf_drop_content_tokens_imp, pdf_forget_tokens_filter, &arg);
+}
+
+static pdf_content_tokens *
+pdf_find_content_tokens(fz_context *ctx, pdf_obj *stmobj, pdf_obj *rdb)
+{
+	pdf_content_tokens *tokens = pdf_find_item(ctx, pdf_drop_content_tokens_imp, stmobj);
+
+	/* Inline images were loaded using the resources in force at the
+	 * time; only reuse them if we are using the same ones now. */
+	if (tokens && tokens->rdb && pdf_objcmp(ctx, tokens->rdb, rdb))
+	{
+		pdf_drop_content_tokens(ctx, tokens);
+		tokens = NULL;
+	}
+	return tokens;
+}
+
 static pdf_font_desc *
 load_font_or_hail_mary(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *font, int depth, fz_cookie *cookie)
 {
@@ -339,6 +807,27 @@ parse_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm)
 	return img;
 }
 
+static fz_image *
+pdf_csi_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm)
+{
+	pdf_cached_token *t;
+	fz_image *img;
+
+	if (csi->replay)
+	{
+		t = pdf_next_cached_token(ctx, csi);
+		if (!t || t->tok != PDF_CACHED_IMAGE)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "syntax error after inline image");
+		return fz_keep_image(ctx, csi->replay->images[t->u.i]);
+	}
+
+	csi->lexing = 1;
+	img = parse_inline_image(ctx, csi, stm);
+	csi->lexing = 0;
+	pdf_record_image(ctx, csi, img);
+	return img;
+}
+
 static void
 pdf_process_extgstate(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_obj *dict)
 {
@@ -751,22 +1240,9 @@ pdf_process_end(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 #define C(a,b,c) (a | b << 8 | c << 16)
 
 static int
-pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, char *word)
+pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, int key, char *word)
 {
 	float *s = csi->stack;
-	int key;
-
-	key = word[0];
-	if (word[1])
-	{
-		key |= word[1] << 8;
-		if (word[2])
-		{
-			key |= word[2] << 16;
-			if (word[3])
-				key = 0;
-		}
-	}
 
 	switch (key)
 	{
@@ -925,7 +1401,7 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	/* shadings, images, xobjects */
 	case B('B','I'):
 		{
-			fz_image *img = parse_inline_image(ctx, csi, stm);
+			fz_image *img = pdf_csi_inline_image(ctx, csi, stm);
 			fz_try(ctx)
 			{
 				if (proc->op_BI)
@@ -1010,13 +1486,15 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 				{
 					if (cookie->abort)
 					{
+						/* An incomplete recording is no use to anyone */
+						pdf_abandon_recording(ctx, csi);
 						tok = PDF_TOK_EOF;
 						break;
 					}
 					cookie->progress++;
 				}
 
-				tok = pdf_lex(ctx, stm, buf);
+				tok = pdf_csi_lex(ctx, csi, stm, buf);
 
 				if (in_text_array)
 				{
@@ -1047,7 +1525,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 								{
 									csi->stack[0] = pdf_to_real(ctx, o);
 									pdf_array_delete(ctx, csi->obj, l-1);
-									if (pdf_process_keyword(ctx, proc, csi, stm, buf->scratch) == 0)
+									if (pdf_process_keyword(ctx, proc, csi, stm, csi->opcode, buf->scratch) == 0)
 										break;
 								}
 							}
@@ -1077,7 +1555,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					}
 					else
 					{
-						csi->obj = pdf_parse_array(ctx, doc, stm, buf);
+						csi->obj = pdf_csi_parse_array(ctx, csi, stm, buf);
 					}
 					break;
 
@@ -1087,7 +1565,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 						pdf_drop_obj(ctx, csi->obj);
 						csi->obj = NULL;
 					}
-					csi->obj = pdf_parse_dict(ctx, doc, stm, buf);
+					csi->obj = pdf_csi_parse_dict(ctx, csi, stm, buf);
 					break;
 
 				case PDF_TOK_NAME:
@@ -1137,7 +1615,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					break;
 
 				case PDF_TOK_KEYWORD:
-					if (pdf_process_keyword(ctx, proc, csi, stm, buf->scratch))
+					if (pdf_process_keyword(ctx, proc, csi, stm, csi->opcode, buf->scratch))
 					{
 						tok = PDF_TOK_EOF;
 					}
@@ -1156,13 +1634,23 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 		}
 		fz_catch(ctx)
 		{
-			int caught;
+			int caught = fz_caught(ctx);
+
+			if (caught == FZ_ERROR_TRYLATER || caught == FZ_ERROR_ABORT)
+				pdf_abandon_recording(ctx, csi);
+			else if (csi->lexing)
+			{
+				/* Lexing/parsing failed part way; replay must
+				 * fail at the same point. */
+				pdf_record_error(ctx, csi);
+			}
+			csi->lexing = 0;
 
 			if (!cookie)
 			{
 				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
 			}
-			else if ((caught = fz_caught(ctx)) == FZ_ERROR_TRYLATER)
+			else if (caught == FZ_ERROR_TRYLATER)
 			{
 				if (cookie->incomplete_ok)
 					cookie->incomplete++;
@@ -1207,8 +1695,29 @@ pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pd
 
 	fz_try(ctx)
 	{
-		stm = pdf_open_contents_stream(ctx, doc, stmobj);
-		pdf_process_stream(ctx, proc, &csi, stm);
+		csi.replay = pdf_find_content_tokens(ctx, stmobj, rdb);
+		if (csi.replay)
+		{
+			pdf_process_stream(ctx, proc, &csi, NULL);
+		}
+		else
+		{
+			csi.record = pdf_new_content_tokens(ctx);
+			stm = pdf_open_contents_stream(ctx, doc, stmobj);
+			pdf_process_stream(ctx, proc, &csi, stm);
+			if (csi.record)
+			{
+				/* A nested pass over the same stream may beat us to it */
+				pdf_content_tokens *existing = pdf_find_item(ctx, pdf_drop_content_tokens_imp, stmobj);
+				if (existing)
+					pdf_drop_content_tokens(ctx, existing);
+				else
+				{
+					pdf_record_content_parts(ctx, csi.record, stmobj);
+					pdf_store_item(ctx, stmobj, csi.record, csi.record->size);
+				}
+			}
+		}
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
@@ -1216,6 +1725,8 @@ pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pd
 		fz_drop_stream(ctx, stm);
 		pdf_clear_stack(ctx, &csi);
 		pdf_lexbuf_fin(ctx, &buf);
+		pdf_drop_content_tokens(ctx, csi.record);
+		pdf_drop_content_tokens(ctx, csi.replay);
 	}
 	fz_catch(ctx)
 	{
@@ -24,6 +24,38 @@
 #define RANGE_0_7 \
 	'0':case'1':case'2':case'3':case'4':case'5':case'6':case'7'
 
+/*
+	Character classes for the scanning fast paths below. These run
+	directly over the buffered rp..wp window of the stream and only
+	fall back to fz_read_byte when they reach the end of it.
+*/
+enum
+{
+	LEX_WHITE = 1,
+	LEX_DELIM = 2,
+	LEX_DIGIT = 4,
+	LEX_HASH = 8,
+	LEX_EOL = 16,
+	LEX_STRING = 32
+};
+
+static const unsigned char lex_class[256] =
+{
+	/* NUL */ 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 17, 0, 1, 17, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* SP ! " # $ % & ' */ 1, 0, 0, 8, 0, 2, 0, 0,
+	/* ( ) * + , - . / */ 34, 34, 0, 0, 0, 0, 0, 2,
+	/* 0-9 */ 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	/* : ; < = > ? */ 0, 0, 2, 0, 2, 0,
+	/* @ A-O */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* P-Z */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* [ \ ] ^ _ */ 2, 32, 2, 0, 0,
+	/* ` a-o */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* p-z */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* { | } ~ DEL */ 2, 0, 2, 0, 0,
+	/* 128-255 */ 0
+};
+
 static inline int iswhite(int ch)
 {
 	return
@@ -46,8 +78,15 @@ static inline int unhex(int ch)
 static void
 lex_white(fz_context *ctx, fz_stream *f)
 {
+	unsigned char *p;
 	int c;
 	do {
+		p = f->rp;
+		while (p < f->wp && (lex_class[*p] & LEX_WHITE))
+			p++;
+		f->rp = p;
+		if (p < f->wp)
+			return;
 		c = fz_read_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
 	if (c != EOF)
@@ -57,12 +96,83 @@ lex_white(fz_context *ctx, fz_stream *f)
 static void
 lex_comment(fz_context *ctx, fz_stream *f)
 {
+	unsigned char *p;
 	int c;
 	do {
+		p = f->rp;
+		while (p < f->wp && !(lex_class[*p] & LEX_EOL))
+			p++;
+		f->rp = p;
 		c = fz_read_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
 }
 
+/*
+	Parse a number straight out of the buffered window. This only
+	succeeds if the character that ends the number is also in the
+	window; otherwise nothing is consumed and PDF_TOK_ERROR is returned
+	so that the caller can take the byte-at-a-time path instead.
+*/
+static inline int
+lex_number_window(fz_stream *f, pdf_lexbuf *buf, int c)
+{
+	unsigned char *p = f->rp;
+	unsigned char *e = f->wp;
+	int neg = 0;
+	int i = 0;
+	int n = 0;
+	int d = 1;
+	float v;
+
+	switch (c)
+	{
+	case '.':
+		goto after_dot;
+	case '-':
+		neg = 1;
+		break;
+	case '+':
+		break;
+	default:
+		i = c - '0';
+		break;
+	}
+
+	while (p < e && (lex_class[*p] & LEX_DIGIT))
+		i = 10*i + *p++ - '0';
+	if (p == e)
+		return PDF_TOK_ERROR;
+	if (*p != '.')
+	{
+		f->rp = p;
+		buf->i = neg ? -i : i;
+		return PDF_TOK_INT;
+	}
+	p++;
+
+after_dot:
+	while (p < e && (lex_class[*p] & LEX_DIGIT))
+	{
+		if (d >= INT_MAX/10)
+		{
+			/* Ignore any digits after here, because they are too small */
+			while (p < e && (lex_class[*p] & LEX_DIGIT))
+				p++;
+			break;
+		}
+		n = n*10 + (*p++ - '0');
+		d *= 10;
+	}
+	if (p == e)
+		return PDF_TOK_ERROR;
+	f->rp = p;
+	v = (float)i + ((float)n / (float)d);
+	if (neg)
+		v = -v;
+	buf->f = v;
+	return PDF_TOK_REAL;
+}
+
 static int
 lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 {
@@ -72,6 +182,10 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 	int d;
 	float v;
 
+	n = lex_number_window(f, buf, c);
+	if (n != PDF_TOK_ERROR)
+		return n;
+
 	/* Initially we might have +, -, . or a digit */
 	switch (c)
 	{
@@ -166,7 +280,20 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf)
 
 	while (n > 1)
 	{
-		int c = fz_read_byte(ctx, f);
+		unsigned char *p = f->rp;
+		int c;
+
+		/* Copy plain name characters straight out of the buffer */
+		while (n > 1 && p < f->wp && !(lex_class[*p] & (LEX_WHITE | LEX_DELIM | LEX_HASH)))
+		{
+			*s++ = *p++;
+			n--;
+		}
+		f->rp = p;
+		if (n <= 1)
+			break;
+
+		c = fz_read_byte(ctx, f);
 		switch (c)
 		{
 		case IS_WHITE:
@@ -247,6 +374,18 @@ lex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			s += pdf_lexbuf_grow(ctx, lb);
 			e = lb->scratch + lb->size;
 		}
+		if (f->rp < f->wp && !(lex_class[*f->rp] & LEX_STRING))
+		{
+			/* Copy a run of ordinary characters out of the buffer */
+			unsigned char *p = f->rp;
+			unsigned char *pe = f->wp;
+			if (pe - p > e - s)
+				pe = p + (e - s);
+			while (p < pe && !(lex_class[*p] & LEX_STRING))
+				*s++ = *p++;
+			f->rp = p;
+			continue;
+		}
 		c = fz_read_byte(ctx, f);
 		switch (c)
 		{
@@ -373,43 +512,62 @@ end:
 	return PDF_TOK_STRING;
 }
 
+/*
+	Map a keyword to its token. The length and first character select
+	at most one candidate, so a keyword costs a single memcmp at most;
+	content stream operators never get that far. The length is taken
+	with strlen rather than from the lexbuf so that a name escape
+	producing a NUL compares exactly as it always has.
+*/
 static pdf_token
 pdf_token_from_keyword(char *key)
 {
-	switch (*key)
+	size_t len = strlen(key);
+
+#define KEYWORD(K, T) \
+	(!memcmp(key, K, sizeof(K) - 1) ? T : PDF_TOK_KEYWORD)
+
+	switch (len)
 	{
-	case 'R':
-		if (!strcmp(key, "R")) return PDF_TOK_R;
+	case 1:
+		if (*key == 'R') return PDF_TOK_R;
 		break;
-	case 't':
-		if (!strcmp(key, "true")) return PDF_TOK_TRUE;
-		if (!strcmp(key, "trailer")) return PDF_TOK_TRAILER;
+	case 3:
+		if (*key == 'o') return KEYWORD("obj", PDF_TOK_OBJ);
 		break;
-	case 'f':
-		if (!strcmp(key, "false")) return PDF_TOK_FALSE;
-		break;
-	case 'n':
-		if (!strcmp(key, "null")) return PDF_TOK_NULL;
-		break;
-	case 'o':
-		if (!strcmp(key, "obj")) return PDF_TOK_OBJ;
+	case 4:
+		switch (*key)
+		{
+		case 't': return KEYWORD("true", PDF_TOK_TRUE);
+		case 'n': return KEYWORD("null", PDF_TOK_NULL);
+		case 'x': return KEYWORD("xref", PDF_TOK_XREF);
+		}
 		break;
-	case 'e':
-		if (!strcmp(key, "endobj")) return PDF_TOK_ENDOBJ;
-		if (!strcmp(key, "endstream")) return PDF_TOK_ENDSTREAM;
+	case 5:
+		if (*key == 'f') return KEYWORD("false", PDF_TOK_FALSE);
 		break;
-	case 's':
-		if (!strcmp(key, "stream")) return PDF_TOK_STREAM;
-		if (!strcmp(key, "startxref")) return PDF_TOK_STARTXREF;
+	case 6:
+		switch (*key)
+		{
+		case 'e': return KEYWORD("endobj", PDF_TOK_ENDOBJ);
+		case 's': return KEYWORD("stream", PDF_TOK_STREAM);
+		}
 		break;
-	case 'x':
-		if (!strcmp(key, "xref")) return PDF_TOK_XREF;
+	case 7:
+		if (*key == 't') return KEYWORD("trailer", PDF_TOK_TRAILER);
 		break;
-	default:
+	case 9:
+		switch (*key)
+		{
+		case 'e': return KEYWORD("endstream", PDF_TOK_ENDSTREAM);
+		case 's': return KEYWORD("startxref", PDF_TOK_STARTXREF);
+		}
 		break;
 	}
 
 	return PDF_TOK_KEYWORD;
+
+#undef KEYWORD
 }
 
 void pdf_lexbuf_init(fz_context *ctx, pdf_lexbuf *lb, int size)
@@ -360,6 +360,19 @@ pdf_document *pdf_get_indirect_document(fz_context *ctx, pdf_obj *obj)
 	return REF(obj)->doc;
 }
 
+pdf_document *pdf_get_bound_document(fz_context *ctx, pdf_obj *obj)
+{
+	if (obj < PDF_OBJ__LIMIT)
+		return NULL;
+	if (obj->kind == PDF_INDIRECT)
+		return REF(obj)->doc;
+	if (obj->kind == PDF_ARRAY)
+		return ARRAY(obj)->doc;
+	if (obj->kind == PDF_DICT)
+		return DICT(obj)->doc;
+	return NULL;
+}
+
 int pdf_objcmp_resolve(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 {
 	RESOLVE(a);
@@ -383,14 +396,14 @@ pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 		if (b < PDF_OBJ_NAME__LIMIT)
 			return a != b;
 
-		if (b->kind != PDF_NAME)
+		if (b < PDF_OBJ__LIMIT || b->kind != PDF_NAME)
 			return 1;
 		return strcmp(NAME(b)->n, PDF_NAMES[(intptr_t)a]);
 	}
 
 	if (b < PDF_OBJ_NAME__LIMIT)
 	{
-		if (a->kind != PDF_NAME)
+		if (a < PDF_OBJ__LIMIT || a->kind != PDF_NAME)
 			return 1;
 		return strcmp(NAME(a)->n, PDF_NAMES[(intptr_t)b]);
 	}
@@ -1603,6 +1616,7 @@ void pdf_dirty_obj(fz_context *ctx, pdf_obj *obj)
 
 void pdf_clean_obj(fz_context *ctx, pdf_obj *obj)
 {
+	RESOLVE(obj);
 	if (obj < PDF_OBJ__LIMIT)
 		return;
 	obj->flags &= ~PDF_FLAGS_DIRTY;
@@ -392,6 +392,17 @@ pdf_load_links(fz_context *ctx, pdf_page *page)
 	return fz_keep_link(ctx, page->links);
 }
 
+fz_image *
+pdf_load_page_thumbnail(fz_context *ctx, pdf_document *doc, int number)
+{
+	pdf_obj *pageobj = pdf_lookup_page_obj(ctx, doc, number);
+	pdf_obj *thumb = pdf_dict_gets(ctx, pageobj, "Thumb");
+
+	if (!pdf_is_stream(ctx, doc, pdf_to_num(ctx, thumb), pdf_to_gen(ctx, thumb)))
+		return NULL;
+	return pdf_load_image(ctx, doc, thumb);
+}
+
 static void
 pdf_drop_page_imp(fz_context *ctx, pdf_page *page)
 {
@@ -14,6 +14,58 @@ struct entry
 	int stm_len;
 };
 
+/*
+	Skip forward to just past the next 'endstream' in the file. The
+	buffered data is searched a block at a time with memchr, and only
+	the few bytes that straddle the end of the buffer go through
+	fz_read_byte. Returns 0 if no 'endstream' was found before EOF.
+*/
+static int
+pdf_repair_skip_stream(fz_context *ctx, fz_stream *file)
+{
+	static const char pat[] = "endstream";
+	/* KMP failure function for pat; only "endstre" has a border ("e") */
+	static const unsigned char fail[] = { 0, 0, 0, 0, 0, 0, 0, 1, 0 };
+	int m = 0;
+	int c;
+
+	while (1)
+	{
+		if (m == 0)
+		{
+			unsigned char *p = file->rp;
+			unsigned char *q;
+
+			while (file->wp - p >= 9)
+			{
+				q = memchr(p, 'e', file->wp - p - 8);
+				if (!q)
+				{
+					p = file->wp - 8;
+					break;
+				}
+				if (!memcmp(q, pat, 9))
+				{
+					file->rp = q + 9;
+					return 1;
+				}
+				p = q + 1;
+			}
+			file->rp = p;
+		}
+
+		c = fz_read_byte(ctx, file);
+		if (c == EOF)
+			return 0;
+		while (m > 0 && pat[m] != c)
+			m = fail[m];
+		if (pat[m] == c)
+			m++;
+		if (m == 9)
+			return 1;
+	}
+}
+
 int
 pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int *tmpofs)
 {
@@ -132,16 +184,7 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int *stmofsp
 			fz_seek(ctx, file, *stmofsp, 0);
 		}
 
-		(void)fz_read(ctx, file, (unsigned char *) buf->scratch, 9);
-
-		while (memcmp(buf->scratch, "endstream", 9) != 0)
-		{
-			c = fz_read_byte(ctx, file);
-			if (c == EOF)
-				break;
-			memmove(&buf->scratch[0], &buf->scratch[1], 8);
-			buf->scratch[8] = c;
-		}
+		pdf_repair_skip_stream(ctx, file);
 
 		if (stmlenp)
 			*stmlenp = fz_tell(ctx, file) - *stmofsp - 9;
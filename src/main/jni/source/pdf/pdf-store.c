@@ -28,6 +28,10 @@ pdf_drop_key(fz_context *ctx, void *key)
 static int
 pdf_cmp_key(fz_context *ctx, void *k0, void *k1)
 {
+	/* The store may be shared by several documents; equal direct
+	 * objects from different documents are different keys. */
+	if (pdf_get_bound_document(ctx, (pdf_obj *)k0) != pdf_get_bound_document(ctx, (pdf_obj *)k1))
+		return 1;
 	return pdf_objcmp(ctx, (pdf_obj *)k0, (pdf_obj *)k1);
 }
 
@@ -52,6 +56,7 @@ static fz_store_type pdf_obj_store_type =
 	pdf_keep_key,
 	pdf_drop_key,
 	pdf_cmp_key,
+	FZ_STORE_TIER_RESOURCES,
 #ifndef NDEBUG
 	pdf_debug_key
 #endif
@@ -76,3 +81,25 @@ pdf_remove_item(fz_context *ctx, fz_store_drop_fn *drop, pdf_obj *key)
 {
 	fz_remove_item(ctx, drop, key, &pdf_obj_store_type);
 }
+
+void
+pdf_filter_store(fz_context *ctx, fz_store_drop_fn *drop, fz_store_filter_fn *fn, void *arg)
+{
+	fz_filter_store(ctx, drop, fn, arg, &pdf_obj_store_type);
+}
+
+static int
+pdf_document_key_filter(fz_context *ctx, void *doc, void *key, fz_storable *val)
+{
+	return pdf_get_bound_document(ctx, (pdf_obj *)key) == doc;
+}
+
+/*
+	Evict everything keyed on objects of one document, leaving what other
+	documents sharing the store have cached.
+*/
+void
+pdf_empty_store(fz_context *ctx, pdf_document *doc)
+{
+	fz_filter_store(ctx, NULL, pdf_document_key_filter, doc, &pdf_obj_store_type);
+}
@@ -525,12 +525,76 @@ can_reuse_buffer(fz_context *ctx, pdf_xref_entry *entry, fz_compression_params *
 
 }
 
+/*
+ * Check if a stream has nothing but a FlateDecode filter without a
+ * predictor, so that it can be inflated in one go by fz_inflate_buffer.
+ */
+static int
+pdf_is_plain_flate(fz_context *ctx, pdf_obj *dict)
+{
+	pdf_obj *f = pdf_dict_geta(ctx, dict, PDF_NAME_Filter, PDF_NAME_F);
+	pdf_obj *p = pdf_dict_geta(ctx, dict, PDF_NAME_DecodeParms, PDF_NAME_DP);
+
+	if (pdf_is_array(ctx, f))
+	{
+		if (pdf_array_len(ctx, f) != 1)
+			return 0;
+		f = pdf_array_get(ctx, f, 0);
+		p = pdf_array_get(ctx, p, 0);
+	}
+	if (!pdf_name_eq(ctx, f, PDF_NAME_FlateDecode) && !pdf_name_eq(ctx, f, PDF_NAME_Fl))
+		return 0;
+	return pdf_to_int(ctx, pdf_dict_get(ctx, p, PDF_NAME_Predictor)) <= 1;
+}
+
+/*
+ * Load a plain flate stream by reading all of the raw (decrypted) data
+ * and inflating it straight into a buffer of the expected size, rather
+ * than pulling it through the filter chain a block at a time.
+ */
+static fz_buffer *
+pdf_load_flate_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int orig_num, int orig_gen, int rawlen, int len, int *truncated)
+{
+	fz_stream *stm = NULL;
+	fz_buffer *raw = NULL;
+	fz_buffer *buf = NULL;
+	pdf_xref_entry *x;
+	int raw_truncated = 0;
+
+	fz_var(stm);
+	fz_var(raw);
+
+	x = pdf_cache_object(ctx, doc, num, gen);
+	if (x->stm_ofs == 0 && x->stm_buf == NULL)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "object is not a stream");
+
+	fz_try(ctx)
+	{
+		stm = pdf_open_raw_filter(ctx, doc->file, doc, x->obj, orig_num, orig_num, orig_gen, x->stm_ofs);
+		raw = fz_read_best(ctx, stm, rawlen, truncated ? &raw_truncated : NULL);
+		buf = fz_inflate_buffer(ctx, raw, 15, len, truncated);
+		if (truncated && raw_truncated)
+			*truncated = 1;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, raw);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_message(ctx, "cannot read raw stream (%d %d R)", num, gen);
+	}
+
+	return buf;
+}
+
 static fz_buffer *
 pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int orig_num, int orig_gen, fz_compression_params *params, int *truncated)
 {
 	fz_stream *stm = NULL;
 	pdf_obj *dict, *obj;
-	int i, len, n;
+	int i, len, n, rawlen, dl, flate;
 	fz_buffer *buf;
 
 	fz_var(buf);
@@ -546,15 +610,25 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int
 
 	dict = pdf_load_object(ctx, doc, num, gen);
 
-	len = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Length));
+	rawlen = len = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Length));
 	obj = pdf_dict_get(ctx, dict, PDF_NAME_Filter);
 	len = pdf_guess_filter_length(len, pdf_to_name(ctx, obj));
 	n = pdf_array_len(ctx, obj);
 	for (i = 0; i < n; i++)
 		len = pdf_guess_filter_length(len, pdf_to_name(ctx, pdf_array_get(ctx, obj, i)));
 
+	flate = !params && pdf_is_plain_flate(ctx, dict);
+
+	/* Trust the decoded length if given, within the compression bomb limit */
+	dl = pdf_to_int(ctx, pdf_dict_gets(ctx, dict, "DL"));
+	if (flate && dl > 0 && dl / 200 <= rawlen)
+		len = dl;
+
 	pdf_drop_obj(ctx, dict);
 
+	if (flate)
+		return pdf_load_flate_stream(ctx, doc, num, gen, orig_num, orig_gen, rawlen, len, truncated);
+
 	stm = pdf_open_image_stream(ctx, doc, num, gen, orig_num, orig_gen, params);
 
 	fz_try(ctx)
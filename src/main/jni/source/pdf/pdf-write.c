@@ -5,6 +5,7 @@
 /* #define DEBUG_WRITING */
 
 typedef struct pdf_write_options_s pdf_write_options;
+typedef struct inflater_s inflater;
 
 /*
 	As part of linearization, we need to keep a list of what objects are used
@@ -79,6 +80,8 @@ struct pdf_write_options_s
 	pdf_obj *hints_length;
 	int page_count;
 	page_objects_list *page_object_lists;
+	/* Decodes Flate streams ahead of the writer when expanding */
+	inflater *inflater;
 };
 
 /*
@@ -589,88 +592,250 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_options *opts,
 }
 
 /*
- * Scan for and remove duplicate objects (slow)
+ * Hash an object consistently with pdf_objcmp: objects that compare
+ * equal always hash to the same value. Indirect references hash by
+ * number, as pdf_objcmp does not follow them.
+ */
+
+static unsigned int hashmix(unsigned int h, unsigned int v)
+{
+	return (h ^ v) * 16777619;
+}
+
+static unsigned int hashbytes(unsigned int h, const unsigned char *s, int n)
+{
+	while (n--)
+		h = hashmix(h, *s++);
+	return h;
+}
+
+static unsigned int hashobj(fz_context *ctx, pdf_obj *obj, int depth)
+{
+	unsigned int h = 2166136261U;
+	int i, n;
+
+	if (!obj)
+		return 0;
+
+	if (pdf_is_indirect(ctx, obj))
+		return hashmix(hashmix(hashmix(h, 'R'), pdf_to_num(ctx, obj)), pdf_to_gen(ctx, obj));
+	if (pdf_is_null(ctx, obj))
+		return hashmix(h, 'N');
+	if (pdf_is_bool(ctx, obj))
+		return hashmix(h, pdf_to_bool(ctx, obj) ? 'T' : 'F');
+	if (pdf_is_int(ctx, obj))
+		return hashmix(hashmix(h, 'i'), pdf_to_int(ctx, obj));
+	if (pdf_is_real(ctx, obj))
+	{
+		float f = pdf_to_real(ctx, obj);
+		unsigned int u;
+		if (f == 0)
+			f = 0; /* -0 compares equal to 0 */
+		memcpy(&u, &f, sizeof u);
+		return hashmix(hashmix(h, 'f'), u);
+	}
+	if (pdf_is_name(ctx, obj))
+	{
+		char *name = pdf_to_name(ctx, obj);
+		return hashbytes(hashmix(h, 'n'), (unsigned char *)name, strlen(name));
+	}
+	if (pdf_is_string(ctx, obj))
+		return hashbytes(hashmix(h, 's'), (unsigned char *)pdf_to_str_buf(ctx, obj), pdf_to_str_len(ctx, obj));
+
+	/* Leave deeply nested contents to pdf_objcmp */
+	if (depth > 8)
+		return h;
+
+	if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		h = hashmix(hashmix(h, 'a'), n);
+		for (i = 0; i < n; i++)
+			h = hashmix(h, hashobj(ctx, pdf_array_get(ctx, obj, i), depth + 1));
+		return h;
+	}
+	if (pdf_is_dict(ctx, obj))
+	{
+		n = pdf_dict_len(ctx, obj);
+		h = hashmix(hashmix(h, 'd'), n);
+		for (i = 0; i < n; i++)
+		{
+			h = hashmix(h, hashobj(ctx, pdf_dict_get_key(ctx, obj, i), depth + 1));
+			h = hashmix(h, hashobj(ctx, pdf_dict_get_val(ctx, obj, i), depth + 1));
+		}
+		return h;
+	}
+	return h;
+}
+
+/*
+ * Compare the raw contents of two streams whose dictionaries already
+ * match. A digest of each stream is computed the first time it is
+ * needed and kept, so that a stream shared by many candidates is only
+ * read once; matching digests are confirmed byte for byte.
+ */
+
+struct stream_digest
+{
+	int len;
+	unsigned char md5[16];
+};
+
+static struct stream_digest *getstreamdigest(fz_context *ctx, pdf_document *doc, struct stream_digest *digests, int num)
+{
+	struct stream_digest *d = &digests[num];
+
+	if (d->len < 0)
+	{
+		fz_buffer *buf = pdf_load_raw_renumbered_stream(ctx, doc, num, 0, num, 0);
+		unsigned char *data;
+		fz_md5 md5;
+
+		d->len = fz_buffer_storage(ctx, buf, &data);
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, data, d->len);
+		fz_md5_final(&md5, d->md5);
+		fz_drop_buffer(ctx, buf);
+	}
+	return d;
+}
+
+static int streamsdiffer(fz_context *ctx, pdf_document *doc, struct stream_digest *digests, int num, int other)
+{
+	struct stream_digest *da = getstreamdigest(ctx, doc, digests, num);
+	struct stream_digest *db = getstreamdigest(ctx, doc, digests, other);
+	fz_buffer *sa = NULL;
+	fz_buffer *sb = NULL;
+	int differ = 1;
+
+	if (da->len != db->len || memcmp(da->md5, db->md5, 16))
+		return 1;
+
+	fz_var(sa);
+	fz_var(sb);
+
+	fz_try(ctx)
+	{
+		unsigned char *dataa, *datab;
+		int lena, lenb;
+		sa = pdf_load_raw_renumbered_stream(ctx, doc, num, 0, num, 0);
+		sb = pdf_load_raw_renumbered_stream(ctx, doc, other, 0, other, 0);
+		lena = fz_buffer_storage(ctx, sa, &dataa);
+		lenb = fz_buffer_storage(ctx, sb, &datab);
+		if (lena == lenb && memcmp(dataa, datab, lena) == 0)
+			differ = 0;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+	return differ;
+}
+
+/*
+ * Scan for and remove duplicate objects
+ *
+ * Objects are bucketed by hashobj so that each object is only compared
+ * against earlier candidates with the same hash. Each bucket holds just
+ * one live representative of any set of equal objects (the lowest
+ * numbered), so the first match found is the one a pairwise scan over
+ * all earlier objects would have picked.
  */
 
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_options *opts)
 {
 	int num, other;
 	int xref_len = pdf_xref_len(ctx, doc);
+	int mask = 255;
+	int *buckets = NULL;
+	int *chain = NULL;
+	unsigned int *hashes = NULL;
+	unsigned char *streams = NULL;
+	struct stream_digest *digests = NULL;
+
+	fz_var(buckets);
+	fz_var(chain);
+	fz_var(hashes);
+	fz_var(streams);
+	fz_var(digests);
+
+	while (mask < xref_len)
+		mask = mask * 2 + 1;
 
-	for (num = 1; num < xref_len; num++)
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
+		buckets = fz_calloc(ctx, mask + 1, sizeof(*buckets));
+		chain = fz_calloc(ctx, xref_len, sizeof(*chain));
+		hashes = fz_calloc(ctx, xref_len, sizeof(*hashes));
+		streams = fz_calloc(ctx, xref_len, sizeof(*streams));
+		if (opts->do_garbage >= 4)
+		{
+			digests = fz_malloc_array(ctx, xref_len, sizeof(*digests));
+			for (num = 0; num < xref_len; num++)
+				digests[num].len = -1;
+		}
+
+		for (num = 1; num < xref_len; num++)
 		{
 			pdf_obj *a, *b;
-			int differ, newnum, streama, streamb;
+			unsigned int h;
+			int newnum, stream, skip;
 
-			if (num == other || !opts->use_list[num] || !opts->use_list[other])
+			if (!opts->use_list[num])
 				continue;
 
 			/*
-			 * Comparing stream objects data contents would take too long.
+			 * Only compare stream objects at garbage level 4, as comparing
+			 * their data contents takes longer.
 			 *
 			 * pdf_is_stream calls pdf_cache_object and ensures
 			 * that the xref table has the objects loaded.
 			 */
 			fz_try(ctx)
 			{
-				streama = pdf_is_stream(ctx, doc, num, 0);
-				streamb = pdf_is_stream(ctx, doc, other, 0);
-				differ = streama || streamb;
-				if (streama && streamb && opts->do_garbage >= 4)
-					differ = 0;
+				stream = pdf_is_stream(ctx, doc, num, 0);
+				skip = stream && opts->do_garbage < 4;
 			}
 			fz_catch(ctx)
 			{
-				/* Assume different */
-				differ = 1;
+				/* Assume different from everything */
+				stream = 0;
+				skip = 1;
 			}
-			if (differ)
+			if (skip)
 				continue;
 
-			a = pdf_get_xref_entry(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry(ctx, doc, other)->obj;
+			a = pdf_resolve_indirect(ctx, pdf_get_xref_entry(ctx, doc, num)->obj);
+			h = hashobj(ctx, a, 0);
 
-			a = pdf_resolve_indirect(ctx, a);
-			b = pdf_resolve_indirect(ctx, b);
+			for (other = buckets[h & mask]; other; other = chain[other])
+			{
+				if (hashes[other] != h || streams[other] != stream)
+					continue;
 
-			if (pdf_objcmp(ctx, a, b))
-				continue;
+				b = pdf_resolve_indirect(ctx, pdf_get_xref_entry(ctx, doc, other)->obj);
+				if (pdf_objcmp(ctx, a, b))
+					continue;
 
-			if (streama && streamb)
-			{
 				/* Check to see if streams match too. */
-				fz_buffer *sa = NULL;
-				fz_buffer *sb = NULL;
+				if (stream && streamsdiffer(ctx, doc, digests, num, other))
+					continue;
 
-				fz_var(sa);
-				fz_var(sb);
+				break;
+			}
 
-				differ = 1;
-				fz_try(ctx)
-				{
-					unsigned char *dataa, *datab;
-					int lena, lenb;
-					sa = pdf_load_raw_renumbered_stream(ctx, doc, num, 0, num, 0);
-					sb = pdf_load_raw_renumbered_stream(ctx, doc, other, 0, other, 0);
-					lena = fz_buffer_storage(ctx, sa, &dataa);
-					lenb = fz_buffer_storage(ctx, sb, &datab);
-					if (lena == lenb && memcmp(dataa, datab, lena) == 0)
-						differ = 0;
-				}
-				fz_always(ctx)
-				{
-					fz_drop_buffer(ctx, sa);
-					fz_drop_buffer(ctx, sb);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow(ctx);
-				}
-				if (differ)
-					continue;
+			if (!other)
+			{
+				hashes[num] = h;
+				streams[num] = stream;
+				chain[num] = buckets[h & mask];
+				buckets[h & mask] = num;
+				continue;
 			}
 
 			/* Keep the lowest numbered object */
@@ -679,11 +844,20 @@ static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_op
 			opts->renumber_map[other] = newnum;
 			opts->rev_renumber_map[newnum] = num; /* Either will do */
 			opts->use_list[fz_maxi(num, other)] = 0;
-
-			/* One duplicate was found, do not look for another */
-			break;
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, buckets);
+		fz_free(ctx, chain);
+		fz_free(ctx, hashes);
+		fz_free(ctx, streams);
+		fz_free(ctx, digests);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 }
 
 /*
@@ -1599,6 +1773,8 @@ static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_options *op
 	pdf_drop_obj(ctx, obj);
 }
 
+static fz_buffer *take_inflated_stream(fz_context *ctx, pdf_write_options *opts, int num);
+
 static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, pdf_obj *obj_orig, int num, int gen)
 {
 	fz_buffer *buf, *tmp;
@@ -1608,7 +1784,9 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_options *
 	int orig_gen = opts->rev_gen_list[num];
 	int truncated = 0;
 
-	buf = pdf_load_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen, (opts->continue_on_error ? &truncated : NULL));
+	buf = take_inflated_stream(ctx, opts, num);
+	if (!buf)
+		buf = pdf_load_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen, (opts->continue_on_error ? &truncated : NULL));
 	if (truncated && opts->errors)
 		(*opts->errors)++;
 
@@ -1667,6 +1845,510 @@ static int filter_implies_image(fz_context *ctx, pdf_document *doc, pdf_obj *o)
 	return 0;
 }
 
+static int shouldexpand(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, pdf_obj *obj)
+{
+	int dontexpand = 0;
+	if (opts->do_expand != 0 && opts->do_expand != fz_expand_all)
+	{
+		pdf_obj *o;
+
+		if ((o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_XObject)) &&
+			(o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Image)))
+			dontexpand = !(opts->do_expand & fz_expand_images);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_Font))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_FontDescriptor))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Length1) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Length2) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Length3) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Type1C))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_CIDFontType0C))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Filter), filter_implies_image(ctx, doc, o))
+			dontexpand = !(opts->do_expand & fz_expand_images);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Width) != NULL && pdf_dict_get(ctx, obj, PDF_NAME_Height) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_images);
+	}
+	return opts->do_expand && !dontexpand && !pdf_is_jpx_image(ctx, obj);
+}
+
+/*
+ * When expanding, most of the time goes in inflating Flate streams. On
+ * builds with threads, a small pool of workers inflates streams a little
+ * way ahead of the writer. The raw (decrypted) data is still read on the
+ * calling thread, as the document is not thread safe; the workers only
+ * run zlib over that memory. The writer takes the results back in object
+ * order, so the output is exactly what the serial path would produce.
+ * Anything the workers cannot decode cleanly (bad data, predictors,
+ * suspected compression bombs) is left to the serial path.
+ */
+
+#ifdef HAVE_PTHREADS
+
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define INFLATER_MAX_THREADS 4
+#define INFLATER_MAX_RAW (16 << 20)
+#define INFLATER_MIN_BOMB (100 << 20) /* As in fz_read_best */
+
+enum
+{
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_FAILED
+};
+
+typedef struct inflate_job_s inflate_job;
+
+struct inflate_job_s
+{
+	int state;
+	int initial;
+	fz_buffer *raw;
+	unsigned char *data;
+	size_t len;
+	inflate_job *next;
+};
+
+struct inflater_s
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t thread[INFLATER_MAX_THREADS];
+	int thread_count;
+	int quit;
+
+	/* Queued jobs, oldest first; protected by lock */
+	inflate_job *head;
+	inflate_job *tail;
+
+	/* Everything below is only touched by the writing thread */
+	int xref_len;
+	inflate_job **jobs;
+	int *order;
+	int order_len;
+	int next;
+	int pending;
+	int pending_raw;
+};
+
+static int run_inflate_job(inflate_job *job)
+{
+	z_stream z;
+	unsigned char *data, *newdata;
+	size_t cap, len = 0;
+	int code;
+
+	memset(&z, 0, sizeof z);
+	if (inflateInit2(&z, 15) != Z_OK)
+		return 0;
+
+	cap = job->initial;
+	data = malloc(cap);
+	if (!data)
+		goto fail;
+
+	z.next_in = job->raw->data;
+	z.avail_in = job->raw->len;
+
+	while (1)
+	{
+		if (len == cap)
+		{
+			if (len >= INFLATER_MIN_BOMB && len / 200 > (size_t)job->initial)
+				goto fail;
+			newdata = realloc(data, cap * 2);
+			if (!newdata)
+				goto fail;
+			data = newdata;
+			cap *= 2;
+		}
+
+		z.next_out = data + len;
+		z.avail_out = cap - len;
+		code = inflate(&z, Z_NO_FLUSH);
+		len = cap - z.avail_out;
+
+		if (code == Z_STREAM_END)
+			break;
+		if (code != Z_OK)
+			goto fail;
+	}
+
+	if (len >= INFLATER_MIN_BOMB && len / 200 > (size_t)job->initial)
+		goto fail;
+
+	inflateEnd(&z);
+	job->data = data;
+	job->len = len;
+	return 1;
+
+fail:
+	inflateEnd(&z);
+	free(data);
+	return 0;
+}
+
+static void *inflater_thread(void *arg)
+{
+	inflater *inf = arg;
+	inflate_job *job;
+	int ok;
+
+	pthread_mutex_lock(&inf->lock);
+	while (!inf->quit)
+	{
+		job = inf->head;
+		if (!job)
+		{
+			pthread_cond_wait(&inf->work, &inf->lock);
+			continue;
+		}
+		inf->head = job->next;
+		if (!inf->head)
+			inf->tail = NULL;
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&inf->lock);
+
+		ok = run_inflate_job(job);
+
+		pthread_mutex_lock(&inf->lock);
+		job->state = ok ? JOB_DONE : JOB_FAILED;
+		pthread_cond_broadcast(&inf->done);
+	}
+	pthread_mutex_unlock(&inf->lock);
+	return NULL;
+}
+
+static void free_inflate_job(fz_context *ctx, inflate_job *job)
+{
+	fz_drop_buffer(ctx, job->raw);
+	free(job->data);
+	fz_free(ctx, job);
+}
+
+static void new_inflater(fz_context *ctx, pdf_document *doc, pdf_write_options *opts)
+{
+	inflater *inf;
+	long cpus;
+	int i, n, xref_len;
+
+	if (!opts->do_expand)
+		return;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	n = fz_clampi(cpus - 1, 0, INFLATER_MAX_THREADS);
+	if (n == 0)
+		return;
+
+	xref_len = pdf_xref_len(ctx, doc);
+	inf = fz_malloc_struct(ctx, inflater);
+	fz_try(ctx)
+	{
+		inf->xref_len = xref_len;
+		inf->jobs = fz_calloc(ctx, xref_len, sizeof(*inf->jobs));
+		inf->order = fz_malloc_array(ctx, xref_len, sizeof(*inf->order));
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, inf->jobs);
+		fz_free(ctx, inf);
+		fz_rethrow(ctx);
+	}
+
+	/* The order in which writeobjects visits objects */
+	if (opts->start < xref_len)
+		inf->order[inf->order_len++] = opts->start;
+	for (i = opts->start + 1; i < xref_len; i++)
+		inf->order[inf->order_len++] = i;
+	for (i = 1; i < opts->start && i < xref_len; i++)
+		inf->order[inf->order_len++] = i;
+
+	pthread_mutex_init(&inf->lock, NULL);
+	pthread_cond_init(&inf->work, NULL);
+	pthread_cond_init(&inf->done, NULL);
+	for (i = 0; i < n; i++)
+	{
+		if (pthread_create(&inf->thread[i], NULL, inflater_thread, inf))
+			break;
+		inf->thread_count++;
+	}
+
+	if (inf->thread_count == 0)
+	{
+		pthread_cond_destroy(&inf->done);
+		pthread_cond_destroy(&inf->work);
+		pthread_mutex_destroy(&inf->lock);
+		fz_free(ctx, inf->order);
+		fz_free(ctx, inf->jobs);
+		fz_free(ctx, inf);
+		return;
+	}
+
+	opts->inflater = inf;
+}
+
+static void drop_inflater(fz_context *ctx, pdf_write_options *opts)
+{
+	inflater *inf = opts->inflater;
+	int i;
+
+	if (!inf)
+		return;
+	opts->inflater = NULL;
+
+	pthread_mutex_lock(&inf->lock);
+	inf->quit = 1;
+	pthread_cond_broadcast(&inf->work);
+	pthread_mutex_unlock(&inf->lock);
+	for (i = 0; i < inf->thread_count; i++)
+		pthread_join(inf->thread[i], NULL);
+
+	for (i = 0; i < inf->xref_len; i++)
+		if (inf->jobs[i])
+			free_inflate_job(ctx, inf->jobs[i]);
+
+	pthread_cond_destroy(&inf->done);
+	pthread_cond_destroy(&inf->work);
+	pthread_mutex_destroy(&inf->lock);
+	fz_free(ctx, inf->order);
+	fz_free(ctx, inf->jobs);
+	fz_free(ctx, inf);
+}
+
+/*
+ * Check whether a stream will be expanded through a lone Flate filter
+ * with no predictor and, if so, load its raw data. Returns NULL (and
+ * swallows any error) for anything else; the serial path will meet the
+ * same object again when it gets there.
+ */
+static fz_buffer *load_inflatable_stream(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int num, int *initial)
+{
+	pdf_xref_entry *entry;
+	pdf_obj *obj = NULL;
+	pdf_obj *f, *p, *type;
+	fz_buffer *raw = NULL;
+	int gen, orig_num, len;
+
+	if (num <= 0 || (opts->do_garbage && !opts->use_list[num]))
+		return NULL;
+	entry = pdf_get_xref_entry(ctx, doc, num);
+	if (entry->type != 'n' || entry->stm_buf)
+		return NULL;
+	if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+		return NULL;
+
+	/* As dowriteobject */
+	gen = (opts->do_garbage >= 2 ? 0 : entry->gen);
+	orig_num = opts->rev_renumber_map[num];
+	if (orig_num <= 0 || orig_num >= pdf_xref_len(ctx, doc) || pdf_get_xref_entry(ctx, doc, orig_num)->stm_buf)
+		return NULL;
+
+	fz_var(obj);
+	fz_var(raw);
+
+	fz_try(ctx)
+	{
+		obj = pdf_load_object(ctx, doc, num, gen);
+		type = pdf_dict_get(ctx, obj, PDF_NAME_Type);
+		f = pdf_dict_geta(ctx, obj, PDF_NAME_Filter, PDF_NAME_F);
+		p = pdf_dict_geta(ctx, obj, PDF_NAME_DecodeParms, PDF_NAME_DP);
+		if (pdf_array_len(ctx, f) == 1)
+		{
+			f = pdf_array_get(ctx, f, 0);
+			p = pdf_array_get(ctx, p, 0);
+		}
+
+		entry = pdf_get_xref_entry(ctx, doc, num);
+		if (pdf_is_stream(ctx, doc, num, gen) && entry->stm_ofs > 0 && !entry->stm_buf &&
+			!pdf_name_eq(ctx, type, PDF_NAME_ObjStm) && !pdf_name_eq(ctx, type, PDF_NAME_XRef) &&
+			(pdf_name_eq(ctx, f, PDF_NAME_FlateDecode) || pdf_name_eq(ctx, f, PDF_NAME_Fl)) &&
+			pdf_to_int(ctx, pdf_dict_get(ctx, p, PDF_NAME_Predictor)) <= 1 &&
+			shouldexpand(ctx, doc, opts, obj))
+		{
+			/* As the length guess in pdf_load_image_stream and fz_read_best */
+			len = pdf_to_int(ctx, pdf_dict_get(ctx, obj, PDF_NAME_Length));
+			f = pdf_dict_get(ctx, obj, PDF_NAME_Filter);
+			if (pdf_name_eq(ctx, f, PDF_NAME_FlateDecode) || pdf_name_eq(ctx, pdf_array_get(ctx, f, 0), PDF_NAME_FlateDecode))
+				len *= 3;
+			*initial = fz_maxi(len, 1024);
+
+			raw = pdf_load_raw_renumbered_stream(ctx, doc, num, gen, orig_num, opts->rev_gen_list[num]);
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+	{
+		raw = NULL;
+	}
+
+	return raw;
+}
+
+static void queue_inflate_jobs(fz_context *ctx, pdf_document *doc, pdf_write_options *opts)
+{
+	inflater *inf = opts->inflater;
+	inflate_job *job;
+	fz_buffer *raw;
+	int num, initial;
+
+	if (!inf)
+		return;
+
+	while (inf->next < inf->order_len && inf->pending < inf->thread_count * 4 && inf->pending_raw < INFLATER_MAX_RAW)
+	{
+		num = inf->order[inf->next++];
+		raw = load_inflatable_stream(ctx, doc, opts, num, &initial);
+		if (!raw)
+			continue;
+
+		fz_try(ctx)
+		{
+			job = fz_malloc_struct(ctx, inflate_job);
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_buffer(ctx, raw);
+			fz_rethrow(ctx);
+		}
+		job->state = JOB_QUEUED;
+		job->initial = initial;
+		job->raw = raw;
+		inf->jobs[num] = job;
+		inf->pending++;
+		inf->pending_raw += raw->len;
+
+		pthread_mutex_lock(&inf->lock);
+		if (inf->tail)
+			inf->tail->next = job;
+		else
+			inf->head = job;
+		inf->tail = job;
+		pthread_cond_signal(&inf->work);
+		pthread_mutex_unlock(&inf->lock);
+	}
+}
+
+/*
+ * Take the job for num out of the inflater, once no worker is using it.
+ * A job that no worker has started yet is unqueued, and run here if
+ * wanted rather than waiting behind the others.
+ */
+static inflate_job *claim_inflate_job(inflater *inf, int num, int run)
+{
+	inflate_job *job = inf->jobs[num];
+	inflate_job *prev, *it;
+
+	if (!job)
+		return NULL;
+
+	pthread_mutex_lock(&inf->lock);
+	if (job->state == JOB_QUEUED)
+	{
+		prev = NULL;
+		for (it = inf->head; it != job; it = it->next)
+			prev = it;
+		if (prev)
+			prev->next = job->next;
+		else
+			inf->head = job->next;
+		if (inf->tail == job)
+			inf->tail = prev;
+		job->state = JOB_FAILED;
+	}
+	else
+	{
+		while (job->state == JOB_RUNNING)
+			pthread_cond_wait(&inf->done, &inf->lock);
+		run = 0;
+	}
+	pthread_mutex_unlock(&inf->lock);
+
+	if (run)
+		job->state = run_inflate_job(job) ? JOB_DONE : JOB_FAILED;
+
+	inf->jobs[num] = NULL;
+	inf->pending--;
+	inf->pending_raw -= job->raw->len;
+	return job;
+}
+
+static fz_buffer *take_inflated_stream(fz_context *ctx, pdf_write_options *opts, int num)
+{
+	inflater *inf = opts->inflater;
+	inflate_job *job;
+	fz_buffer *buf = NULL;
+
+	if (!inf || !(job = claim_inflate_job(inf, num, 1)))
+		return NULL;
+
+	fz_try(ctx)
+	{
+		if (job->state == JOB_DONE)
+		{
+			buf = fz_new_buffer(ctx, fz_maxi(job->len, 1));
+			memcpy(buf->data, job->data, job->len);
+			buf->len = job->len;
+		}
+	}
+	fz_always(ctx)
+	{
+		free_inflate_job(ctx, job);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+static void discard_inflate_job(fz_context *ctx, pdf_write_options *opts, int num)
+{
+	inflater *inf = opts->inflater;
+	inflate_job *job;
+
+	if (inf && (job = claim_inflate_job(inf, num, 0)) != NULL)
+		free_inflate_job(ctx, job);
+}
+
+#else
+
+static void new_inflater(fz_context *ctx, pdf_document *doc, pdf_write_options *opts)
+{
+}
+
+static void drop_inflater(fz_context *ctx, pdf_write_options *opts)
+{
+}
+
+static void queue_inflate_jobs(fz_context *ctx, pdf_document *doc, pdf_write_options *opts)
+{
+}
+
+static fz_buffer *take_inflated_stream(fz_context *ctx, pdf_write_options *opts, int num)
+{
+	return NULL;
+}
+
+static void discard_inflate_job(fz_context *ctx, pdf_write_options *opts, int num)
+{
+}
+
+#endif
+
 static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int num, int gen, int skip_xrefs)
 {
 	pdf_xref_entry *entry;
@@ -1725,36 +2407,10 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_options *o
 	}
 	else
 	{
-		int dontexpand = 0;
-		if (opts->do_expand != 0 && opts->do_expand != fz_expand_all)
-		{
-			pdf_obj *o;
-
-			if ((o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_XObject)) &&
-				(o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Image)))
-				dontexpand = !(opts->do_expand & fz_expand_images);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_Font))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_FontDescriptor))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Length1) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Length2) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Length3) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Type1C))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_CIDFontType0C))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Filter), filter_implies_image(ctx, doc, o))
-				dontexpand = !(opts->do_expand & fz_expand_images);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Width) != NULL && pdf_dict_get(ctx, obj, PDF_NAME_Height) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_images);
-		}
+		int expand = shouldexpand(ctx, doc, opts, obj);
 		fz_try(ctx)
 		{
-			if (opts->do_expand && !dontexpand && !pdf_is_jpx_image(ctx, obj))
+			if (expand)
 				expandstream(ctx, doc, opts, obj, num, gen);
 			else
 				copystream(ctx, doc, opts, obj, num, gen);
@@ -2066,7 +2722,11 @@ dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int n
 			padto(opts->out, opts->ofs_list[num]);
 		opts->ofs_list[num] = ftell(opts->out);
 		if (!opts->do_incremental || pdf_xref_is_incremental(ctx, doc, num))
+		{
+			queue_inflate_jobs(ctx, doc, opts);
 			writeobject(ctx, doc, opts, num, opts->gen_list[num], 1);
+			discard_inflate_job(ctx, opts, num);
+		}
 	}
 	else
 		opts->use_list[num] = 0;
@@ -2078,36 +2738,49 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int pa
 	int num;
 	int xref_len = pdf_xref_len(ctx, doc);
 
-	if (!opts->do_incremental)
+	new_inflater(ctx, doc, opts);
+
+	fz_try(ctx)
 	{
-		fprintf(opts->out, "%%PDF-%d.%d\n", doc->version / 10, doc->version % 10);
-		fputs("%%\316\274\341\277\246\n\n", opts->out);
-	}
+		if (!opts->do_incremental)
+		{
+			fprintf(opts->out, "%%PDF-%d.%d\n", doc->version / 10, doc->version % 10);
+			fputs("%%\316\274\341\277\246\n\n", opts->out);
+		}
 
-	dowriteobject(ctx, doc, opts, opts->start, pass);
+		dowriteobject(ctx, doc, opts, opts->start, pass);
 
-	if (opts->do_linear)
-	{
-		/* Write first xref */
-		if (pass == 0)
-			opts->first_xref_offset = ftell(opts->out);
-		else
-			padto(opts->out, opts->first_xref_offset);
-		writexref(ctx, doc, opts, opts->start, pdf_xref_len(ctx, doc), 1, opts->main_xref_offset, 0);
-	}
+		if (opts->do_linear)
+		{
+			/* Write first xref */
+			if (pass == 0)
+				opts->first_xref_offset = ftell(opts->out);
+			else
+				padto(opts->out, opts->first_xref_offset);
+			writexref(ctx, doc, opts, opts->start, pdf_xref_len(ctx, doc), 1, opts->main_xref_offset, 0);
+		}
 
-	for (num = opts->start+1; num < xref_len; num++)
-		dowriteobject(ctx, doc, opts, num, pass);
-	if (opts->do_linear && pass == 1)
+		for (num = opts->start+1; num < xref_len; num++)
+			dowriteobject(ctx, doc, opts, num, pass);
+		if (opts->do_linear && pass == 1)
+		{
+			int offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
+			padto(opts->out, offset);
+		}
+		for (num = 1; num < opts->start; num++)
+		{
+			if (pass == 1)
+				opts->ofs_list[num] += opts->hintstream_len;
+			dowriteobject(ctx, doc, opts, num, pass);
+		}
+	}
+	fz_always(ctx)
 	{
-		int offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
-		padto(opts->out, offset);
+		drop_inflater(ctx, opts);
 	}
-	for (num = 1; num < opts->start; num++)
+	fz_catch(ctx)
 	{
-		if (pass == 1)
-			opts->ofs_list[num] += opts->hintstream_len;
-		dowriteobject(ctx, doc, opts, num, pass);
+		fz_rethrow(ctx);
 	}
 }
 
@@ -1092,6 +1092,13 @@ pdf_load_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
 	}
 }
 
+static void
+pdf_want_range(fz_context *ctx, pdf_document *doc, int offset, int len)
+{
+	if (doc->file_ranged && len > 0)
+		fz_stream_meta(ctx, doc->file, FZ_STREAM_META_WANT, len, &offset);
+}
+
 static void
 pdf_load_linear(fz_context *ctx, pdf_document *doc)
 {
@@ -1120,6 +1127,12 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
 		if (len != doc->file_length)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "File has been updated since linearization");
 
+		/* Ask for the whole of the first page and the hint stream in
+		 * one go, rather than as the parser stumbles on each block. */
+		hint = pdf_dict_get(ctx, dict, PDF_NAME_H);
+		pdf_want_range(ctx, doc, 0, pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_E)));
+		pdf_want_range(ctx, doc, pdf_to_int(ctx, pdf_array_get(ctx, hint, 0)), pdf_to_int(ctx, pdf_array_get(ctx, hint, 1)));
+
 		pdf_read_xref_sections(ctx, doc, fz_tell(ctx, doc->file), &doc->lexbuf.base, 0);
 
 		doc->page_count = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_N));
@@ -1130,7 +1143,6 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
 		doc->linear_page1_obj_num = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_O));
 		doc->linear_page_refs[0] = pdf_new_indirect(ctx, doc, doc->linear_page1_obj_num, 0);
 		doc->linear_page_num = 0;
-		hint = pdf_dict_get(ctx, dict, PDF_NAME_H);
 		doc->hint_object_offset = pdf_to_int(ctx, pdf_array_get(ctx, hint, 0));
 		doc->hint_object_length = pdf_to_int(ctx, pdf_array_get(ctx, hint, 1));
 
@@ -1332,6 +1344,8 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* Check to see if we should work in progressive mode */
 		if (fz_stream_meta(ctx, doc->file, FZ_STREAM_META_PROGRESSIVE, 0, NULL) > 0)
 			doc->file_reading_linearly = 1;
+		if (fz_stream_meta(ctx, doc->file, FZ_STREAM_META_WANT, 0, NULL) > 0)
+			doc->file_ranged = 1;
 
 		/* Try to load the linearized file if we are in progressive
 		 * mode. */
@@ -1470,9 +1484,10 @@ pdf_close_document(fz_context *ctx, pdf_document *doc)
 		return;
 
 	/* Type3 glyphs in the glyph cache can contain pdf_obj pointers
-	 * that we are about to destroy. Simplest solution is to bin the
-	 * glyph cache at this point. */
-	fz_purge_glyph_cache(ctx);
+	 * that we are about to destroy. The glyph cache may be shared with
+	 * other documents, so only the glyphs of our Type3 fonts go. */
+	for (i = 0; i < doc->num_type3_fonts; i++)
+		fz_purge_glyph_cache_font(ctx, doc->type3_fonts[i]);
 
 	if (doc->js)
 		doc->drop_js(doc->js);
@@ -1518,7 +1533,7 @@ pdf_close_document(fz_context *ctx, pdf_document *doc)
 
 	pdf_drop_ocg(ctx, doc->ocg);
 
-	fz_empty_store(ctx);
+	pdf_empty_store(ctx, doc);
 
 	pdf_lexbuf_fin(ctx, &doc->lexbuf.base);
 
@@ -1547,74 +1562,172 @@ pdf_print_xref(fz_context *ctx, pdf_document *doc)
  * compressed object streams
  */
 
-static pdf_xref_entry *
-pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, int gen, pdf_lexbuf *buf, int target)
-{
-	fz_stream *stm = NULL;
-	pdf_obj *objstm = NULL;
-	int *numbuf = NULL;
-	int *ofsbuf = NULL;
+/*
+	The decompressed contents of an object stream and the offsets of the
+	objects in it are kept in the store, so that siblings of an object
+	that has been evicted from the xref can be parsed again without
+	inflating and lexing the whole stream a second time.
+*/
 
-	pdf_obj *obj;
-	int first;
+typedef struct pdf_obj_stm_s pdf_obj_stm;
+
+struct pdf_obj_stm_s
+{
+	fz_storable storable;
 	int count;
-	int i;
+	int first;
+	int *nums;
+	int *ofs;
+	fz_buffer *data;
+};
+
+static void
+pdf_drop_obj_stm_imp(fz_context *ctx, fz_storable *objstm_)
+{
+	pdf_obj_stm *objstm = (pdf_obj_stm *)objstm_;
+
+	fz_drop_buffer(ctx, objstm->data);
+	fz_free(ctx, objstm->nums);
+	fz_free(ctx, objstm->ofs);
+	fz_free(ctx, objstm);
+}
+
+static void
+pdf_drop_obj_stm(fz_context *ctx, pdf_obj_stm *objstm)
+{
+	if (objstm)
+		fz_drop_storable(ctx, &objstm->storable);
+}
+
+static unsigned int
+pdf_obj_stm_size(pdf_obj_stm *objstm)
+{
+	return sizeof(*objstm) + objstm->count * 2 * sizeof(int) + objstm->data->cap;
+}
+
+static pdf_obj_stm *
+pdf_load_obj_stm_index(fz_context *ctx, pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
+{
+	fz_stream *stm = NULL;
+	pdf_obj *dict;
+	pdf_obj_stm *objstm;
 	pdf_token tok;
-	pdf_xref_entry *ret_entry = NULL;
+	int i;
+
+	objstm = fz_malloc_struct(ctx, pdf_obj_stm);
+	FZ_INIT_STORABLE(objstm, 1, pdf_drop_obj_stm_imp);
 
-	fz_var(numbuf);
-	fz_var(ofsbuf);
-	fz_var(objstm);
 	fz_var(stm);
 
 	fz_try(ctx)
 	{
-		objstm = pdf_load_object(ctx, doc, num, gen);
-
-		count = pdf_to_int(ctx, pdf_dict_get(ctx, objstm, PDF_NAME_N));
-		first = pdf_to_int(ctx, pdf_dict_get(ctx, objstm, PDF_NAME_First));
+		dict = pdf_load_object(ctx, doc, num, gen);
+		objstm->count = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_N));
+		objstm->first = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_First));
+		pdf_drop_obj(ctx, dict);
 
-		if (count < 0)
+		if (objstm->count < 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "negative number of objects in object stream");
-		if (first < 0)
+		if (objstm->first < 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "first object in object stream resides outside stream");
 
-		numbuf = fz_calloc(ctx, count, sizeof(int));
-		ofsbuf = fz_calloc(ctx, count, sizeof(int));
+		objstm->nums = fz_calloc(ctx, objstm->count, sizeof(int));
+		objstm->ofs = fz_calloc(ctx, objstm->count, sizeof(int));
 
-		stm = pdf_open_stream(ctx, doc, num, gen);
-		for (i = 0; i < count; i++)
+		objstm->data = pdf_load_stream(ctx, doc, num, gen);
+		stm = fz_open_buffer(ctx, objstm->data);
+		for (i = 0; i < objstm->count; i++)
 		{
 			tok = pdf_lex(ctx, stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d %d R)", num, gen);
-			numbuf[i] = buf->i;
+			objstm->nums[i] = buf->i;
 
 			tok = pdf_lex(ctx, stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d %d R)", num, gen);
-			ofsbuf[i] = buf->i;
+			objstm->ofs[i] = buf->i;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_obj_stm(ctx, objstm);
+		fz_rethrow(ctx);
+	}
+
+	return objstm;
+}
+
+static void
+pdf_forget_obj_stm(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_obj *key = pdf_new_indirect(ctx, doc, num, 0);
+	fz_try(ctx)
+		pdf_remove_item(ctx, pdf_drop_obj_stm_imp, key);
+	fz_always(ctx)
+		pdf_drop_obj(ctx, key);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static pdf_xref_entry *
+pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, int gen, pdf_lexbuf *buf, int target)
+{
+	fz_stream *stm = NULL;
+	pdf_obj *key = NULL;
+	pdf_obj_stm *objstm = NULL;
+
+	pdf_obj *obj;
+	int all = 0;
+	int i;
+	pdf_xref_entry *ret_entry = NULL;
+
+	fz_var(key);
+	fz_var(objstm);
+	fz_var(stm);
+	fz_var(all);
+
+	fz_try(ctx)
+	{
+		key = pdf_new_indirect(ctx, doc, num, gen);
+		objstm = pdf_find_item(ctx, pdf_drop_obj_stm_imp, key);
+		if (!objstm)
+		{
+			/* Freshly decompressed: populate every object in the
+			 * stream, since their siblings are likely to be wanted
+			 * soon. Later visits only parse the target. */
+			objstm = pdf_load_obj_stm_index(ctx, doc, num, gen, buf);
+			pdf_store_item(ctx, key, objstm, pdf_obj_stm_size(objstm));
+			all = 1;
 		}
 
-		fz_seek(ctx, stm, first, SEEK_SET);
+		stm = fz_open_buffer(ctx, objstm->data);
 
-		for (i = 0; i < count; i++)
+		for (i = 0; i < objstm->count; i++)
 		{
 			int xref_len = pdf_xref_len(ctx, doc);
 			pdf_xref_entry *entry;
-			fz_seek(ctx, stm, first + ofsbuf[i], SEEK_SET);
+
+			if (!all && objstm->nums[i] != target)
+				continue;
+
+			fz_seek(ctx, stm, objstm->first + objstm->ofs[i], SEEK_SET);
 
 			obj = pdf_parse_stm_obj(ctx, doc, stm, buf);
 
-			if (numbuf[i] <= 0 || numbuf[i] >= xref_len)
+			if (objstm->nums[i] <= 0 || objstm->nums[i] >= xref_len)
 			{
 				pdf_drop_obj(ctx, obj);
-				fz_throw(ctx, FZ_ERROR_GENERIC, "object id (%d 0 R) out of range (0..%d)", numbuf[i], xref_len - 1);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "object id (%d 0 R) out of range (0..%d)", objstm->nums[i], xref_len - 1);
 			}
 
-			entry = pdf_get_xref_entry(ctx, doc, numbuf[i]);
+			entry = pdf_get_xref_entry(ctx, doc, objstm->nums[i]);
 
-			pdf_set_obj_parent(ctx, obj, numbuf[i]);
+			pdf_set_obj_parent(ctx, obj, objstm->nums[i]);
 
 			if (entry->type == 'o' && entry->ofs == num)
 			{
@@ -1627,12 +1740,12 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, int gen, pdf_lexbu
 				if (entry->obj)
 				{
 					if (pdf_objcmp(ctx, entry->obj, obj))
-						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", numbuf[i]);
+						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", objstm->nums[i]);
 					pdf_drop_obj(ctx, obj);
 				}
 				else
 					entry->obj = obj;
-				if (numbuf[i] == target)
+				if (objstm->nums[i] == target)
 					ret_entry = entry;
 			}
 			else
@@ -1644,9 +1757,8 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, int gen, pdf_lexbu
 	fz_always(ctx)
 	{
 		fz_drop_stream(ctx, stm);
-		fz_free(ctx, ofsbuf);
-		fz_free(ctx, numbuf);
-		pdf_drop_obj(ctx, objstm);
+		pdf_drop_obj_stm(ctx, objstm);
+		pdf_drop_obj(ctx, key);
 	}
 	fz_catch(ctx)
 	{
@@ -1786,11 +1898,35 @@ pdf_obj_read(fz_context *ctx, pdf_document *doc, int *offset, int *nump, pdf_obj
 	return 0;
 }
 
+/* Ask a ranged file for the bytes of a page's own objects and of the
+ * shared object groups it uses, as given by the hint tables. Groups
+ * in the first page section were asked for with that section (and the
+ * length of the last of them cannot be recovered anyway). */
+static void
+pdf_want_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
+{
+	int i, r, first_end;
+
+	if (!doc->file_ranged || !doc->hint_page || !doc->hint_shared)
+		return;
+	if (pagenum <= 0 || pagenum >= doc->page_count)
+		return;
+
+	first_end = pdf_to_int(ctx, pdf_dict_get(ctx, doc->linear_obj, PDF_NAME_E));
+	pdf_want_range(ctx, doc, doc->hint_page[pagenum].offset, doc->hint_page[pagenum+1].offset - doc->hint_page[pagenum].offset);
+	for (i = doc->hint_page[pagenum].index; i < doc->hint_page[pagenum+1].index; i++)
+	{
+		r = doc->hint_shared_ref[i];
+		if (doc->hint_shared[r].offset >= first_end)
+			pdf_want_range(ctx, doc, doc->hint_shared[r].offset, doc->hint_shared[r+1].offset - doc->hint_shared[r].offset);
+	}
+}
+
 static void
 pdf_load_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
 {
 
-	if (!doc->hints_loaded || !doc->linear_page_refs)
+	if (!doc->hints_loaded || !doc->hint_page || !doc->linear_page_refs)
 		return;
 
 	if (doc->linear_page_refs[pagenum])
@@ -2123,6 +2259,13 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 	x->obj = pdf_keep_obj(ctx, newobj);
 
 	pdf_set_obj_parent(ctx, newobj, num);
+
+	/* Only arrays and streams can make up content streams */
+	if (pdf_is_array(ctx, newobj) || pdf_dict_get(ctx, newobj, PDF_NAME_Length))
+	{
+		pdf_forget_content_tokens(ctx, doc, num);
+		pdf_forget_obj_stm(ctx, doc, num);
+	}
 }
 
 void
@@ -2146,6 +2289,9 @@ pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *n
 	fz_drop_buffer(ctx, x->stm_buf);
 	x->stm_buf = fz_keep_buffer(ctx, newbuf);
 
+	pdf_forget_content_tokens(ctx, doc, num);
+	pdf_forget_obj_stm(ctx, doc, num);
+
 	pdf_dict_puts_drop(ctx, obj, "Length", pdf_new_int(ctx, doc, newbuf->len));
 	if (!compressed)
 	{
@@ -2519,8 +2665,25 @@ pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum, int gennum)
 		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
 		/* Don't try to load hints again */
 		doc->hints_loaded = 1;
-		/* We won't use the linearized object any more. */
-		doc->file_reading_linearly = 0;
+		if (doc->file_ranged)
+		{
+			/* A ranged file has no other way to find the rest of
+			 * the document, so forget the tables and read through
+			 * the file instead. */
+			fz_free(ctx, doc->hint_page);
+			fz_free(ctx, doc->hint_shared_ref);
+			fz_free(ctx, doc->hint_shared);
+			fz_free(ctx, doc->hint_obj_offsets);
+			doc->hint_page = NULL;
+			doc->hint_shared_ref = NULL;
+			doc->hint_shared = NULL;
+			doc->hint_obj_offsets = NULL;
+		}
+		else
+		{
+			/* We won't use the linearized object any more. */
+			doc->file_reading_linearly = 0;
+		}
 		/* Any other error becomes a TRYLATER */
 		fz_throw(ctx, FZ_ERROR_TRYLATER, "malformed hints object");
 	}
@@ -2573,6 +2736,15 @@ pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum
 	int curr_pos;
 	pdf_obj *page;
 
+	/* A ranged file can fetch the hints and then the page directly,
+	 * without reading through the file up to them. */
+	if (doc->file_ranged && pagenum > 0 && pagenum < doc->page_count)
+	{
+		if (!doc->hints_loaded && doc->hint_object_offset > 0)
+			pdf_load_hint_object(ctx, doc);
+		pdf_want_hinted_page(ctx, doc, pagenum);
+	}
+
 	pdf_load_hinted_page(ctx, doc, pagenum);
 
 	if (pagenum < 0 || pagenum >= doc->page_count)
@@ -2581,6 +2753,12 @@ pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum
 	if (doc->linear_pos == doc->file_length)
 		return doc->linear_page_refs[pagenum];
 
+	/* The first page is in the first xref section, and with hints the
+	 * rest of any other page can be found without reading through to
+	 * it. */
+	if (doc->file_ranged && (pagenum == 0 || doc->hint_page) && doc->linear_page_refs[pagenum])
+		return doc->linear_page_refs[pagenum];
+
 	/* Only load hints once, and then only after we have got page 0 */
 	if (pagenum > 0 && !doc->hints_loaded && doc->hint_object_offset > 0 && doc->linear_pos >= doc->hint_object_offset)
 	{